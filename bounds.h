@@ -0,0 +1,102 @@
+#ifndef SPONZA_BOUNDS_H
+#define SPONZA_BOUNDS_H
+
+#include <cfloat>
+#include <glm/glm.hpp>
+#include "types.h"
+
+// An axis aligned box plus a bounding sphere around the same geometry.
+// The sphere is centered on the box, which is cheap to compute and close to
+// optimal for the mostly boxy objects in architectural scenes.
+struct Bounds {
+    glm::vec3 min;
+    glm::vec3 max;
+    glm::vec3 center;
+    f32 radius; // negative if the bounds contain nothing
+};
+
+inline Bounds emptyBounds() {
+    return Bounds { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX), glm::vec3(0), -1 };
+}
+
+inline bool isEmpty(const Bounds &bounds) {
+    return bounds.radius < 0;
+}
+
+// Grows the box to include point. Call centerBounds once every point is added.
+inline void addPoint(Bounds &bounds, glm::vec3 point) {
+    bounds.min = glm::min(bounds.min, point);
+    bounds.max = glm::max(bounds.max, point);
+}
+
+// Grows the box to include another box. Empty boxes are skipped.
+inline void addBox(Bounds &bounds, const Bounds &box) {
+    if (box.min.x > box.max.x) return;
+    bounds.min = glm::min(bounds.min, box.min);
+    bounds.max = glm::max(bounds.max, box.max);
+}
+
+// Grows the sphere to include point, keeping its center.
+inline void addSpherePoint(Bounds &bounds, glm::vec3 point) {
+    glm::vec3 offset = point - bounds.center;
+    f32 dist2 = glm::dot(offset, offset);
+    if (dist2 > bounds.radius * bounds.radius) bounds.radius = glm::sqrt(dist2);
+}
+
+// Centers the sphere on the box, with zero radius. Follow with addSpherePoint for every point.
+inline void centerBounds(Bounds &bounds) {
+    if (bounds.min.x > bounds.max.x) return; // no points
+    bounds.center = (bounds.min + bounds.max) * 0.5f;
+    bounds.radius = 0;
+}
+
+// Grows into to contain other. The sphere stays tight only when the two don't overlap much.
+inline void mergeBounds(Bounds &into, const Bounds &other) {
+    if (isEmpty(other)) return;
+    if (isEmpty(into)) {
+        into = other;
+        return;
+    }
+    into.min = glm::min(into.min, other.min);
+    into.max = glm::max(into.max, other.max);
+
+    glm::vec3 offset = other.center - into.center;
+    f32 dist = glm::length(offset);
+    if (dist + other.radius <= into.radius) return;
+    if (dist + into.radius <= other.radius) {
+        into.center = other.center;
+        into.radius = other.radius;
+        return;
+    }
+    f32 radius = (dist + into.radius + other.radius) * 0.5f;
+    into.center += offset * ((radius - into.radius) / dist);
+    into.radius = radius;
+}
+
+// The six planes of the frustum of a view projection matrix, in the space it transforms from.
+// Each is (normal, distance) with the normal pointing into the frustum.
+inline void extractFrustum(const glm::mat4 &m, glm::vec4 planes[6]) {
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    planes[0] = row3 + row0;
+    planes[1] = row3 - row0;
+    planes[2] = row3 + row1;
+    planes[3] = row3 - row1;
+    planes[4] = row3 + row2;
+    planes[5] = row3 - row2;
+    for (int c = 0; c < 6; c++) {
+        planes[c] /= glm::length(glm::vec3(planes[c]));
+    }
+}
+
+// False if the sphere is entirely outside one of the planes.
+inline bool sphereInFrustum(const glm::vec4 planes[6], glm::vec3 center, f32 radius) {
+    for (int c = 0; c < 6; c++) {
+        if (glm::dot(glm::vec3(planes[c]), center) + planes[c].w < -radius) return false;
+    }
+    return true;
+}
+
+#endif //SPONZA_BOUNDS_H
@@ -0,0 +1,119 @@
+#include "culling.h"
+#include "mesh.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace glm;
+
+void clearBoxes(BoxList &boxes) {
+    boxes.minX.clear();
+    boxes.minY.clear();
+    boxes.minZ.clear();
+    boxes.maxX.clear();
+    boxes.maxY.clear();
+    boxes.maxZ.clear();
+}
+
+void pushBox(BoxList &boxes, const vec3 &min, const vec3 &max) {
+    boxes.minX.push_back(min.x);
+    boxes.minY.push_back(min.y);
+    boxes.minZ.push_back(min.z);
+    boxes.maxX.push_back(max.x);
+    boxes.maxY.push_back(max.y);
+    boxes.maxZ.push_back(max.z);
+}
+
+void buildCullBoxes(const Mesh &mesh, BoxList &boxes) {
+    clearBoxes(boxes);
+    for (const ObjectPart &op : mesh.objectParts) {
+        const Bounds &bounds = mesh.objects[op.object].bounds;
+        pushBox(boxes, bounds.min, bounds.max);
+    }
+    for (u32 objectPart = 0; objectPart + 1 < mesh.firstInstance.size(); objectPart++) {
+        const Bounds &bounds = mesh.objects[mesh.objectParts[objectPart].object].bounds;
+        vec3 center = (bounds.min + bounds.max) * 0.5f;
+        vec3 extent = bounds.max - center;
+        for (u32 c = mesh.firstInstance[objectPart], end = mesh.firstInstance[objectPart + 1]; c < end; c++) {
+            // The box around the transformed box, from its center and the absolute matrix.
+            const mat4 &m = mesh.instances[c];
+            vec3 worldCenter = vec3(m * vec4(center, 1));
+            vec3 worldExtent = abs(vec3(m[0])) * extent.x + abs(vec3(m[1])) * extent.y + abs(vec3(m[2])) * extent.z;
+            pushBox(boxes, worldCenter - worldExtent, worldCenter + worldExtent);
+        }
+    }
+}
+
+// A box is outside a plane when its corner furthest along the plane's normal is. Which corner
+// that is depends only on the plane, so each plane reads the min or max array of each axis.
+struct CullPlane {
+    const f32 *x;
+    const f32 *y;
+    const f32 *z;
+    vec4 plane;
+};
+
+static inline bool boxVisible(const CullPlane planes[6], u32 c) {
+    for (int p = 0; p < 6; p++) {
+        const vec4 &plane = planes[p].plane;
+        if (plane.x * planes[p].x[c] + plane.y * planes[p].y[c] + plane.z * planes[p].z[c] + plane.w < 0) return false;
+    }
+    return true;
+}
+
+#ifdef __SSE2__
+struct SimdPlane {
+    const f32 *x, *y, *z;
+    __m128 nx, ny, nz, d;
+};
+
+static inline SimdPlane simdPlane(const CullPlane &plane) {
+    return SimdPlane { plane.x, plane.y, plane.z, _mm_set1_ps(plane.plane.x), _mm_set1_ps(plane.plane.y),
+                       _mm_set1_ps(plane.plane.z), _mm_set1_ps(plane.plane.w) };
+}
+
+// All ones in the lanes of boxes c to c + 3 that are outside the plane.
+static inline __m128 outsidePlane(const SimdPlane &plane, u32 c) {
+    __m128 dist = _mm_add_ps(_mm_mul_ps(plane.nx, _mm_loadu_ps(plane.x + c)), plane.d);
+    dist = _mm_add_ps(dist, _mm_mul_ps(plane.ny, _mm_loadu_ps(plane.y + c)));
+    dist = _mm_add_ps(dist, _mm_mul_ps(plane.nz, _mm_loadu_ps(plane.z + c)));
+    return _mm_cmplt_ps(dist, _mm_setzero_ps());
+}
+#endif
+
+u32 cullBoxes(const BoxList &boxes, const vec4 frustum[6], u8 *visible, u32 first) {
+    CullPlane planes[6];
+    for (int p = 0; p < 6; p++) {
+        const vec4 &plane = frustum[p];
+        planes[p].x = plane.x > 0 ? boxes.maxX.data() : boxes.minX.data();
+        planes[p].y = plane.y > 0 ? boxes.maxY.data() : boxes.minY.data();
+        planes[p].z = plane.z > 0 ? boxes.maxZ.data() : boxes.minZ.data();
+        planes[p].plane = plane;
+    }
+
+    u32 count = boxCount(boxes), numVisible = 0, c = first;
+#ifdef __SSE2__
+    SimdPlane simd[6];
+    for (int p = 0; p < 6; p++) {
+        simd[p] = simdPlane(planes[p]);
+    }
+    for (; c + 4 <= count; c += 4) {
+        // Written out rather than looped, so the planes stay in registers.
+        __m128 outside = _mm_or_ps(_mm_or_ps(outsidePlane(simd[0], c), outsidePlane(simd[1], c)),
+                                   _mm_or_ps(outsidePlane(simd[2], c), outsidePlane(simd[3], c)));
+        outside = _mm_or_ps(outside, _mm_or_ps(outsidePlane(simd[4], c), outsidePlane(simd[5], c)));
+        u32 mask = u32(_mm_movemask_ps(outside));
+        for (u32 k = 0; k < 4; k++) {
+            visible[c + k] = u8(~mask >> k & 1);
+            numVisible += visible[c + k];
+        }
+    }
+#endif
+    for (; c < count; c++) {
+        visible[c] = boxVisible(planes, c);
+        numVisible += visible[c];
+    }
+    return numVisible;
+}
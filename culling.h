@@ -0,0 +1,33 @@
+#ifndef SPONZA_CULLING_H
+#define SPONZA_CULLING_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "bounds.h"
+#include "types.h"
+
+struct Mesh;
+
+// World space boxes with each coordinate in its own array, so cullBoxes can test several at once.
+struct BoxList {
+    std::vector<f32> minX, minY, minZ;
+    std::vector<f32> maxX, maxY, maxZ;
+};
+
+inline u32 boxCount(const BoxList &boxes) {
+    return u32(boxes.minX.size());
+}
+
+void clearBoxes(BoxList &boxes);
+void pushBox(BoxList &boxes, const glm::vec3 &min, const glm::vec3 &max);
+
+// The boxes draw() culls: the bounds of every object part, then the transformed bounds of every
+// instance (see Mesh::instances). An object part with instances gets a box too, but it's unused.
+void buildCullBoxes(const Mesh &mesh, BoxList &boxes);
+
+// Sets visible[i] to 1 if box i is at least partly inside all six planes (see extractFrustum),
+// else 0, for every box from first on, leaving visible[i] before first alone. Tests boxes 4 at a
+// time with SSE2. Returns the number of visible boxes tested.
+u32 cullBoxes(const BoxList &boxes, const glm::vec4 planes[6], u8 *visible, u32 first = 0);
+
+#endif //SPONZA_CULLING_H
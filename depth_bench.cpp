@@ -0,0 +1,141 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "depth_bench.h"
+#include "gl_includes.h"
+#include "material.h"
+
+using namespace std;
+using namespace glm;
+
+const u32 kBenchRounds = 8;
+const u32 kBenchFrames = 32; // per round and layout
+
+// Draws everything at full detail, object parts with instances once per instance as drawInstances
+// in main.cpp does, and runs of the rest of each part in one draw.
+static void drawDepth(const Mesh &mesh) {
+    glClear(GL_DEPTH_BUFFER_BIT);
+    auto drawRange = [&](const MeshPart &mp, u32 offset, u32 size) {
+        glDrawElementsBaseVertex(GL_TRIANGLES, size, mp.indexType,
+                                 (void *)(uintptr_t(offset) * indexSize(mp.indexType)), GLint(mp.baseVertex));
+    };
+    if (mesh.firstInstance.empty()) {
+        for (const MeshPart &mp : mesh.parts) {
+            drawRange(mp, mp.offset, mp.size);
+        }
+        return;
+    }
+
+    u32 runPart = 0, runOffset = 0, runSize = 0;
+    for (u32 c = 0, n = u32(mesh.objectParts.size()); c <= n; c++) {
+        const ObjectPart *op = c < n ? &mesh.objectParts[c] : nullptr;
+        u32 first = op ? mesh.firstInstance[c] : 0, end = op ? mesh.firstInstance[c + 1] : 0;
+        bool joins = op && first == end && op->part == runPart && op->offset == runOffset + runSize;
+        if (runSize > 0 && !joins) {
+            drawRange(mesh.parts[runPart], runOffset, runSize);
+            runSize = 0;
+        }
+        if (!op) break;
+        if (first == end) {
+            if (runSize == 0) {
+                runPart = op->part;
+                runOffset = op->offset;
+            }
+            runSize += op->size;
+            continue;
+        }
+        const MeshPart &mp = mesh.parts[op->part];
+        bindInstances(s32(first));
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, op->size, mp.indexType,
+                                          (void *)(uintptr_t(op->offset) * indexSize(mp.indexType)), end - first,
+                                          GLint(mp.baseVertex));
+        bindInstances(-1);
+    }
+}
+
+void runDepthBench(const Mesh &mesh, const mat4 &mvp) {
+    if (!mesh.positionVao || !mesh.partBindings.empty()) {
+        printf("Depth bench: the mesh has no split vertex buffer\n");
+        return;
+    }
+
+    // Read the split vertices back and interleave them again.
+    GLint verts, indices, bytes;
+    glBindVertexArray(mesh.vao);
+    glGetVertexAttribiv(VAO_POS, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &verts);
+    glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &indices);
+    glBindBuffer(GL_ARRAY_BUFFER, GLuint(verts));
+    glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &bytes);
+    vector<u8> split(bytes);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, bytes, split.data());
+
+    u32 size = vertexSize(mesh.vertexFormat);
+    u32 position = positionSize(mesh.vertexFormat);
+    u32 numVerts = u32(bytes) / size;
+    vector<u8> interleaved(split.size());
+    for (u32 c = 0; c < numVerts; c++) {
+        memcpy(&interleaved[u64(c) * size], &split[u64(c) * position], position);
+        memcpy(&interleaved[u64(c) * size + position], &split[u64(numVerts) * position + u64(c) * (size - position)],
+               size - position);
+    }
+
+    GLuint vao, buffer;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, interleaved.size(), interleaved.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, GLuint(indices));
+    bindVertexAttribs(mesh.vertexFormat);
+    GLuint interleavedVao = createPositionVao(vao, mesh.vertexFormat, 0);
+    checkError();
+
+    const char *names[2] = { "interleaved", "split" };
+    GLuint vaos[2] = { interleavedVao, mesh.positionVao };
+    u32 strides[2] = { size, position };
+    GLuint queries[2];
+    glGenQueries(2, queries);
+    u64 nanoseconds[2] = {};
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    bindVertexFormat(mesh.vertexFormat, mesh.positionOffset, mesh.positionScale);
+    bindDepthShader(mvp);
+    if (mesh.instanceTexture) {
+        glActiveTexture(GL_TEXTURE5); // see bindUniforms
+        glBindTexture(GL_TEXTURE_BUFFER, mesh.instanceTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+    for (u32 layout = 0; layout < 2; layout++) {
+        glBindVertexArray(vaos[layout]);
+        drawDepth(mesh); // warm up
+    }
+    glFinish();
+    for (u32 round = 0; round < kBenchRounds; round++) {
+        for (u32 layout = 0; layout < 2; layout++) {
+            glBindVertexArray(vaos[layout]);
+            glBeginQuery(GL_TIME_ELAPSED, queries[layout]);
+            for (u32 frame = 0; frame < kBenchFrames; frame++) {
+                drawDepth(mesh);
+            }
+            glEndQuery(GL_TIME_ELAPSED);
+            GLuint64 elapsed;
+            glGetQueryObjectui64v(queries[layout], GL_QUERY_RESULT, &elapsed);
+            nanoseconds[layout] += elapsed;
+        }
+    }
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    checkError();
+
+    printf("Depth only, %u vertices, %u frames each:\n", numVerts, kBenchRounds * kBenchFrames);
+    for (u32 layout = 0; layout < 2; layout++) {
+        printf("  %-12s %7.3f ms/frame (%u byte position stride)\n", names[layout],
+               nanoseconds[layout] * 1e-6 / (kBenchRounds * kBenchFrames), strides[layout]);
+    }
+
+    glDeleteQueries(2, queries);
+    glDeleteVertexArrays(1, &interleavedVao);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &buffer);
+    glBindVertexArray(mesh.vao);
+}
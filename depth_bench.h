@@ -0,0 +1,13 @@
+#ifndef SPONZA_DEPTH_BENCH_H
+#define SPONZA_DEPTH_BENCH_H
+
+#include <glm/glm.hpp>
+#include "mesh.h"
+
+// Renders the mesh depth only from mvp with its vertices interleaved and split (see createVao),
+// alternating between the two, and prints the GPU time per frame of each. Object parts with
+// instances are drawn once per instance, as in the main view. Needs a mesh with a positionVao,
+// as built by obj2mesh or loaded from the mesh cache.
+void runDepthBench(const Mesh &mesh, const glm::mat4 &mvp);
+
+#endif //SPONZA_DEPTH_BENCH_H
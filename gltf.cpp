@@ -0,0 +1,801 @@
+#include "gltf.h"
+#include "material.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <glm/gtc/quaternion.hpp>
+#include <stb/stb_image.h>
+
+using namespace std;
+using namespace glm;
+
+int loadTexture(GLuint texname, const char *filename, int format);
+int loadTextureFromMemory(GLuint texname, const u8 *data, u32 size, const char *name, int format);
+
+// ------------------ Begin JSON -------------------
+
+// Just enough JSON for the glTF header. Objects keep their keys in order, and lookups
+// of missing keys or indices return a null value, so optional fields chain without checks.
+struct JsonValue {
+    enum Type : u8 { kNull, kBool, kNumber, kString, kArray, kObject };
+    Type type = kNull;
+    bool boolean = false;
+    f64 number = 0;
+    string str;
+    vector<string> keys;      // object keys, parallel to items
+    vector<JsonValue> items;  // array elements or object values
+
+    const JsonValue &operator[](const string &key) const;
+    const JsonValue &operator[](size_t index) const;
+    size_t size() const { return items.size(); }
+    bool isNull() const { return type == kNull; }
+    f64 num(f64 fallback) const { return type == kNumber ? number : fallback; }
+    s32 integer(s32 fallback) const { return type == kNumber ? s32(number) : fallback; }
+};
+
+static const JsonValue jsonNull;
+
+const JsonValue &JsonValue::operator[](const string &key) const {
+    for (size_t c = 0, n = keys.size(); c < n; c++) {
+        if (keys[c] == key) return items[c];
+    }
+    return jsonNull;
+}
+
+const JsonValue &JsonValue::operator[](size_t index) const {
+    return index < items.size() ? items[index] : jsonNull;
+}
+
+struct JsonParser {
+    const char *pos;
+    const char *end;
+    bool failed;
+};
+
+static void skipSpace(JsonParser &parser) {
+    while (parser.pos < parser.end &&
+           (*parser.pos == ' ' || *parser.pos == '\t' || *parser.pos == '\n' || *parser.pos == '\r')) {
+        parser.pos++;
+    }
+}
+
+static bool consume(JsonParser &parser, char c) {
+    skipSpace(parser);
+    if (parser.pos < parser.end && *parser.pos == c) {
+        parser.pos++;
+        return true;
+    }
+    return false;
+}
+
+static void appendUtf8(string &str, u32 code) {
+    if (code < 0x80) {
+        str += char(code);
+    } else if (code < 0x800) {
+        str += char(0xC0 | (code >> 6));
+        str += char(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        str += char(0xE0 | (code >> 12));
+        str += char(0x80 | ((code >> 6) & 0x3F));
+        str += char(0x80 | (code & 0x3F));
+    } else {
+        str += char(0xF0 | (code >> 18));
+        str += char(0x80 | ((code >> 12) & 0x3F));
+        str += char(0x80 | ((code >> 6) & 0x3F));
+        str += char(0x80 | (code & 0x3F));
+    }
+}
+
+static bool parseHex4(JsonParser &parser, u32 &code) {
+    if (parser.end - parser.pos < 4) return false;
+    code = 0;
+    for (int c = 0; c < 4; c++) {
+        char h = *parser.pos++;
+        code <<= 4;
+        if (h >= '0' && h <= '9') code |= h - '0';
+        else if (h >= 'a' && h <= 'f') code |= h - 'a' + 10;
+        else if (h >= 'A' && h <= 'F') code |= h - 'A' + 10;
+        else return false;
+    }
+    return true;
+}
+
+// Expects the opening quote to be consumed already.
+static bool parseString(JsonParser &parser, string &str) {
+    while (parser.pos < parser.end) {
+        char c = *parser.pos++;
+        if (c == '"') return true;
+        if (c != '\\') {
+            str += c;
+            continue;
+        }
+        if (parser.pos >= parser.end) return false;
+        char escape = *parser.pos++;
+        switch (escape) {
+            case '"': str += '"'; break;
+            case '\\': str += '\\'; break;
+            case '/': str += '/'; break;
+            case 'b': str += '\b'; break;
+            case 'f': str += '\f'; break;
+            case 'n': str += '\n'; break;
+            case 'r': str += '\r'; break;
+            case 't': str += '\t'; break;
+            case 'u': {
+                u32 code;
+                if (!parseHex4(parser, code)) return false;
+                if (code >= 0xD800 && code < 0xDC00 && parser.end - parser.pos >= 6 &&
+                    parser.pos[0] == '\\' && parser.pos[1] == 'u') {
+                    parser.pos += 2;
+                    u32 low;
+                    if (!parseHex4(parser, low)) return false;
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                appendUtf8(str, code);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
+static bool matchWord(JsonParser &parser, const char *word) {
+    size_t len = strlen(word);
+    if (size_t(parser.end - parser.pos) < len || memcmp(parser.pos, word, len) != 0) return false;
+    parser.pos += len;
+    return true;
+}
+
+static void parseValue(JsonParser &parser, JsonValue &value, int depth) {
+    skipSpace(parser);
+    if (parser.pos >= parser.end || depth > 64) {
+        parser.failed = true;
+        return;
+    }
+
+    char c = *parser.pos;
+    if (c == '{') {
+        parser.pos++;
+        value.type = JsonValue::kObject;
+        if (consume(parser, '}')) return;
+        do {
+            value.keys.emplace_back();
+            value.items.emplace_back();
+            if (!consume(parser, '"') || !parseString(parser, value.keys.back()) || !consume(parser, ':')) {
+                parser.failed = true;
+                return;
+            }
+            parseValue(parser, value.items.back(), depth + 1);
+            if (parser.failed) return;
+        } while (consume(parser, ','));
+        if (!consume(parser, '}')) parser.failed = true;
+    } else if (c == '[') {
+        parser.pos++;
+        value.type = JsonValue::kArray;
+        if (consume(parser, ']')) return;
+        do {
+            value.items.emplace_back();
+            parseValue(parser, value.items.back(), depth + 1);
+            if (parser.failed) return;
+        } while (consume(parser, ','));
+        if (!consume(parser, ']')) parser.failed = true;
+    } else if (c == '"') {
+        parser.pos++;
+        value.type = JsonValue::kString;
+        if (!parseString(parser, value.str)) parser.failed = true;
+    } else if (matchWord(parser, "true")) {
+        value.type = JsonValue::kBool;
+        value.boolean = true;
+    } else if (matchWord(parser, "false")) {
+        value.type = JsonValue::kBool;
+    } else if (matchWord(parser, "null")) {
+        value.type = JsonValue::kNull;
+    } else {
+        // The text is null terminated (see parseJson), so strtod can't run off the end.
+        char *numberEnd;
+        value.type = JsonValue::kNumber;
+        value.number = strtod(parser.pos, &numberEnd);
+        if (numberEnd == parser.pos) parser.failed = true;
+        parser.pos = numberEnd;
+    }
+}
+
+static bool parseJson(const string &text, JsonValue &root) {
+    JsonParser parser = { text.c_str(), text.c_str() + text.size(), false };
+    parseValue(parser, root, 0);
+    skipSpace(parser);
+    return !parser.failed && parser.pos == parser.end;
+}
+
+// ------------------ End JSON -------------------
+
+
+
+// ------------------ Begin GLB -------------------
+
+#define GLB_MAGIC 0x46546C67 // "glTF"
+#define GLB_CHUNK_JSON 0x4E4F534A
+#define GLB_CHUNK_BIN 0x004E4942
+
+#define GLTF_MODE_TRIANGLES 4
+
+struct GlbHeader {
+    u32 magic;
+    u32 version;
+    u32 length;
+};
+
+struct GlbChunk {
+    u32 length;
+    u32 type;
+};
+
+// A glTF buffer, with the range of it that holds geometry and is uploaded to GL.
+struct GltfBuffer {
+    const u8 *data = nullptr;
+    u64 size = 0;
+    u64 uploadStart = ~u64(0);
+    u64 uploadEnd = 0;
+    GLuint glBuffer = 0;
+};
+
+// An accessor resolved through its buffer view.
+struct GltfAccessor {
+    u32 buffer;
+    u64 offset;     // from the start of the buffer
+    u32 stride;     // in bytes
+    u32 count;
+    u32 components; // 1 for SCALAR up to 4 for VEC4
+    u32 componentType;
+    bool normalized;
+    const JsonValue *json;
+};
+
+static u32 componentCount(const string &type) {
+    if (type == "SCALAR") return 1;
+    if (type == "VEC2") return 2;
+    if (type == "VEC3") return 3;
+    if (type == "VEC4") return 4;
+    return 0;
+}
+
+static u32 componentSize(u32 componentType) {
+    switch (componentType) {
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE:
+            return 1;
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:
+            return 2;
+        case GL_UNSIGNED_INT:
+        case GL_FLOAT:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+static bool resolveAccessor(const JsonValue &gltf, const vector<GltfBuffer> &buffers, s32 index, GltfAccessor &accessor) {
+    const JsonValue &json = gltf["accessors"][size_t(index)];
+    if (json.isNull() || index < 0) {
+        printf("glTF: missing accessor %d\n", index);
+        return false;
+    }
+    if (!json["sparse"].isNull()) {
+        printf("glTF: sparse accessors are not supported\n");
+        return false;
+    }
+    const JsonValue &view = gltf["bufferViews"][size_t(json["bufferView"].integer(-1))];
+    if (view.isNull()) {
+        printf("glTF: accessor %d has no buffer view\n", index);
+        return false;
+    }
+
+    accessor.buffer = u32(view["buffer"].integer(-1));
+    accessor.offset = u64(view["byteOffset"].num(0)) + u64(json["byteOffset"].num(0));
+    accessor.count = u32(json["count"].integer(0));
+    accessor.components = componentCount(json["type"].str);
+    accessor.componentType = u32(json["componentType"].integer(0));
+    accessor.normalized = json["normalized"].boolean;
+    accessor.json = &json;
+
+    u32 elementSize = accessor.components * componentSize(accessor.componentType);
+    accessor.stride = u32(view["byteStride"].integer(s32(elementSize)));
+    if (accessor.buffer >= buffers.size() || elementSize == 0) {
+        printf("glTF: accessor %d has a bad buffer or type\n", index);
+        return false;
+    }
+    u64 viewEnd = u64(view["byteOffset"].num(0)) + u64(view["byteLength"].num(0));
+    u64 accessorEnd = accessor.offset + (accessor.count ? u64(accessor.count - 1) * accessor.stride + elementSize : 0);
+    if (accessorEnd > viewEnd || viewEnd > buffers[accessor.buffer].size) {
+        printf("glTF: accessor %d runs past the end of its buffer\n", index);
+        return false;
+    }
+    return true;
+}
+
+// Marks the accessor's bytes as geometry, to be uploaded.
+static void useAccessor(vector<GltfBuffer> &buffers, const GltfAccessor &accessor) {
+    GltfBuffer &buffer = buffers[accessor.buffer];
+    u32 elementSize = accessor.components * componentSize(accessor.componentType);
+    u64 end = accessor.offset + (accessor.count ? u64(accessor.count - 1) * accessor.stride + elementSize : 0);
+    buffer.uploadStart = std::min(buffer.uploadStart, accessor.offset);
+    buffer.uploadEnd = std::max(buffer.uploadEnd, end);
+}
+
+static mat4 nodeTransform(const JsonValue &node) {
+    const JsonValue &matrix = node["matrix"];
+    if (matrix.size() == 16) {
+        mat4 result;
+        for (u32 c = 0; c < 16; c++) {
+            result[c / 4][c % 4] = f32(matrix[c].num(0)); // glTF matrices are column major too
+        }
+        return result;
+    }
+
+    const JsonValue &t = node["translation"];
+    const JsonValue &r = node["rotation"];
+    const JsonValue &s = node["scale"];
+    mat4 translation(1);
+    translation[3] = vec4(f32(t[0].num(0)), f32(t[1].num(0)), f32(t[2].num(0)), 1);
+    quat rotation(f32(r[3].num(1)), f32(r[0].num(0)), f32(r[1].num(0)), f32(r[2].num(0)));
+    mat4 scale(1);
+    scale[0][0] = f32(s[0].num(1));
+    scale[1][1] = f32(s[1].num(1));
+    scale[2][2] = f32(s[2].num(1));
+    return translation * mat4_cast(rotation) * scale;
+}
+
+// A mesh under a node, placed in the world.
+struct GltfInstance {
+    u32 node;
+    u32 mesh;
+    mat4 transform;
+};
+
+static void collectInstances(const JsonValue &gltf, u32 nodeIndex, const mat4 &parent,
+                             vector<GltfInstance> &instances, vector<bool> &visited) {
+    const JsonValue &node = gltf["nodes"][nodeIndex];
+    if (node.isNull() || visited[nodeIndex]) return; // a node can only have one parent, so this is a bad file
+    visited[nodeIndex] = true;
+
+    mat4 transform = parent * nodeTransform(node);
+    if (!node["mesh"].isNull()) {
+        instances.push_back(GltfInstance { nodeIndex, u32(node["mesh"].integer(0)), transform });
+    }
+    const JsonValue &children = node["children"];
+    for (size_t c = 0, n = children.size(); c < n; c++) {
+        collectInstances(gltf, u32(children[c].integer(-1)), transform, instances, visited);
+    }
+}
+
+// Returns the image behind a textureInfo, or -1.
+static s32 textureImage(const JsonValue &gltf, const JsonValue &textureInfo) {
+    if (textureInfo.isNull()) return -1;
+    const JsonValue &texture = gltf["textures"][size_t(textureInfo["index"].integer(-1))];
+    return texture["source"].integer(-1);
+}
+
+// glTF has no ambient term. Split the base color the way Sponza's materials split theirs.
+const f32 gltfAmbientFraction = 0.588f;
+const f32 gltfDiffuseFraction = 0.588f;
+
+static void gltf2mesh_material(const JsonValue &gltf, const JsonValue &json, Material &mat, vector<bool> &imageUsed) {
+    const JsonValue &pbr = json["pbrMetallicRoughness"];
+    const JsonValue &baseColor = pbr["baseColorFactor"];
+    vec3 base(f32(baseColor[0].num(1)), f32(baseColor[1].num(1)), f32(baseColor[2].num(1)));
+    f32 roughness = std::max(f32(pbr["roughnessFactor"].num(1)), 0.05f);
+    const JsonValue &emissive = json["emissiveFactor"];
+
+    mat.name = json["name"].str;
+    mat.Ns = std::max(2 / (roughness * roughness * roughness * roughness) - 2, 1.0f); // Beckmann to Phong
+    mat.d = f32(baseColor[3].num(1));
+    mat.Tf = vec3(1);
+    mat.Ka = base * gltfAmbientFraction;
+    mat.Kd = base * gltfDiffuseFraction;
+    mat.Ks = vec3(0);
+    mat.Ke = vec3(f32(emissive[0].num(0)), f32(emissive[1].num(0)), f32(emissive[2].num(0)));
+    mat.map_Ka = TEX_UNLOADED;
+    mat.map_Kd = TEX_UNLOADED;
+    mat.map_Ks = TEX_UNLOADED;
+    mat.map_Ke = TEX_UNLOADED;
+    mat.map_Ns = TEX_UNLOADED;
+    mat.map_d = TEX_UNLOADED;
+    mat.map_bump = TEX_UNLOADED;
+    mat.flags = 0;
+
+    s32 baseImage = textureImage(gltf, pbr["baseColorTexture"]);
+    if (baseImage >= 0 && baseImage < s32(imageUsed.size())) {
+        mat.map_Ka = mat.map_Kd = u16(baseImage);
+        mat.flags |= MAT_AMBIENT_TEX | MAT_DIFFUSE_TEX;
+        imageUsed[baseImage] = true;
+    }
+    s32 normalImage = textureImage(gltf, json["normalTexture"]);
+    if (normalImage >= 0 && normalImage < s32(imageUsed.size())) {
+        mat.map_bump = u16(normalImage);
+        mat.flags |= MAT_NORMAL_TANGENT_TEX;
+        imageUsed[normalImage] = true;
+    }
+}
+
+// Undoes the %XX escapes in a URI.
+static string decodeUri(const string &uri) {
+    string result;
+    for (size_t c = 0, n = uri.size(); c < n; c++) {
+        if (uri[c] == '%' && c + 2 < n) {
+            result += char(strtol(uri.substr(c + 1, 2).c_str(), nullptr, 16));
+            c += 2;
+        } else {
+            result += uri[c];
+        }
+    }
+    return result;
+}
+
+static void loadImages(const string &path, const JsonValue &gltf, const vector<GltfBuffer> &buffers,
+                       const vector<bool> &imageUsed, Mesh &mesh) {
+    const JsonValue &images = gltf["images"];
+    mesh.textures.assign(images.size(), Texture { BAD_TEX });
+    for (size_t c = 0, n = images.size(); c < n; c++) {
+        if (!imageUsed[c]) continue;
+        const JsonValue &image = images[c];
+        GLuint texName;
+        glGenTextures(1, &texName);
+        int loaded = 0;
+        if (!image["uri"].isNull()) {
+            const string &uri = image["uri"].str;
+            if (uri.compare(0, 5, "data:") == 0) {
+                printf("glTF: data URIs are not supported (image %zu)\n", c);
+            } else {
+                string file = path + '/' + decodeUri(uri);
+                loaded = loadTexture(texName, file.c_str(), STBI_rgb);
+            }
+        } else {
+            const JsonValue &view = gltf["bufferViews"][size_t(image["bufferView"].integer(-1))];
+            u32 buffer = u32(view["buffer"].integer(-1));
+            u64 offset = u64(view["byteOffset"].num(0));
+            u64 length = u64(view["byteLength"].num(0));
+            if (buffer < buffers.size() && offset + length <= buffers[buffer].size) {
+                string name = image["name"].isNull() ? "image " + to_string(c) : image["name"].str;
+                loaded = loadTextureFromMemory(texName, buffers[buffer].data + offset, u32(length), name.c_str(), STBI_rgb);
+            } else {
+                printf("glTF: image %zu has a bad buffer view\n", c);
+            }
+        }
+        if (loaded) {
+            mesh.textures[c].glHandle = texName;
+        } else {
+            glDeleteTextures(1, &texName);
+        }
+    }
+}
+
+// The vertex layout of a primitive, which is also the key for sharing its VAO.
+struct GltfLayout {
+    GltfAccessor attribs[4]; // VAO_POS, VAO_NOR, VAO_TEX, VAO_TAN
+    bool present[4];
+    s32 indexBuffer; // -1 if not indexed
+};
+
+static bool sameLayout(const GltfLayout &a, const GltfLayout &b) {
+    if (a.indexBuffer != b.indexBuffer) return false;
+    for (int c = 0; c < 4; c++) {
+        if (a.present[c] != b.present[c]) return false;
+        if (!a.present[c]) continue;
+        const GltfAccessor &x = a.attribs[c];
+        const GltfAccessor &y = b.attribs[c];
+        if (x.buffer != y.buffer || x.offset != y.offset || x.stride != y.stride ||
+            x.components != y.components || x.componentType != y.componentType || x.normalized != y.normalized) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static GLuint createLayoutVao(const GltfLayout &layout, const vector<GltfBuffer> &buffers) {
+    static const u32 locations[4] = { VAO_POS, VAO_NOR, VAO_TEX, VAO_TAN };
+
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    for (int c = 0; c < 4; c++) {
+        // Missing attributes read the constant (0,0,0,1): no texture coordinates, and no
+        // tangents or bitangents. The bitangent is never bound and is rebuilt in the shader.
+        if (!layout.present[c]) continue;
+        const GltfAccessor &accessor = layout.attribs[c];
+        const GltfBuffer &buffer = buffers[accessor.buffer];
+        glBindBuffer(GL_ARRAY_BUFFER, buffer.glBuffer);
+        glEnableVertexAttribArray(locations[c]);
+        glVertexAttribPointer(locations[c], accessor.components, accessor.componentType,
+                              GLboolean(accessor.normalized), accessor.stride,
+                              (void *)(uintptr_t)(accessor.offset - buffer.uploadStart));
+    }
+    if (layout.indexBuffer >= 0) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[layout.indexBuffer].glBuffer);
+    }
+    checkError();
+    return vao;
+}
+
+// A part before sorting.
+struct GltfPrimitive {
+    u32 object;
+    u32 material;
+    u32 layout;
+    u32 indexType;
+    u32 offset; // in indices
+    u32 count;
+    mat4 transform;
+};
+
+bool loadGltfFile(const string &path, const string &filename, Mesh &mesh) {
+    string fullPath = path + '/' + filename;
+    MappedFile file;
+    if (!mapFile(fullPath, file)) {
+        printf("Failed to open %s\n", fullPath.c_str());
+        return false;
+    }
+
+    GlbHeader header;
+    GlbChunk jsonChunk;
+    if (file.size < sizeof(header) + sizeof(jsonChunk)) {
+        printf("%s is too small to be a .glb\n", fullPath.c_str());
+        unmapFile(file);
+        return false;
+    }
+    memcpy(&header, file.data, sizeof(header));
+    memcpy(&jsonChunk, file.data + sizeof(header), sizeof(jsonChunk));
+    u64 jsonStart = sizeof(header) + sizeof(jsonChunk);
+    if (header.magic != GLB_MAGIC || header.version != 2 || header.length > file.size ||
+        jsonChunk.type != GLB_CHUNK_JSON || jsonStart + jsonChunk.length > header.length) {
+        printf("%s is not a glTF 2.0 binary\n", fullPath.c_str());
+        unmapFile(file);
+        return false;
+    }
+
+    JsonValue gltf;
+    string jsonText(file.data + jsonStart, jsonChunk.length);
+    if (!parseJson(jsonText, gltf)) {
+        printf("%s has a malformed JSON chunk\n", fullPath.c_str());
+        unmapFile(file);
+        return false;
+    }
+    jsonText = string();
+
+    // The BIN chunk, if any, follows the JSON chunk (padded to 4 bytes) and is buffer 0.
+    const u8 *binData = nullptr;
+    u64 binSize = 0;
+    u64 binHeader = (jsonStart + jsonChunk.length + 3) & ~u64(3);
+    if (binHeader + sizeof(GlbChunk) <= header.length) {
+        GlbChunk binChunk;
+        memcpy(&binChunk, file.data + binHeader, sizeof(binChunk));
+        if (binChunk.type == GLB_CHUNK_BIN && binHeader + sizeof(binChunk) + binChunk.length <= header.length) {
+            binData = (const u8 *) file.data + binHeader + sizeof(binChunk);
+            binSize = binChunk.length;
+        }
+    }
+
+    // Buffers other than the BIN chunk are separate files, mapped the same way.
+    const JsonValue &bufferList = gltf["buffers"];
+    vector<GltfBuffer> buffers(bufferList.size());
+    vector<MappedFile> externalFiles;
+    bool success = true;
+    for (size_t c = 0, n = buffers.size(); c < n && success; c++) {
+        const JsonValue &uri = bufferList[c]["uri"];
+        if (uri.isNull()) {
+            buffers[c].data = binData;
+            buffers[c].size = binData && c == 0 ? binSize : 0;
+        } else if (uri.str.compare(0, 5, "data:") == 0) {
+            printf("glTF: data URIs are not supported (buffer %zu)\n", c);
+            success = false;
+        } else {
+            externalFiles.emplace_back();
+            string bufferFile = path + '/' + decodeUri(uri.str);
+            if (!mapFile(bufferFile, externalFiles.back())) {
+                printf("Failed to open %s\n", bufferFile.c_str());
+                success = false;
+            }
+            buffers[c].data = (const u8 *) externalFiles.back().data;
+            buffers[c].size = externalFiles.back().size;
+        }
+    }
+
+    vector<GltfInstance> instances;
+    if (success) {
+        vector<bool> visited(gltf["nodes"].size());
+        const JsonValue &scene = gltf["scenes"][size_t(gltf["scene"].integer(0))];
+        if (!scene.isNull()) {
+            for (size_t c = 0, n = scene["nodes"].size(); c < n; c++) {
+                collectInstances(gltf, u32(scene["nodes"][c].integer(-1)), mat4(1), instances, visited);
+            }
+        } else {
+            // No scene, so every node that isn't a child is a root.
+            vector<bool> isChild(visited.size());
+            for (size_t c = 0, n = visited.size(); c < n; c++) {
+                const JsonValue &children = gltf["nodes"][c]["children"];
+                for (size_t k = 0; k < children.size(); k++) {
+                    u32 child = u32(children[k].integer(-1));
+                    if (child < isChild.size()) isChild[child] = true;
+                }
+            }
+            for (u32 c = 0, n = u32(visited.size()); c < n; c++) {
+                if (!isChild[c]) collectInstances(gltf, c, mat4(1), instances, visited);
+            }
+        }
+    }
+
+    // Materials, plus a plain one at the end for primitives without one.
+    const JsonValue &materialList = gltf["materials"];
+    vector<bool> imageUsed(gltf["images"].size());
+    mesh.materials.resize(materialList.size() + 1);
+    for (size_t c = 0, n = materialList.size(); c < n; c++) {
+        gltf2mesh_material(gltf, materialList[c], mesh.materials[c], imageUsed);
+    }
+    gltf2mesh_material(gltf, jsonNull, mesh.materials.back(), imageUsed);
+    mesh.materials.back().name = "default";
+    u32 defaultMaterial = u32(materialList.size());
+
+    vector<GltfLayout> layouts;
+    vector<GltfPrimitive> primitives;
+    vector<bool> hasTangents(mesh.materials.size(), true);
+    u32 skipped = 0;
+    mesh.objects.clear();
+    for (const GltfInstance &instance : instances) {
+        if (!success) break;
+        const JsonValue &gltfMesh = gltf["meshes"][instance.mesh];
+        const JsonValue &node = gltf["nodes"][instance.node];
+        u32 object = u32(mesh.objects.size());
+        mesh.objects.push_back(MeshObject { node["name"].str, emptyBounds() });
+        if (mesh.objects.back().name.empty()) mesh.objects.back().name = gltfMesh["name"].str;
+        Bounds &bounds = mesh.objects.back().bounds;
+
+        const JsonValue &primitiveList = gltfMesh["primitives"];
+        for (size_t p = 0, np = primitiveList.size(); p < np && success; p++) {
+            const JsonValue &primitive = primitiveList[p];
+            const JsonValue &attributes = primitive["attributes"];
+            if (primitive["mode"].integer(GLTF_MODE_TRIANGLES) != GLTF_MODE_TRIANGLES ||
+                attributes["POSITION"].isNull()) {
+                skipped++;
+                continue;
+            }
+
+            static const char *attributeNames[4] = { "POSITION", "NORMAL", "TEXCOORD_0", "TANGENT" };
+            GltfLayout layout;
+            for (int c = 0; c < 4 && success; c++) {
+                const JsonValue &index = attributes[attributeNames[c]];
+                layout.present[c] = !index.isNull();
+                if (layout.present[c]) {
+                    success = resolveAccessor(gltf, buffers, index.integer(-1), layout.attribs[c]);
+                    if (success) useAccessor(buffers, layout.attribs[c]);
+                }
+            }
+            if (!success) break;
+
+            GltfPrimitive part;
+            part.object = object;
+            part.material = u32(primitive["material"].integer(s32(defaultMaterial)));
+            if (part.material > defaultMaterial) part.material = defaultMaterial;
+            part.transform = instance.transform;
+            if (!layout.present[3]) hasTangents[part.material] = false;
+
+            if (primitive["indices"].isNull()) {
+                layout.indexBuffer = -1;
+                part.indexType = 0;
+                part.offset = 0;
+                part.count = layout.attribs[0].count;
+            } else {
+                GltfAccessor indices;
+                success = resolveAccessor(gltf, buffers, primitive["indices"].integer(-1), indices);
+                if (!success) break;
+                u32 size = componentSize(indices.componentType);
+                if (indices.components != 1 || indices.componentType == GL_FLOAT || indices.offset % size != 0) {
+                    printf("glTF: bad index accessor in mesh %u\n", instance.mesh);
+                    success = false;
+                    break;
+                }
+                useAccessor(buffers, indices);
+                layout.indexBuffer = s32(indices.buffer);
+                part.indexType = indices.componentType;
+                part.offset = u32(indices.offset / size); // made relative to the upload below
+                part.count = indices.count;
+            }
+
+            part.layout = u32(layouts.size());
+            for (u32 c = 0, n = u32(layouts.size()); c < n; c++) {
+                if (sameLayout(layouts[c], layout)) {
+                    part.layout = c;
+                    break;
+                }
+            }
+            if (part.layout == layouts.size()) layouts.push_back(layout);
+            primitives.push_back(part);
+
+            // POSITION must have min and max, so the bounds come without looking at a vertex.
+            const JsonValue &position = *layout.attribs[0].json;
+            const JsonValue &min = position["min"];
+            const JsonValue &max = position["max"];
+            vec3 lo(f32(min[0].num(0)), f32(min[1].num(0)), f32(min[2].num(0)));
+            vec3 hi(f32(max[0].num(0)), f32(max[1].num(0)), f32(max[2].num(0)));
+            for (u32 corner = 0; corner < 8; corner++) {
+                vec3 point((corner & 1) ? hi.x : lo.x, (corner & 2) ? hi.y : lo.y, (corner & 4) ? hi.z : lo.z);
+                addPoint(bounds, vec3(instance.transform * vec4(point, 1)));
+            }
+        }
+        if (bounds.min.x <= bounds.max.x) {
+            vec3 lo = bounds.min, hi = bounds.max;
+            centerBounds(bounds);
+            for (u32 corner = 0; corner < 8; corner++) {
+                addSpherePoint(bounds, vec3((corner & 1) ? hi.x : lo.x, (corner & 2) ? hi.y : lo.y, (corner & 4) ? hi.z : lo.z));
+            }
+        }
+    }
+    if (skipped) {
+        printf("glTF: skipped %u primitives that aren't triangle lists\n", skipped);
+    }
+
+    if (success) {
+        // Upload the geometry straight out of the mapping. Starts are rounded down so that
+        // attribute and index offsets keep their alignment.
+        u64 uploaded = 0;
+        for (GltfBuffer &buffer : buffers) {
+            if (buffer.uploadStart >= buffer.uploadEnd) continue;
+            buffer.uploadStart &= ~u64(15);
+            glGenBuffers(1, &buffer.glBuffer);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer.glBuffer);
+            glBufferData(GL_ARRAY_BUFFER, buffer.uploadEnd - buffer.uploadStart, buffer.data + buffer.uploadStart, GL_STATIC_DRAW);
+            uploaded += buffer.uploadEnd - buffer.uploadStart;
+        }
+        checkError();
+
+        vector<GLuint> vaos(layouts.size());
+        for (u32 c = 0, n = u32(layouts.size()); c < n; c++) {
+            vaos[c] = createLayoutVao(layouts[c], buffers);
+        }
+        glBindVertexArray(0);
+
+        // Normal maps need tangents, which glTF leaves optional.
+        for (u32 c = 0, n = u32(mesh.materials.size()); c < n; c++) {
+            if (!hasTangents[c]) mesh.materials[c].flags &= ~MAT_NORMAL_TANGENT_TEX;
+        }
+        loadImages(path, gltf, buffers, imageUsed, mesh);
+
+        // Sort by material to batch state changes, then by VAO.
+        stable_sort(primitives.begin(), primitives.end(), [](const GltfPrimitive &a, const GltfPrimitive &b) {
+            if (a.material != b.material) return a.material < b.material;
+            return a.layout < b.layout;
+        });
+        mesh.parts.clear();
+        mesh.partBindings.clear();
+        mesh.objectParts.clear();
+        mesh.size = 0;
+        for (const GltfPrimitive &primitive : primitives) {
+            u32 offset = primitive.offset;
+            if (primitive.indexType) {
+                const GltfBuffer &buffer = buffers[layouts[primitive.layout].indexBuffer];
+                offset -= u32(buffer.uploadStart / componentSize(primitive.indexType));
+            }
+            u32 index = u32(mesh.parts.size());
+            mesh.objectParts.push_back(ObjectPart { offset, primitive.count, primitive.object, index });
+            mesh.parts.push_back(MeshPart { offset, primitive.count, 0, u16(primitive.material), 0, primitive.indexType });
+            mesh.partBindings.push_back(PartBinding { vaos[primitive.layout], primitive.transform, inverse(primitive.transform) });
+            mesh.size += primitive.count;
+        }
+        mesh.vao = vaos.empty() ? createVao() : vaos[0];
+        assignShaders(mesh);
+
+        printf("Loaded %s: %zu parts, %zu objects, %zu materials, %zu vertex layouts, %u MB of buffers\n",
+               filename.c_str(), mesh.parts.size(), mesh.objects.size(), mesh.materials.size(),
+               layouts.size(), u32(uploaded >> 20));
+    }
+
+    for (MappedFile &external : externalFiles) {
+        unmapFile(external);
+    }
+    unmapFile(file);
+    return success;
+}
+
+// ------------------ End GLB -------------------
@@ -0,0 +1,22 @@
+#ifndef SPONZA_GLTF_H
+#define SPONZA_GLTF_H
+
+#include <string>
+#include "mesh.h"
+
+// Binary glTF 2.0 (.glb) loading. The file is mapped and the byte range of its buffers that
+// holds geometry is handed to GL as is. Every primitive gets a VAO that points straight at its
+// accessors, with their own component types and strides, so no vertex is ever touched on the
+// CPU. Indices stay in the file's 8, 16 or 32 bit format.
+//
+// Each primitive under each node becomes a MeshPart, with a PartBinding for its VAO and the
+// node's transform, and each node with a mesh becomes a MeshObject bounded by the accessor
+// min/max. Materials are mapped from pbrMetallicRoughness: the base color becomes the ambient
+// and diffuse color, the normal texture the bump map, and the roughness the shininess.
+// Textures are decoded and uploaded before this returns.
+//
+// Not supported: sparse accessors, base64 data: URIs, skins, morph targets, and primitive
+// modes other than triangles (those primitives are skipped).
+bool loadGltfFile(const std::string &path, const std::string &filename, Mesh &mesh);
+
+#endif //SPONZA_GLTF_H
@@ -0,0 +1,474 @@
+#include <cstdio>
+
+#include "gpu_culling.h"
+#include "gl_includes.h"
+
+using namespace std;
+using namespace glm;
+
+#define GLSL430(src) "#version 430\n" #src
+
+// Matches Cluster in the cull shader, laid out std430.
+struct GpuCluster {
+    vec4 sphere;      // the meshlet's bounding sphere
+    vec4 cone;        // the meshlet's cone axis and cutoff, see isBackfacing
+    vec4 lodSphere;   // the object's bounding sphere, for picking a level of detail like selectLod
+    vec4 boxMin;      // the object's box, for the frustum and for simplified levels
+    vec4 boxMax;
+    u32 offset;       // full detail indices, in the part's index type
+    u32 size;
+    u32 objectPart;
+    u32 firstCluster; // of its part, where the part's commands start
+    s32 baseVertex;
+    u32 part;
+    u32 lead;         // 1 for the first cluster of its object part, which draws the simplified levels
+    u32 pad;
+};
+
+struct DrawElementsIndirectCommand {
+    u32 count;
+    u32 instanceCount;
+    u32 firstIndex;
+    s32 baseVertex;
+    u32 baseInstance;
+};
+
+// ------------------- Begin Shader Text ----------------------
+
+const char *cullSource = GLSL430(
+        layout(local_size_x = 64) in;
+
+        struct Cluster {
+            vec4 sphere;
+            vec4 cone;
+            vec4 lodSphere;
+            vec4 boxMin;
+            vec4 boxMax;
+            uint offset;
+            uint size;
+            uint objectPart;
+            uint firstCluster;
+            int baseVertex;
+            uint part;
+            uint lead;
+            uint pad;
+        };
+
+        struct LodLevel {
+            uint offset;
+            uint size;
+            float error;
+        };
+
+        struct Command {
+            uint count;
+            uint instanceCount;
+            uint firstIndex;
+            int baseVertex;
+            uint baseInstance;
+        };
+
+        layout(std430, binding = 0) readonly buffer Clusters { Cluster clusters[]; };
+        layout(std430, binding = 1) readonly buffer Lods { LodLevel lods[]; };
+        layout(std430, binding = 2) buffer Visibility { uint visible[]; };
+        layout(std430, binding = 3) writeonly buffer Commands { Command commands[]; };
+        layout(std430, binding = 4) buffer Counts { uint counts[]; };
+
+        uniform uint numClusters;
+        uniform uint numParts;
+        uniform uint phase;
+        uniform bool cull;    // off draws every cluster, only the level of detail is picked
+        uniform bool compact; // pack each part's commands and count them, else one per cluster
+        uniform int maxLods;  // 0 if there are no simplified levels or they're off
+        uniform float maxLodError;
+        uniform float lodPixelScale;
+        uniform float nearPlane;
+        uniform vec3 camPos;
+        uniform vec4 frustum[6];
+        uniform mat4 viewProjection;
+        uniform sampler2D hiZ;
+        uniform ivec2 viewportSize;
+        uniform int hiZLevels;
+
+        bool sphereInFrustum(vec4 sphere) {
+            for (int c = 0; c < 6; c++) {
+                if (dot(frustum[c].xyz, sphere.xyz) + frustum[c].w < -sphere.w) return false;
+            }
+            return true;
+        }
+
+        bool boxInFrustum(vec3 boxMin, vec3 boxMax) {
+            for (int c = 0; c < 6; c++) {
+                vec3 far = mix(boxMin, boxMax, greaterThan(frustum[c].xyz, vec3(0.0)));
+                if (dot(frustum[c].xyz, far) + frustum[c].w < 0.0) return false;
+            }
+            return true;
+        }
+
+        bool isBackfacing(Cluster cluster) {
+            vec3 view = cluster.sphere.xyz - camPos;
+            return dot(view, cluster.cone.xyz) >= cluster.cone.w * length(view) + cluster.sphere.w;
+        }
+
+        // True if the box is behind the depth already drawn everywhere it could cover. The pyramid
+        // level is picked so the box's pixels span at most two texels each way.
+        bool boxOccluded(vec3 boxMin, vec3 boxMax) {
+            vec2 lo = vec2(1.0);
+            vec2 hi = vec2(-1.0);
+            float nearest = 1.0;
+            for (int c = 0; c < 8; c++) {
+                vec3 corner = mix(boxMin, boxMax, bvec3((c & 1) != 0, (c & 2) != 0, (c & 4) != 0));
+                vec4 clip = viewProjection * vec4(corner, 1.0);
+                if (clip.z < -clip.w) return false; // crosses the near plane
+                vec3 ndc = clip.xyz / clip.w;
+                lo = min(lo, ndc.xy);
+                hi = max(hi, ndc.xy);
+                nearest = min(nearest, ndc.z);
+            }
+            ivec2 pixelMin = clamp(ivec2(floor((lo * 0.5 + 0.5) * vec2(viewportSize))), ivec2(0), viewportSize - 1);
+            ivec2 pixelMax = clamp(ivec2(floor((hi * 0.5 + 0.5) * vec2(viewportSize))), ivec2(0), viewportSize - 1);
+            int extent = max(pixelMax.x - pixelMin.x, pixelMax.y - pixelMin.y);
+            int level = 0;
+            while (level + 1 < hiZLevels && (1 << level) < extent) level++;
+
+            ivec2 levelMax = textureSize(hiZ, level) - 1;
+            ivec2 texelMin = min(pixelMin >> level, levelMax);
+            ivec2 texelMax = min(pixelMax >> level, levelMax);
+            float farthest = max(max(texelFetch(hiZ, texelMin, level).r, texelFetch(hiZ, ivec2(texelMax.x, texelMin.y), level).r),
+                                 max(texelFetch(hiZ, ivec2(texelMin.x, texelMax.y), level).r, texelFetch(hiZ, texelMax, level).r));
+            return nearest * 0.5 + 0.5 > farthest;
+        }
+
+        void main() {
+            uint c = gl_GlobalInvocationID.x;
+            if (c >= numClusters) return;
+            Cluster cluster = clusters[c];
+
+            uint level = 0u;
+            if (maxLods > 0) {
+                float distance = max(length(cluster.lodSphere.xyz - camPos) - cluster.lodSphere.w, nearPlane);
+                float allowedError = maxLodError * distance / lodPixelScale;
+                uint base = cluster.objectPart * uint(maxLods);
+                while (level + 1u < uint(maxLods) && lods[base + level + 1u].error <= allowedError) level++;
+            }
+
+            uint offset = cluster.offset;
+            uint size = cluster.size;
+            vec3 boxMin = cluster.sphere.xyz - cluster.sphere.w;
+            vec3 boxMax = cluster.sphere.xyz + cluster.sphere.w;
+            bool inFrustum = !cull || boxInFrustum(cluster.boxMin.xyz, cluster.boxMax.xyz);
+            if (level > 0u) {
+                // Simplified levels go whole, with the object's box, drawn by the object part's
+                // lead cluster. The others draw nothing, but without compaction they still own a
+                // command, which has to be cleared of whatever it drew last frame.
+                if (cluster.lead == 0u) inFrustum = false;
+                offset = lods[cluster.objectPart * uint(maxLods) + level].offset;
+                size = lods[cluster.objectPart * uint(maxLods) + level].size;
+                boxMin = cluster.boxMin.xyz;
+                boxMax = cluster.boxMax.xyz;
+            } else {
+                inFrustum = inFrustum && (!cull || (sphereInFrustum(cluster.sphere) && !isBackfacing(cluster)));
+            }
+
+            bool drawnFirst = inFrustum && visible[c] != 0u;
+            bool draw = drawnFirst;
+            if (phase == 1u) {
+                bool seen = inFrustum && (!cull || !boxOccluded(boxMin, boxMax));
+                visible[c] = seen ? 1u : 0u;
+                draw = seen && !drawnFirst;
+            }
+
+            uint commandBase = phase * numClusters;
+            if (compact) {
+                if (!draw) return;
+                uint slot = cluster.firstCluster + atomicAdd(counts[phase * numParts + cluster.part], 1u);
+                commands[commandBase + slot] = Command(size, 1u, offset, cluster.baseVertex, 0u);
+            } else {
+                commands[commandBase + c] = Command(draw ? size : 0u, draw ? 1u : 0u, offset, cluster.baseVertex, 0u);
+            }
+        }
+);
+
+const char *copySource = GLSL430(
+        layout(local_size_x = 8, local_size_y = 8) in;
+        uniform sampler2D depth;
+        layout(r32f, binding = 1) writeonly uniform image2D target;
+
+        void main() {
+            ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+            if (any(greaterThanEqual(p, imageSize(target)))) return;
+            imageStore(target, p, vec4(texelFetch(depth, p, 0).r));
+        }
+);
+
+const char *reduceSource = GLSL430(
+        layout(local_size_x = 8, local_size_y = 8) in;
+        layout(r32f, binding = 0) readonly uniform image2D source;
+        layout(r32f, binding = 1) writeonly uniform image2D target;
+
+        void main() {
+            ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+            ivec2 size = imageSize(target);
+            if (any(greaterThanEqual(p, size))) return;
+            // The last row and column also take the odd one out of the level before, so every
+            // pixel is under some texel of each level.
+            ivec2 sourceSize = imageSize(source);
+            ivec2 first = p * 2;
+            ivec2 last = first + 1;
+            if (p.x == size.x - 1) last.x = sourceSize.x - 1;
+            if (p.y == size.y - 1) last.y = sourceSize.y - 1;
+            last = min(last, sourceSize - 1);
+            float farthest = 0.0;
+            for (int y = first.y; y <= last.y; y++) {
+                for (int x = first.x; x <= last.x; x++) {
+                    farthest = max(farthest, imageLoad(source, ivec2(x, y)).r);
+                }
+            }
+            imageStore(target, p, vec4(farthest));
+        }
+);
+
+// ------------------ End Shader Text -----------------------
+
+static GLuint compileCompute(const char *source) {
+    GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    GLint success = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    GLuint program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!success || !linked) {
+        char log[4096] = "";
+        glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        printf("Compute shader failed: %s\n", log);
+        glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+        printf("%s\n", log);
+        glDeleteShader(shader);
+        glDeleteProgram(program);
+        return 0;
+    }
+    glDeleteShader(shader);
+    return program;
+}
+
+static GLuint createStorage(u64 size, const void *data) {
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(size ? size : 4), data, GL_DYNAMIC_DRAW);
+    return buffer;
+}
+
+bool initGpuCulling(GpuCulling &culling, const Mesh &mesh) {
+    freeGpuCulling(culling);
+    if (!GLEW_VERSION_4_3) {
+        printf("GPU culling needs OpenGL 4.3\n");
+        return false;
+    }
+    culling.indirectCount = GLEW_ARB_indirect_parameters != 0;
+
+    // Object parts are in part order, so each part's clusters end up together.
+    vector<GpuCluster> clusters;
+    u32 numParts = u32(mesh.parts.size());
+    culling.firstCluster.assign(numParts + 1, 0);
+    for (u32 objectPart = 0, n = u32(mesh.objectParts.size()); objectPart < n; objectPart++) {
+        const ObjectPart &op = mesh.objectParts[objectPart];
+        if (!mesh.firstInstance.empty() && mesh.firstInstance[objectPart] != mesh.firstInstance[objectPart + 1]) continue;
+        const Bounds &bounds = mesh.objects[op.object].bounds;
+        GpuCluster cluster = {};
+        cluster.lodSphere = vec4(bounds.center, bounds.radius);
+        cluster.boxMin = vec4(bounds.min, 0);
+        cluster.boxMax = vec4(bounds.max, 0);
+        cluster.objectPart = objectPart;
+        cluster.baseVertex = s32(mesh.parts[op.part].baseVertex);
+        cluster.part = op.part;
+        cluster.lead = 1;
+        if (mesh.meshlets.empty()) {
+            // The object part is the cluster, and it never faces away.
+            cluster.sphere = cluster.lodSphere;
+            cluster.cone = vec4(0, 0, 0, 1);
+            cluster.offset = op.offset;
+            cluster.size = op.size;
+            clusters.push_back(cluster);
+            continue;
+        }
+        for (u32 c = mesh.firstMeshlet[objectPart], end = mesh.firstMeshlet[objectPart + 1]; c < end; c++) {
+            const Meshlet &meshlet = mesh.meshlets[c];
+            cluster.sphere = vec4(meshlet.center, meshlet.radius);
+            cluster.cone = vec4(meshlet.coneAxis, meshlet.coneCutoff);
+            cluster.offset = meshlet.offset;
+            cluster.size = meshlet.size;
+            clusters.push_back(cluster);
+            cluster.lead = 0;
+        }
+    }
+    culling.numClusters = u32(clusters.size());
+    culling.mesh = &mesh;
+    culling.meshVao = mesh.vao;
+    culling.meshSize = mesh.size;
+    culling.numObjectParts = u32(mesh.objectParts.size());
+    culling.hasLods = !mesh.lods.empty();
+    for (const GpuCluster &cluster : clusters) {
+        culling.firstCluster[cluster.part + 1]++;
+    }
+    for (u32 c = 0; c < numParts; c++) {
+        culling.firstCluster[c + 1] += culling.firstCluster[c];
+    }
+    for (GpuCluster &cluster : clusters) {
+        cluster.firstCluster = culling.firstCluster[cluster.part];
+    }
+
+    culling.cullProgram = compileCompute(cullSource);
+    culling.copyProgram = compileCompute(copySource);
+    culling.reduceProgram = compileCompute(reduceSource);
+    if (!culling.cullProgram || !culling.copyProgram || !culling.reduceProgram) {
+        freeGpuCulling(culling);
+        return false;
+    }
+
+    culling.clusterBuffer = createStorage(clusters.size() * sizeof(GpuCluster), clusters.data());
+    culling.lodBuffer = createStorage(mesh.lods.size() * sizeof(LodLevel), mesh.lods.data());
+    vector<u32> zeros(culling.numClusters, 0);
+    culling.visibilityBuffer = createStorage(zeros.size() * sizeof(u32), zeros.data());
+    culling.commandBuffer = createStorage(u64(GPU_CULL_PHASES) * culling.numClusters * sizeof(DrawElementsIndirectCommand), nullptr);
+    culling.countBuffer = createStorage(u64(GPU_CULL_PHASES) * numParts * sizeof(u32), nullptr);
+    checkError();
+    printf("GPU culling %u clusters, %s\n", culling.numClusters,
+           culling.indirectCount ? "drawn with indirect counts" : "without ARB_indirect_parameters");
+    return true;
+}
+
+void freeGpuCulling(GpuCulling &culling) {
+    GLuint buffers[] = { culling.clusterBuffer, culling.lodBuffer, culling.visibilityBuffer, culling.commandBuffer,
+                         culling.countBuffer };
+    for (GLuint buffer : buffers) {
+        if (buffer) glDeleteBuffers(1, &buffer);
+    }
+    GLuint programs[] = { culling.cullProgram, culling.copyProgram, culling.reduceProgram };
+    for (GLuint program : programs) {
+        if (program) glDeleteProgram(program);
+    }
+    if (culling.depthTexture) glDeleteTextures(1, &culling.depthTexture);
+    if (culling.hiZTexture) glDeleteTextures(1, &culling.hiZTexture);
+    culling = GpuCulling();
+}
+
+bool gpuCullingMatches(const GpuCulling &culling, const Mesh &mesh) {
+    return culling.mesh == &mesh && culling.meshVao == mesh.vao && culling.meshSize == mesh.size &&
+           culling.numObjectParts == mesh.objectParts.size();
+}
+
+// Copies the depth buffer into the pyramid's first level and takes the farthest depth of each
+// 2x2 block (2x3, 3x2 or 3x3 at odd edges) for every level after it.
+static void buildHiZ(GpuCulling &culling, s32 width, s32 height) {
+    if (culling.width != width || culling.height != height) {
+        if (culling.depthTexture) glDeleteTextures(1, &culling.depthTexture);
+        if (culling.hiZTexture) glDeleteTextures(1, &culling.hiZTexture);
+        culling.width = width;
+        culling.height = height;
+        culling.hiZLevels = 1;
+        while ((std::max(width, height) >> culling.hiZLevels) > 0) culling.hiZLevels++;
+
+        glGenTextures(1, &culling.depthTexture);
+        glBindTexture(GL_TEXTURE_2D, culling.depthTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glGenTextures(1, &culling.hiZTexture);
+        glBindTexture(GL_TEXTURE_2D, culling.hiZTexture);
+        glTexStorage2D(GL_TEXTURE_2D, GLsizei(culling.hiZLevels), GL_R32F, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, culling.depthTexture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+    glUseProgram(culling.copyProgram);
+    glUniform1i(glGetUniformLocation(culling.copyProgram, "depth"), 6);
+    glBindImageTexture(1, culling.hiZTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute(GLuint(width + 7) / 8, GLuint(height + 7) / 8, 1);
+
+    glUseProgram(culling.reduceProgram);
+    for (u32 level = 1; level < culling.hiZLevels; level++) {
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        s32 levelWidth = std::max(width >> level, 1), levelHeight = std::max(height >> level, 1);
+        glBindImageTexture(0, culling.hiZTexture, GLint(level - 1), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, culling.hiZTexture, GLint(level), GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute(GLuint(levelWidth + 7) / 8, GLuint(levelHeight + 7) / 8, 1);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void cullClusters(GpuCulling &culling, const GpuCullView &view, u32 phase) {
+    if (culling.numClusters == 0) return;
+    // material.cpp remembers which shader it bound last, so put it back afterwards.
+    GLint previousProgram = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+    if (phase == 1) buildHiZ(culling, view.width, view.height);
+
+    GLuint program = culling.cullProgram;
+    glUseProgram(program);
+    u32 numParts = u32(culling.firstCluster.size() - 1);
+    auto location = [&](const char *name) { return glGetUniformLocation(program, name); };
+    glUniform1ui(location("numClusters"), culling.numClusters);
+    glUniform1ui(location("numParts"), numParts);
+    glUniform1ui(location("phase"), phase);
+    glUniform1i(location("cull"), view.useCulling);
+    glUniform1i(location("compact"), culling.indirectCount);
+    glUniform1i(location("maxLods"), view.useLods && culling.hasLods ? MAX_LODS : 0);
+    glUniform1f(location("maxLodError"), view.maxLodError);
+    glUniform1f(location("lodPixelScale"), view.lodPixelScale);
+    glUniform1f(location("nearPlane"), view.nearPlane);
+    glUniform3fv(location("camPos"), 1, &view.camPos[0]);
+    glUniform4fv(location("frustum"), 6, &view.frustum[0][0]);
+    glUniformMatrix4fv(location("viewProjection"), 1, GL_FALSE, &view.viewProjection[0][0]);
+    glUniform2i(location("viewportSize"), view.width, view.height);
+    glUniform1i(location("hiZLevels"), s32(culling.hiZLevels));
+    glUniform1i(location("hiZ"), 6);
+    if (phase == 1) {
+        glActiveTexture(GL_TEXTURE6);
+        glBindTexture(GL_TEXTURE_2D, culling.hiZTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    if (culling.indirectCount) {
+        GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.countBuffer);
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GLintptr(phase * numParts * sizeof(u32)),
+                             GLsizeiptr(numParts * sizeof(u32)), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, culling.clusterBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, culling.lodBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, culling.visibilityBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, culling.commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, culling.countBuffer);
+    glDispatchCompute((culling.numClusters + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    glUseProgram(GLuint(previousProgram));
+    checkError();
+}
+
+u32 drawCulledPart(const GpuCulling &culling, const Mesh &mesh, u32 part, u32 phase) {
+    u32 first = culling.firstCluster[part], count = culling.firstCluster[part + 1] - first;
+    if (count == 0) return 0;
+    GLenum indexType = mesh.parts[part].indexType;
+    const void *commands = (const void *)(uintptr_t(u64(phase) * culling.numClusters + first) *
+                                          sizeof(DrawElementsIndirectCommand));
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culling.commandBuffer);
+    if (culling.indirectCount) {
+        u32 numParts = u32(culling.firstCluster.size() - 1);
+        glBindBuffer(GL_PARAMETER_BUFFER_ARB, culling.countBuffer);
+        glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, indexType, commands,
+                                            GLintptr((u64(phase) * numParts + part) * sizeof(u32)), GLsizei(count), 0);
+    } else {
+        glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, commands, GLsizei(count), 0);
+    }
+    return 1;
+}
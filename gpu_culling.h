@@ -0,0 +1,79 @@
+#ifndef SPONZA_GPU_CULLING_H
+#define SPONZA_GPU_CULLING_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "mesh.h"
+#include "types.h"
+
+// GPU driven culling. Every meshlet of every object part without instances is a cluster (or
+// every object part is, if there are no meshlets), and a compute shader picks each cluster's
+// level of detail, culls it against the frustum, its normal cone and a hierarchical Z pyramid,
+// and writes a DrawElementsIndirectCommand for each survivor, packed per part. The CPU is left
+// with binding each part's material and one glMultiDrawElementsIndirectCount per part.
+//
+// Culling runs in two phases per frame. The first draws the clusters that were visible last
+// frame, and the pyramid is built from the depth that leaves; the second tests everything else
+// against it, draws what's newly visible and remembers what was seen for the next frame. Only
+// geometry that's really behind what's already drawn is skipped, so the picture comes out the
+// same as drawing every cluster in the frustum.
+//
+// Needs OpenGL 4.3 for compute shaders. Without ARB_indirect_parameters every cluster keeps its
+// own command, with culled ones drawing nothing, and glMultiDrawElementsIndirect draws them all.
+
+#define GPU_CULL_PHASES 2
+
+struct GpuCulling {
+    u32 clusterBuffer = 0;    // GpuCluster per cluster, grouped by part
+    u32 lodBuffer = 0;        // Mesh::lods
+    u32 visibilityBuffer = 0; // u32 per cluster, 1 if the second phase saw it last frame
+    u32 commandBuffer = 0;    // numClusters commands per phase, each part's starting at its first cluster
+    u32 countBuffer = 0;      // u32 per part per phase, the number of commands written
+    u32 cullProgram = 0;
+    u32 copyProgram = 0;      // depth buffer to the pyramid's first level
+    u32 reduceProgram = 0;    // each level of the pyramid from the one before
+    u32 depthTexture = 0;
+    u32 hiZTexture = 0;       // GL_R32F, the farthest depth under each texel, down to 1x1
+    s32 width = 0, height = 0;
+    u32 hiZLevels = 0;
+    u32 numClusters = 0;
+    const Mesh *mesh = nullptr; // what the clusters were built from, see gpuCullingMatches
+    u32 meshVao = 0;
+    u32 meshSize = 0;
+    u32 numObjectParts = 0;
+    std::vector<u32> firstCluster; // per part, plus one past the end
+    bool hasLods = false;
+    bool indirectCount = false;
+};
+
+// What the cull shader needs to know about the frame, matching what draw() uses on the CPU.
+struct GpuCullView {
+    glm::mat4 viewProjection;
+    glm::vec4 frustum[6]; // see extractFrustum
+    glm::vec3 camPos;
+    bool useCulling;      // false draws every cluster, like draw() with culling off
+    bool useLods;
+    f32 maxLodError;      // see selectLod in main.cpp
+    f32 lodPixelScale;
+    f32 nearPlane;
+    s32 width, height;    // of the viewport
+};
+
+// Builds the clusters of mesh and compiles the shaders. Returns false, leaving culling empty,
+// if the context can't run them.
+bool initGpuCulling(GpuCulling &culling, const Mesh &mesh);
+void freeGpuCulling(GpuCulling &culling);
+
+// True if culling was built from mesh as it is now. A mesh that's built again gets a new VAO,
+// and one that's streaming in gains object parts, and either needs initGpuCulling again.
+bool gpuCullingMatches(const GpuCulling &culling, const Mesh &mesh);
+
+// Culls every cluster for the given phase and writes its draw commands. The second phase first
+// builds the pyramid from the depth buffer, so call it after drawing the first phase's commands.
+void cullClusters(GpuCulling &culling, const GpuCullView &view, u32 phase);
+
+// Draws the commands the last cullClusters wrote for one part, with the part's shader and
+// material already bound and the mesh's VAO current. Returns the number of draw calls made.
+u32 drawCulledPart(const GpuCulling &culling, const Mesh &mesh, u32 part, u32 phase);
+
+#endif //SPONZA_GPU_CULLING_H
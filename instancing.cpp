@@ -0,0 +1,321 @@
+#include "instancing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "obj.h"
+
+using namespace std;
+using namespace glm;
+
+#define NO_VERTEX 0xFFFFFFFF
+
+// Smaller pieces cost more as draws of their own than they save.
+static const u32 kMinInstanceTriangles = 32;
+// How far a copy may be from the transformed original, relative to the original's size.
+static const f32 kPositionTolerance = 1e-4f;
+static const f32 kNormalTolerance = 1e-3f; // one minus the cosine of the angle between normals
+static const f32 kTexCoordTolerance = 1e-5f;
+// Pieces with the same corners and texture coordinates that still don't match, like boxes of
+// different sizes, are only compared against this many originals.
+static const u32 kMaxCandidates = 16;
+
+// A connected set of triangles within one mesh part.
+struct Piece {
+    u32 part;
+    u32 firstTriangle; // into triangles
+    u32 numTriangles;
+    u32 firstVertex;   // into verts, in order of first use
+    u32 numVerts;
+    u64 key;           // hash of the material, the corners and the texture coordinates
+};
+
+// Three vertices of an original that span it, to solve for the transform to each copy.
+struct Frame {
+    u32 p, q, r; // local vertex indices
+    f32 size;    // the farthest any vertex is from p
+    bool valid;  // false if the piece is flat along a line
+};
+
+struct Pieces {
+    vector<Piece> pieces;
+    vector<u32> triangles; // triangle indices into obj.indices / 3
+    vector<u32> corners;   // per triangle corner, the local index of its vertex
+    vector<u32> verts;     // global vertex indices
+};
+
+static u32 findRoot(vector<u32> &parent, u32 v) {
+    while (parent[v] != v) {
+        parent[v] = parent[parent[v]];
+        v = parent[v];
+    }
+    return v;
+}
+
+static void join(vector<u32> &parent, u32 a, u32 b) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a != b) parent[std::max(a, b)] = std::min(a, b);
+}
+
+static u64 hashWord(u64 hash, u32 word) {
+    return (hash ^ word) * 0x100000001B3ULL;
+}
+
+// Splits every mesh part into pieces connected by shared corners or shared positions, so
+// attribute seams don't split a piece.
+static void findPieces(const OBJMesh &obj, Pieces &out) {
+    vector<u32> parent(obj.verts.size());
+    vector<u32> seenInPart(obj.verts.size(), NO_VERTEX);
+    vector<u32> localIndex(obj.verts.size(), NO_VERTEX);
+    vector<u32> partVerts;
+    vector<pair<u32, u32>> roots; // root vertex, triangle
+    for (u32 p = 0, n = u32(obj.meshParts.size()); p < n; p++) {
+        const OBJMeshPart &part = obj.meshParts[p];
+        u32 firstTriangle = part.indexOffset / 3, endTriangle = (part.indexOffset + part.indexSize) / 3;
+
+        partVerts.clear();
+        for (u32 c = part.indexOffset; c < part.indexOffset + part.indexSize; c++) {
+            u32 v = obj.indices[c];
+            if (seenInPart[v] == p) continue;
+            seenInPart[v] = p;
+            parent[v] = v;
+            partVerts.push_back(v);
+        }
+        for (u32 t = firstTriangle; t < endTriangle; t++) {
+            join(parent, obj.indices[t * 3], obj.indices[t * 3 + 1]);
+            join(parent, obj.indices[t * 3], obj.indices[t * 3 + 2]);
+        }
+        sort(partVerts.begin(), partVerts.end(), [&](u32 a, u32 b) {
+            const vec3 &pa = obj.verts[a].position, &pb = obj.verts[b].position;
+            if (pa.x != pb.x) return pa.x < pb.x;
+            if (pa.y != pb.y) return pa.y < pb.y;
+            return pa.z < pb.z;
+        });
+        for (u32 c = 1, m = u32(partVerts.size()); c < m; c++) {
+            if (obj.verts[partVerts[c]].position == obj.verts[partVerts[c - 1]].position) {
+                join(parent, partVerts[c], partVerts[c - 1]);
+            }
+        }
+
+        roots.clear();
+        for (u32 t = firstTriangle; t < endTriangle; t++) {
+            roots.push_back(make_pair(findRoot(parent, obj.indices[t * 3]), t));
+        }
+        sort(roots.begin(), roots.end());
+        for (u32 start = 0, m = u32(roots.size()); start < m;) {
+            u32 end = start;
+            while (end < m && roots[end].first == roots[start].first) end++;
+
+            Piece piece;
+            piece.part = p;
+            piece.firstTriangle = u32(out.triangles.size());
+            piece.numTriangles = end - start;
+            piece.firstVertex = u32(out.verts.size());
+            u64 key = hashWord(0xCBF29CE484222325ULL, part.materialIndex);
+            for (u32 c = start; c < end; c++) {
+                u32 t = roots[c].second;
+                out.triangles.push_back(t);
+                for (u32 k = 0; k < 3; k++) {
+                    u32 v = obj.indices[t * 3 + k];
+                    if (localIndex[v] == NO_VERTEX) {
+                        localIndex[v] = u32(out.verts.size()) - piece.firstVertex;
+                        out.verts.push_back(v);
+                        const vec2 &tex = obj.verts[v].texture;
+                        key = hashWord(key, u32(s32(floor(tex.x * 4096 + 0.5f))));
+                        key = hashWord(key, u32(s32(floor(tex.y * 4096 + 0.5f))));
+                    }
+                    out.corners.push_back(localIndex[v]);
+                    key = hashWord(key, localIndex[v]);
+                }
+            }
+            piece.numVerts = u32(out.verts.size()) - piece.firstVertex;
+            piece.key = key;
+            for (u32 c = piece.firstVertex; c < piece.firstVertex + piece.numVerts; c++) {
+                localIndex[out.verts[c]] = NO_VERTEX;
+            }
+            out.pieces.push_back(piece);
+            start = end;
+        }
+    }
+}
+
+static Frame makeFrame(const OBJMesh &obj, const Pieces &pieces, const Piece &piece) {
+    const u32 *verts = &pieces.verts[piece.firstVertex];
+    Frame frame;
+    frame.p = 0;
+    frame.q = 0;
+    frame.r = 0;
+    vec3 p = obj.verts[verts[0]].position;
+    f32 farthest = 0;
+    for (u32 c = 1; c < piece.numVerts; c++) {
+        f32 dist = length(obj.verts[verts[c]].position - p);
+        if (dist > farthest) {
+            farthest = dist;
+            frame.q = c;
+        }
+    }
+    vec3 edge = obj.verts[verts[frame.q]].position - p;
+    f32 widest = 0;
+    for (u32 c = 1; c < piece.numVerts; c++) {
+        f32 area = length(cross(edge, obj.verts[verts[c]].position - p));
+        if (area > widest) {
+            widest = area;
+            frame.r = c;
+        }
+    }
+    frame.size = farthest;
+    frame.valid = farthest > 0 && widest > farthest * farthest * 1e-3f;
+    return frame;
+}
+
+static mat3 frameBasis(vec3 p, vec3 q, vec3 r) {
+    vec3 x = normalize(q - p);
+    vec3 z = normalize(cross(q - p, r - p));
+    return mat3(x, cross(z, x), z);
+}
+
+// Checks whether copy is original moved by a rotation and translation, and finds them.
+static bool matchPiece(const OBJMesh &obj, const Pieces &pieces, const Piece &original, const Frame &frame,
+                       const Piece &copy, mat4 &transform) {
+    if (copy.numTriangles != original.numTriangles || copy.numVerts != original.numVerts ||
+        obj.meshParts[copy.part].materialIndex != obj.meshParts[original.part].materialIndex) return false;
+    if (memcmp(&pieces.corners[original.firstTriangle * 3], &pieces.corners[copy.firstTriangle * 3],
+               original.numTriangles * 3 * sizeof(u32)) != 0) return false;
+
+    const u32 *a = &pieces.verts[original.firstVertex];
+    const u32 *b = &pieces.verts[copy.firstVertex];
+    auto position = [&](const u32 *verts, u32 c) { return obj.verts[verts[c]].position; };
+    mat3 fromOriginal = frameBasis(position(a, frame.p), position(a, frame.q), position(a, frame.r));
+    mat3 fromCopy = frameBasis(position(b, frame.p), position(b, frame.q), position(b, frame.r));
+    mat3 rotation = fromCopy * transpose(fromOriginal);
+    vec3 translation = position(b, frame.p) - rotation * position(a, frame.p);
+
+    f32 tolerance = frame.size * kPositionTolerance;
+    for (u32 c = 0; c < original.numVerts; c++) {
+        const OBJVertex &va = obj.verts[a[c]], &vb = obj.verts[b[c]];
+        if (length(rotation * va.position + translation - vb.position) > tolerance) return false;
+        vec2 tex = abs(va.texture - vb.texture);
+        if (std::max(tex.x, tex.y) > kTexCoordTolerance) return false;
+        f32 na = length(va.normal), nb = length(vb.normal);
+        if ((na > 0) != (nb > 0)) return false;
+        if (na > 0 && dot(rotation * va.normal, vb.normal) < (1 - kNormalTolerance) * na * nb) return false;
+    }
+
+    transform = mat4(rotation);
+    transform[3] = vec4(translation, 1);
+    return true;
+}
+
+void findInstances(OBJMesh &obj, vector<InstanceGroup> &groups) {
+    auto startTime = chrono::high_resolution_clock::now();
+    groups.clear();
+
+    Pieces pieces;
+    findPieces(obj, pieces);
+
+    vector<u32> order;
+    for (u32 c = 0, n = u32(pieces.pieces.size()); c < n; c++) {
+        if (pieces.pieces[c].numTriangles >= kMinInstanceTriangles) order.push_back(c);
+    }
+    stable_sort(order.begin(), order.end(), [&](u32 a, u32 b) {
+        return pieces.pieces[a].key < pieces.pieces[b].key;
+    });
+
+    // Within each run of equal keys, every piece is an original or a copy of an earlier one.
+    struct Original {
+        u32 piece;
+        Frame frame;
+        vector<u32> copies; // pieces, the original first
+        vector<mat4> transforms;
+    };
+    vector<Original> repeated;
+    vector<Original> originals;
+    for (u32 start = 0, n = u32(order.size()); start < n;) {
+        u32 end = start;
+        while (end < n && pieces.pieces[order[end]].key == pieces.pieces[order[start]].key) end++;
+
+        originals.clear();
+        for (u32 c = start; c < end; c++) {
+            const Piece &piece = pieces.pieces[order[c]];
+            bool matched = false;
+            mat4 transform;
+            for (u32 k = 0; k < originals.size() && k < kMaxCandidates && !matched; k++) {
+                Original &original = originals[k];
+                if (!original.frame.valid) continue;
+                if (matchPiece(obj, pieces, pieces.pieces[original.piece], original.frame, piece, transform)) {
+                    original.copies.push_back(order[c]);
+                    original.transforms.push_back(transform);
+                    matched = true;
+                }
+            }
+            if (!matched) {
+                originals.push_back(Original { order[c], makeFrame(obj, pieces, piece), vector<u32>(1, order[c]),
+                                               vector<mat4>(1, mat4(1)) });
+            }
+        }
+        for (Original &original : originals) {
+            if (original.transforms.size() > 1) repeated.push_back(std::move(original));
+        }
+        start = end;
+    }
+
+    // Rebuild the indices without any copy, then add each original as a part of its own.
+    u32 numTriangles = u32(obj.indices.size() / 3);
+    vector<u8> removed(numTriangles, 0);
+    u32 numCopies = 0;
+    for (const Original &original : repeated) {
+        for (u32 copy : original.copies) {
+            const Piece &piece = pieces.pieces[copy];
+            for (u32 c = piece.firstTriangle; c < piece.firstTriangle + piece.numTriangles; c++) {
+                removed[pieces.triangles[c]] = 1;
+            }
+        }
+        numCopies += u32(original.copies.size());
+    }
+
+    vector<u32> indices;
+    indices.reserve(obj.indices.size());
+    vector<OBJMeshPart> parts;
+    for (const OBJMeshPart &part : obj.meshParts) {
+        OBJMeshPart kept = part;
+        kept.indexOffset = u32(indices.size());
+        for (u32 t = part.indexOffset / 3; t < (part.indexOffset + part.indexSize) / 3; t++) {
+            if (removed[t]) continue;
+            indices.insert(indices.end(), &obj.indices[t * 3], &obj.indices[t * 3 + 3]);
+        }
+        kept.indexSize = u32(indices.size()) - kept.indexOffset;
+        if (kept.indexSize) parts.push_back(kept);
+    }
+    for (Original &original : repeated) {
+        const Piece &piece = pieces.pieces[original.piece];
+        const OBJMeshPart &source = obj.meshParts[piece.part];
+        OBJObject object;
+        object.name = obj.objects[source.objectIndex].name;
+        object.bounds = emptyBounds();
+        for (u32 c = piece.firstVertex; c < piece.firstVertex + piece.numVerts; c++) {
+            addPoint(object.bounds, obj.verts[pieces.verts[c]].position);
+        }
+        centerBounds(object.bounds);
+        for (u32 c = piece.firstVertex; c < piece.firstVertex + piece.numVerts; c++) {
+            addSpherePoint(object.bounds, obj.verts[pieces.verts[c]].position);
+        }
+
+        u32 objectIndex = u32(obj.objects.size());
+        obj.objects.push_back(object);
+        parts.push_back(OBJMeshPart { source.materialIndex, u32(indices.size()), piece.numTriangles * 3, objectIndex });
+        for (u32 c = piece.firstTriangle; c < piece.firstTriangle + piece.numTriangles; c++) {
+            u32 t = pieces.triangles[c];
+            indices.insert(indices.end(), &obj.indices[t * 3], &obj.indices[t * 3 + 3]);
+        }
+        groups.push_back(InstanceGroup { objectIndex, std::move(original.transforms) });
+    }
+
+    obj.indices = std::move(indices);
+    obj.meshParts = std::move(parts);
+
+    chrono::duration<double> seconds = chrono::high_resolution_clock::now() - startTime;
+    printf("Found %zu repeated pieces in %ums; %u copies drawn as instances, %u triangles -> %zu\n",
+           groups.size(), u32(seconds.count() * 1000), numCopies, numTriangles, obj.indices.size() / 3);
+}
@@ -0,0 +1,27 @@
+#ifndef SPONZA_INSTANCING_H
+#define SPONZA_INSTANCING_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "types.h"
+
+struct OBJMesh;
+
+// A piece of geometry that the file repeats. Its triangles are kept once, as their own object,
+// and drawn once per transform. The first transform is the identity, for the copy that was kept.
+struct InstanceGroup {
+    u32 object;
+    std::vector<glm::mat4> transforms; // object to world, for every copy
+};
+
+// Finds connected pieces of each material run that are rigid transforms of each other, like the
+// columns and vases that Sponza stores as separately placed copies. Each repeated piece keeps
+// the triangles of its first copy in a new object and mesh part, with its own bounds, and the
+// triangles of the other copies are removed, so their vertices go unused.
+//
+// Copies are matched corner by corner in file order, which is how exporters write out baked
+// copies of the same source, and must agree on texture coordinates. Mirrored copies and pieces
+// under a handful of triangles are left alone.
+void findInstances(OBJMesh &obj, std::vector<InstanceGroup> &groups);
+
+#endif //SPONZA_INSTANCING_H
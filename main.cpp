@@ -1,5 +1,8 @@
 #include <iostream>
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <chrono>
 
 #include <cmath>
 
@@ -12,11 +15,22 @@
 #include "obj.h"
 #include "material.h"
 #include "camera.h"
+#include "meshcache.h"
+#include "streaming.h"
+#include "memory_usage.h"
+#include "outofcore.h"
+#include "gltf.h"
+#include "depth_bench.h"
+#include "culling.h"
+#include "occlusion.h"
+#include "occlusion_queries.h"
+#include "gpu_culling.h"
 
 using namespace std;
 using namespace glm;
 
 int loadTexture(GLuint texname, const char *filename, int format = STBI_default);
+int loadTextureFromMemory(GLuint texname, const u8 *data, u32 size, const char *name, int format = STBI_default);
 
 GLFWwindow *window;
 
@@ -33,6 +47,8 @@ const int nCameras = sizeof(cameras) / sizeof(cameras[0]);
 bool cursorCaught;
 
 mat4 projection;
+const f32 nearPlane = 10.f;
+const f32 farPlane = 10000.f;
 
 Mesh mesh;
 
@@ -43,8 +59,67 @@ bool materialPreview = false;
 int part = -1;
 int renderMode = 0;
 
-void loadTextures(const string &dir, OBJMesh &obj) {
-    for (OBJTexture &tex : obj.textures) {
+bool streamLoad = false; // --stream: render while the scene loads in the background
+bool outOfCore = false; // --out-of-core: split the scene into cells on disk and page them by distance
+u64 gpuBudget = u64(512) << 20; // --gpu-budget=<MB>: buffer memory for resident cells
+const u32 cellTriangles = 1 << 15;
+string gltfFile; // --gltf=<file.glb>: load a binary glTF scene instead of Sponza
+VertexFormat vertexFormat = kCompactVertex; // --float-vertices: keep the 56 byte float vertices
+u32 splitTriangles = DEFAULT_SPLIT_TRIANGLES; // --split-triangles=<n>: cell size for culling, 0 keeps objects whole
+bool depthBench = false; // --depth-bench: time depth only renders with interleaved and split vertices, then exit
+bool useLods = true; // L toggles the simplified levels of detail
+const f32 maxLodError = 1.f; // in pixels
+f32 lodPixelScale = 1; // pixels covered by one unit at a distance of one, from the projection and viewport
+bool useCulling = true; // K toggles frustum and backface culling of objects and meshlets
+vec4 frustumPlanes[6]; // of the current frame's view projection
+BoxList cullBoxList; // see buildCullBoxes, rebuilt when the mesh grows
+vector<u8> boxVisible; // cullBoxes of cullBoxList for the current frame
+bool useOcclusion = true; // O toggles culling behind the mesh's occluders, when culling is on
+OcclusionBuffer occlusionBuffer; // the occluders as seen from the current frame's camera
+bool useQueries = false; // Q switches from the CPU occlusion test to GPU occlusion queries, when culling is on
+OcclusionQueries occlusionQueries; // on the boxes of cullBoxList
+vector<u8> drawnConditionally; // per box, 1 if it was last drawn under conditional render of its query
+const GLuint *conditionalQueries = nullptr; // while set, each box is drawn only if its query passed
+bool useGpuCulling = false; // G culls and picks levels of detail on the GPU; the CPU path stays the reference
+GpuCulling gpuCulling; // built from the mesh when it's first used, and again whenever the mesh changes
+s32 viewportWidth = 0, viewportHeight = 0;
+
+// What draw() submitted, summed over the frames since the last printDrawStats.
+struct DrawStats {
+    u64 frames;
+    u64 draws;
+    u64 triangles;
+    u64 culledObjectParts;
+    u64 culledTriangles; // at full detail, in culled object parts, meshlets and instances
+    u64 meshlets;
+    u64 culledMeshlets;
+    u64 instances;
+    u64 culledInstances;
+    u64 cullNanoseconds; // in cullBoxes
+    u64 occluded; // boxes and meshlets in the frustum but behind the occluders
+    u64 occlusionNanoseconds; // in renderOccluders and boxOccluded
+    u64 queries;
+    u64 conditionalBoxes; // drawn under conditional render
+    u64 skippedTriangles; // at full detail, in conditionally drawn boxes whose query came back hidden
+} drawStats;
+
+void printDrawStats() {
+    if (drawStats.frames == 0) return;
+    f64 frames = f64(drawStats.frames);
+    printf("Per frame: %.0f draws, %.0f triangles, %.0f object parts culled, %.0f of %.0f meshlets culled, "
+           "%.0f of %.0f instances culled, %.0f triangles culled, %u boxes tested in %.1fus, "
+           "%.0f occluded in %.1fus, %.0f queries, %.0f boxes drawn conditionally, %.0f triangles skipped\n",
+           drawStats.draws / frames, drawStats.triangles / frames, drawStats.culledObjectParts / frames,
+           drawStats.culledMeshlets / frames, drawStats.meshlets / frames,
+           drawStats.culledInstances / frames, drawStats.instances / frames, drawStats.culledTriangles / frames,
+           boxCount(cullBoxList), drawStats.cullNanoseconds / frames / 1000,
+           drawStats.occluded / frames, drawStats.occlusionNanoseconds / frames / 1000,
+           drawStats.queries / frames, drawStats.conditionalBoxes / frames, drawStats.skippedTriangles / frames);
+    drawStats = DrawStats();
+}
+
+void loadTextures(const string &dir, vector<OBJTexture> &textures) {
+    for (OBJTexture &tex : textures) {
         if (tex.texName == UNLOADED) {
             string file = dir + '/' + tex.name;
             glGenTextures(1, &tex.texName);
@@ -66,19 +141,53 @@ void setup() {
 
     initShaders();
 
-    OBJMesh obj;
-    bool success = loadObjFile("assets/sponza", "sponza.obj", obj);
-    if (!success) {
-        printf("Failed to load materials.\n");
-        exit(2);
-    }
-    printf("Loaded %lu materials.\n", obj.materials.size());
-    printf("Loaded %lu mesh parts.\n", obj.meshParts.size());
-    printf("Loaded %lu vertices and %lu indices.\n", obj.verts.size(), obj.indices.size());
+    vector<OBJTexture> textures;
+    if (!gltfFile.empty()) {
+        size_t slash = gltfFile.find_last_of("/\\");
+        string dir = slash == string::npos ? string(".") : gltfFile.substr(0, slash);
+        string name = slash == string::npos ? gltfFile : gltfFile.substr(slash + 1);
+        if (!loadGltfFile(dir, name, mesh)) {
+            printf("Failed to load %s.\n", gltfFile.c_str());
+            exit(2);
+        }
+    } else if (streamLoad) {
+        startStreaming("assets/sponza", "sponza.obj", mesh);
+    } else if (outOfCore) {
+        if (!openCellFile("assets/sponza/sponza.obj", mesh, textures)) {
+            if (!buildCellFile("assets/sponza", "sponza.obj", cellTriangles) ||
+                !openCellFile("assets/sponza/sponza.obj", mesh, textures)) {
+                printf("Failed to build cells.\n");
+                exit(2);
+            }
+        }
+        loadTextures("assets/sponza", textures);
+        for (u32 c = 0, n = textures.size(); c < n; c++) {
+            mesh.textures[c].glHandle = textures[c].texName;
+        }
+    } else if (loadMeshCache("assets/sponza/sponza.obj", mesh, textures, vertexFormat, splitTriangles)) {
+        loadTextures("assets/sponza", textures);
+        for (u32 c = 0, n = textures.size(); c < n; c++) {
+            mesh.textures[c].glHandle = textures[c].texName;
+        }
+        assignShaders(mesh);
+    } else {
+        OBJMesh obj;
+        bool success = loadObjFile("assets/sponza", "sponza.obj", obj, OBJ_LOAD_THREADED | OBJ_LOAD_WELD);
+        if (!success) {
+            printf("Failed to load materials.\n");
+            exit(2);
+        }
+        printf("Loaded %zu materials.\n", obj.materials.size());
+        printf("Loaded %zu mesh parts.\n", obj.meshParts.size());
+        printf("Loaded %zu vertices and %zu indices.\n", obj.verts.size(), obj.indices.size());
 
-    loadTextures("assets/sponza", obj);
+        loadTextures("assets/sponza", obj.textures);
 
-    obj2mesh(obj, mesh);
+        obj2mesh(obj, mesh, "assets/sponza/sponza.obj", vertexFormat, splitTriangles);
+    }
+    if (!streamLoad) {
+        printPeakMemory("loading");
+    }
 
     float testVerts[] = {
         0, 0, 0,    // position
@@ -120,6 +229,374 @@ void setup() {
     flyCam.m_pos = vec3(0, 200, 0);
 }
 
+// The coarsest level of detail of an object part whose error stays under maxLodError pixels,
+// as seen from the nearest point of its bounding sphere.
+static u32 selectLod(u32 objectPart, const vec3 &center, f32 radius, const vec3 &camPos) {
+    u32 level = 0;
+    if (!useLods || mesh.lods.empty()) return level;
+    f32 distance = std::max(length(center - camPos) - radius, nearPlane);
+    f32 allowedError = maxLodError * distance / lodPixelScale;
+    const LodLevel *levels = &mesh.lods[objectPart * MAX_LODS];
+    while (level + 1 < MAX_LODS && levels[level + 1].error <= allowedError) {
+        level++;
+    }
+    return level;
+}
+
+// Draws the instances of an object part that are in the frustum, each run of neighbors at the
+// same level of detail in one instanced draw, or each on its own under conditionalQueries.
+// Meshlets aren't culled per instance.
+static void drawInstances(u32 objectPart, const vec3 &camPos) {
+    const ObjectPart &op = mesh.objectParts[objectPart];
+    const MeshPart &mp = mesh.parts[op.part];
+    const Bounds &bounds = mesh.objects[op.object].bounds;
+    u32 runStart = 0, runCount = 0, runLevel = 0;
+    auto drawRun = [&]() {
+        if (runCount == 0) return;
+        u32 offset = op.offset, size = op.size;
+        if (runLevel > 0) {
+            offset = mesh.lods[objectPart * MAX_LODS + runLevel].offset;
+            size = mesh.lods[objectPart * MAX_LODS + runLevel].size;
+        }
+        bindInstances(s32(runStart));
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, size, mp.indexType,
+                                          (void *)(uintptr_t(offset) * indexSize(mp.indexType)), runCount, GLint(mp.baseVertex));
+        drawStats.draws++;
+        drawStats.triangles += u64(size / 3) * runCount;
+        runCount = 0;
+    };
+
+    for (u32 c = mesh.firstInstance[objectPart], end = mesh.firstInstance[objectPart + 1]; c < end; c++) {
+        vec3 center = vec3(mesh.instances[c] * vec4(bounds.center, 1));
+        drawStats.instances++;
+        if (useCulling && !boxVisible[mesh.objectParts.size() + c]) {
+            drawStats.culledInstances++;
+            drawStats.culledTriangles += op.size / 3;
+            drawRun();
+            continue;
+        }
+        u32 level = selectLod(objectPart, center, bounds.radius, camPos);
+        if (runCount > 0 && level != runLevel) drawRun();
+        if (runCount == 0) {
+            runStart = c;
+            runLevel = level;
+        }
+        runCount++;
+        if (conditionalQueries) {
+            glBeginConditionalRender(conditionalQueries[mesh.objectParts.size() + c], GL_QUERY_WAIT);
+            drawRun();
+            glEndConditionalRender();
+        }
+    }
+    drawRun();
+    bindInstances(-1);
+}
+
+// Draws the object parts of a part that are in the frustum, each at the level of detail from
+// selectLod. At full detail, only the meshlets in the frustum that face the camera are drawn,
+// with neighboring ranges joined into one. Object parts with instances are drawn after the rest.
+// Under conditionalQueries, each object part is its own draw, made only if its query passed.
+static void drawObjectParts(u32 index, const vec3 &camPos) {
+    static vector<GLsizei> counts;
+    static vector<const void *> offsets;
+    static vector<GLint> baseVertices;
+    counts.clear();
+    offsets.clear();
+    const MeshPart &mp = mesh.parts[index];
+    u32 stride = indexSize(mp.indexType);
+
+    u32 lastEnd = 0;
+    auto drawRange = [&](u32 offset, u32 size) {
+        if (!counts.empty() && offset == lastEnd) {
+            counts.back() += GLsizei(size);
+        } else {
+            counts.push_back(GLsizei(size));
+            offsets.push_back((void *)(uintptr_t(offset) * stride));
+        }
+        lastEnd = offset + size;
+        drawStats.triangles += size / 3;
+    };
+    auto submit = [&]() {
+        if (counts.empty()) return;
+        baseVertices.assign(counts.size(), GLint(mp.baseVertex));
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), mp.indexType, offsets.data(),
+                                      GLsizei(counts.size()), baseVertices.data());
+        drawStats.draws += counts.size();
+        counts.clear();
+        offsets.clear();
+    };
+    auto drawMeshlets = [&](u32 objectPart) {
+        for (u32 c = mesh.firstMeshlet[objectPart], end = mesh.firstMeshlet[objectPart + 1]; c < end; c++) {
+            const Meshlet &meshlet = mesh.meshlets[c];
+            drawStats.meshlets++;
+            if (!sphereInFrustum(frustumPlanes, meshlet.center, meshlet.radius) || isBackfacing(meshlet, camPos)) {
+                drawStats.culledMeshlets++;
+                drawStats.culledTriangles += meshlet.size / 3;
+                continue;
+            }
+            if (useOcclusion && boxOccluded(occlusionBuffer, meshlet.center - vec3(meshlet.radius),
+                                            meshlet.center + vec3(meshlet.radius))) {
+                drawStats.culledMeshlets++;
+                drawStats.culledTriangles += meshlet.size / 3;
+                drawStats.occluded++;
+                continue;
+            }
+            drawRange(meshlet.offset, meshlet.size);
+        }
+    };
+
+    auto first = lower_bound(mesh.objectParts.begin(), mesh.objectParts.end(), index,
+                             [](const ObjectPart &objectPart, u32 part) { return objectPart.part < part; });
+    static vector<u32> instanced;
+    instanced.clear();
+    for (auto it = first; it != mesh.objectParts.end() && it->part == index; ++it) {
+        u32 objectPart = u32(it - mesh.objectParts.begin());
+        if (!mesh.firstInstance.empty() && mesh.firstInstance[objectPart] != mesh.firstInstance[objectPart + 1]) {
+            instanced.push_back(objectPart);
+            continue;
+        }
+        const Bounds &bounds = mesh.objects[it->object].bounds;
+        if (useCulling && !boxVisible[objectPart]) {
+            drawStats.culledObjectParts++;
+            drawStats.culledTriangles += it->size / 3;
+            continue;
+        }
+
+        if (conditionalQueries) {
+            submit(); // anything before this object part draws unconditionally
+            glBeginConditionalRender(conditionalQueries[objectPart], GL_QUERY_WAIT);
+        }
+
+        u32 level = selectLod(objectPart, bounds.center, bounds.radius, camPos);
+        if (level > 0) {
+            const LodLevel &lod = mesh.lods[objectPart * MAX_LODS + level];
+            drawRange(lod.offset, lod.size);
+        } else if (!useCulling || mesh.meshlets.empty()) {
+            drawRange(it->offset, it->size);
+        } else {
+            drawMeshlets(objectPart);
+        }
+
+        if (conditionalQueries) {
+            submit();
+            glEndConditionalRender();
+        }
+    }
+    submit();
+    for (u32 objectPart : instanced) {
+        drawInstances(objectPart, camPos);
+    }
+}
+
+// Draws one part. Parts with their own binding use its VAO and transform, with the camera
+// and light moved into the part's space since the shaders light in object space.
+void drawPart(u32 index, u16 shader, const mat4 &mvp, const vec3 &camPos, const vec3 &lightPos) {
+    const MeshPart &mp = mesh.parts[index];
+    const Material &mat = mesh.materials[mp.material];
+    bindShader(shader);
+    if (mesh.partBindings.empty()) {
+        bindMaterial(mvp, camPos, lightPos, mesh, mat);
+        if ((useLods && !mesh.lods.empty()) || (useCulling && !mesh.objectParts.empty()) || !mesh.instances.empty()) {
+            drawObjectParts(index, camPos);
+        } else {
+            glDrawElementsBaseVertex(GL_TRIANGLES, mp.size, mp.indexType,
+                                     (void *)(uintptr_t(mp.offset) * indexSize(mp.indexType)), GLint(mp.baseVertex));
+            drawStats.draws++;
+            drawStats.triangles += mp.size / 3;
+        }
+        return;
+    }
+
+    const PartBinding &binding = mesh.partBindings[index];
+    glBindVertexArray(binding.vao);
+    bindMaterial(mvp * binding.transform, vec3(binding.inverse * vec4(camPos, 1)),
+                 vec3(binding.inverse * vec4(lightPos, 1)), mesh, mat);
+    switch (mp.indexType) {
+        case GL_UNSIGNED_BYTE:
+            glDrawElements(GL_TRIANGLES, mp.size, GL_UNSIGNED_BYTE, (void *)(uintptr_t) mp.offset);
+            break;
+        case GL_UNSIGNED_SHORT:
+            glDrawElements(GL_TRIANGLES, mp.size, GL_UNSIGNED_SHORT, (void *)(mp.offset * sizeof(u16)));
+            break;
+        case GL_UNSIGNED_INT:
+            glDrawElements(GL_TRIANGLES, mp.size, GL_UNSIGNED_INT, (void *)(mp.offset * sizeof(u32)));
+            break;
+        default:
+            glDrawArrays(GL_TRIANGLES, mp.offset, mp.size);
+            break;
+    }
+    drawStats.draws++;
+    drawStats.triangles += mp.size / 3;
+}
+
+// Tests the bounds of every object part and instance against the frustum, for drawObjectParts,
+// then the ones inside it against the occluders. With instancesOnly, for the GPU culled path,
+// only the instances are tested, against just the frustum; the compute shaders do the rest.
+static void cullObjects(const mat4 &mvp, bool instancesOnly) {
+    u32 count = u32(mesh.objectParts.size() + mesh.instances.size());
+    if (boxCount(cullBoxList) != count) {
+        buildCullBoxes(mesh, cullBoxList);
+    }
+    boxVisible.resize(count);
+    auto startTime = chrono::high_resolution_clock::now();
+    cullBoxes(cullBoxList, frustumPlanes, boxVisible.data(), instancesOnly ? u32(mesh.objectParts.size()) : 0);
+    drawStats.cullNanoseconds += u64(chrono::duration_cast<chrono::nanoseconds>(
+        chrono::high_resolution_clock::now() - startTime).count());
+
+    occlusionBuffer.depth.clear(); // boxOccluded says no to everything
+    if (instancesOnly || !useOcclusion || useQueries || mesh.occluders.empty()) return;
+    startTime = chrono::high_resolution_clock::now();
+    renderOccluders(occlusionBuffer, mesh.occluders, mvp);
+    for (u32 c = 0; c < count; c++) {
+        if (!boxVisible[c]) continue;
+        vec3 min(cullBoxList.minX[c], cullBoxList.minY[c], cullBoxList.minZ[c]);
+        vec3 max(cullBoxList.maxX[c], cullBoxList.maxY[c], cullBoxList.maxZ[c]);
+        if (boxOccluded(occlusionBuffer, min, max)) {
+            boxVisible[c] = 0;
+            drawStats.occluded++;
+        }
+    }
+    drawStats.occlusionNanoseconds += u64(chrono::duration_cast<chrono::nanoseconds>(
+        chrono::high_resolution_clock::now() - startTime).count());
+}
+
+// Draws every part, or just the one picked with R/F, as renderMode says.
+static void drawParts(const mat4 &mvp, const vec3 &camPos, const vec3 &lightPos) {
+    if (part != -1) {
+        const MeshPart &mp = mesh.parts[part];
+        drawPart(part, renderMode == kDiffuseTex ? mp.shader : u16(renderMode), mvp, camPos, lightPos);
+    } else if (renderMode == kDiffuseTex) {
+        for (int c = 0, n = mesh.parts.size(); c < n; c++) {
+            drawPart(c, mesh.parts[c].shader, mvp, camPos, lightPos);
+        }
+    } else {
+        // parts can have their own buffers or index types, so they can't go in one draw.
+        for (int c = 0, n = mesh.parts.size(); c < n; c++) {
+            drawPart(c, u16(renderMode), mvp, camPos, lightPos);
+        }
+    }
+}
+
+// The number of full detail triangles in box c of cullBoxList.
+static u32 boxTriangles(u32 box) {
+    u32 numObjectParts = u32(mesh.objectParts.size());
+    if (box < numObjectParts) return mesh.objectParts[box].size / 3;
+    u32 instance = box - numObjectParts;
+    u32 objectPart = u32(upper_bound(mesh.firstInstance.begin(), mesh.firstInstance.end(), instance) -
+                         mesh.firstInstance.begin()) - 1;
+    return mesh.objectParts[objectPart].size / 3;
+}
+
+// Draws with occlusion queries, after coherent hierarchical culling: the boxes in the frustum
+// whose last query saw them are drawn first, then every box in the frustum is queried against
+// that depth, and the rest are drawn under conditional render of their query, so the GPU skips
+// them without the CPU waiting for any results. The results are read back later, once ready,
+// and decide which boxes go first in the frames after.
+static void drawWithQueries(const mat4 &mvp, const vec3 &camPos, const vec3 &lightPos) {
+    u32 count = boxCount(cullBoxList);
+    if (occlusionQueries.current.size() != count) {
+        initOcclusionQueries(occlusionQueries, cullBoxList);
+        drawnConditionally.assign(count, 0);
+    }
+
+    static vector<u32> hidden;
+    hidden.clear();
+    readQueryResults(occlusionQueries, hidden);
+    for (u32 c : hidden) {
+        if (drawnConditionally[c]) drawStats.skippedTriangles += boxTriangles(c);
+    }
+
+    // Object parts with instances have a box that's never drawn, so it isn't queried either.
+    static vector<u8> inFrustum, test;
+    inFrustum = boxVisible;
+    test.assign(count, 0);
+    u32 numObjectParts = u32(mesh.objectParts.size());
+    for (u32 c = 0; c < count; c++) {
+        if (!inFrustum[c]) continue;
+        if (c < numObjectParts && !mesh.firstInstance.empty() && mesh.firstInstance[c] != mesh.firstInstance[c + 1]) continue;
+        // The camera's inside the box, or close enough for the near plane to cut it.
+        bool inside = camPos.x > cullBoxList.minX[c] - nearPlane && camPos.x < cullBoxList.maxX[c] + nearPlane &&
+                      camPos.y > cullBoxList.minY[c] - nearPlane && camPos.y < cullBoxList.maxY[c] + nearPlane &&
+                      camPos.z > cullBoxList.minZ[c] - nearPlane && camPos.z < cullBoxList.maxZ[c] + nearPlane;
+        test[c] = !inside;
+    }
+
+    for (u32 c = 0; c < count; c++) {
+        boxVisible[c] = inFrustum[c] && (occlusionQueries.visible[c] || !test[c]);
+    }
+    drawParts(mvp, camPos, lightPos);
+
+    drawStats.queries += issueQueries(occlusionQueries, test.data(), mvp);
+    bindVertexFormat(mesh.vertexFormat, mesh.positionOffset, mesh.positionScale);
+    glBindVertexArray(mesh.vao);
+
+    for (u32 c = 0; c < count; c++) {
+        drawnConditionally[c] = test[c] && !boxVisible[c];
+        boxVisible[c] = drawnConditionally[c];
+        drawStats.conditionalBoxes += drawnConditionally[c];
+    }
+    // The second pass goes over the same boxes, so only its draws go in the stats. The boxes
+    // it draws were counted as culled by the first pass, and are counted again as conditional.
+    DrawStats firstPass = drawStats;
+    conditionalQueries = occlusionQueries.current.data();
+    drawParts(mvp, camPos, lightPos);
+    conditionalQueries = nullptr;
+    firstPass.draws = drawStats.draws;
+    firstPass.triangles = drawStats.triangles;
+    drawStats = firstPass;
+}
+
+// Draws the object parts of a part that have instances, which GPU culling leaves to the CPU.
+static void drawPartInstances(u32 index, const vec3 &camPos) {
+    if (mesh.firstInstance.empty()) return;
+    auto first = lower_bound(mesh.objectParts.begin(), mesh.objectParts.end(), index,
+                             [](const ObjectPart &objectPart, u32 part) { return objectPart.part < part; });
+    for (auto it = first; it != mesh.objectParts.end() && it->part == index; ++it) {
+        u32 objectPart = u32(it - mesh.objectParts.begin());
+        if (mesh.firstInstance[objectPart] != mesh.firstInstance[objectPart + 1]) {
+            drawInstances(objectPart, camPos);
+        }
+    }
+}
+
+// Draws with the culling and level of detail picking done in compute shaders (see gpu_culling.h),
+// leaving the CPU one material and one indirect draw per part in each of the two phases.
+static void drawGpuCulled(const mat4 &mvp, const vec3 &camPos, const vec3 &lightPos) {
+    if (!gpuCullingMatches(gpuCulling, mesh) && !initGpuCulling(gpuCulling, mesh)) {
+        useGpuCulling = false;
+        drawParts(mvp, camPos, lightPos);
+        return;
+    }
+
+    GpuCullView view;
+    view.viewProjection = mvp;
+    for (int c = 0; c < 6; c++) {
+        view.frustum[c] = frustumPlanes[c];
+    }
+    view.camPos = camPos;
+    view.useCulling = useCulling;
+    view.useLods = useLods;
+    view.maxLodError = maxLodError;
+    view.lodPixelScale = lodPixelScale;
+    view.nearPlane = nearPlane;
+    view.width = viewportWidth;
+    view.height = viewportHeight;
+
+    for (u32 phase = 0; phase < GPU_CULL_PHASES; phase++) {
+        cullClusters(gpuCulling, view, phase);
+        for (u32 c = 0, n = u32(mesh.parts.size()); c < n; c++) {
+            if (part != -1 && c != u32(part)) continue;
+            // Instances are drawn with the first phase, so the second only needs parts with clusters.
+            if (phase > 0 && gpuCulling.firstCluster[c] == gpuCulling.firstCluster[c + 1]) continue;
+            const MeshPart &mp = mesh.parts[c];
+            bindShader(renderMode == kDiffuseTex ? mp.shader : u16(renderMode));
+            bindMaterial(mvp, camPos, lightPos, mesh, mesh.materials[mp.material]);
+            drawStats.draws += drawCulledPart(gpuCulling, mesh, c, phase);
+            if (phase == 0) drawPartInstances(c, camPos);
+        }
+    }
+}
+
 void draw(s32 dt) {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -129,33 +606,33 @@ void draw(s32 dt) {
     mat4 mvp = projection * mv;
     vec3 camPos = cam->m_pos;
     vec3 lightPos = orbitCam.m_pos;
+    bindVertexFormat(mesh.vertexFormat, mesh.positionOffset, mesh.positionScale);
+    extractFrustum(mvp, frustumPlanes);
+    drawStats.frames++;
+
+    if (outOfCore) {
+        drawCells(mvp, camPos, lightPos, mesh);
+        return;
+    }
 
     glBindVertexArray(mesh.vao);
-    if (part == -1) {
-        if (renderMode == kDiffuseTex) {
-            for (int c = 0, n = mesh.parts.size(); c < n; c++) {
-                MeshPart &mp = mesh.parts[c];
-                Material &mat = mesh.materials[mp.material];
-                bindShader(mp.shader);
-                bindMaterial(mvp, camPos, lightPos, mesh, mat);
-                glDrawElements(GL_TRIANGLES, mp.size, GL_UNSIGNED_INT, (void *)(mp.offset * sizeof(u32)));
-            }
-        } else {
-            // screw mesh parts, just draw everything.
-            bindShader(renderMode);
-            bindMaterial(mvp, camPos, lightPos, mesh, mesh.materials[0]);
-            glDrawElements(GL_TRIANGLES, mesh.size, GL_UNSIGNED_INT, 0);
-        }
+    if (mesh.parts.empty()) return; // still streaming in
+    bool gpuCulled = useGpuCulling && mesh.partBindings.empty() && !mesh.objectParts.empty();
+    if (useCulling) {
+        cullObjects(mvp, gpuCulled);
+    }
+    if (gpuCulled) {
+        drawGpuCulled(mvp, camPos, lightPos);
+    } else if (useCulling && useQueries && mesh.partBindings.empty() && !mesh.objectParts.empty()) {
+        drawWithQueries(mvp, camPos, lightPos);
     } else {
-        MeshPart &mp = mesh.parts[part];
-        Material &mat = mesh.materials[mp.material];
-        u16 shader = renderMode == kDiffuseTex ? mp.shader : u16(renderMode);
-        bindShader(shader);
-        bindMaterial(mvp, camPos, lightPos, mesh, mat);
-        glDrawElements(GL_TRIANGLES, mp.size, GL_UNSIGNED_INT, (void *)(mp.offset * sizeof(u32)));
-
+        drawParts(mvp, camPos, lightPos);
+    }
+    if (part != -1) {
+        Material &mat = mesh.materials[mesh.parts[part].material];
         if (materialPreview) {
             glBindVertexArray(testVao);
+            bindVertexFormat(kFloatVertex);
             mat4 idt4(1);
             bindMaterial(idt4, vec3(0,0,1), lightPos, mesh, mat);
             glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr);
@@ -166,9 +643,12 @@ void draw(s32 dt) {
 static void glfw_resize_callback(GLFWwindow *window, int width, int height) {
     printf("resize: %dx%d\n", width, height);
     glViewport(0, 0, width, height);
+    viewportWidth = width;
+    viewportHeight = height;
     if (height != 0) {
         float aspect = float(width) / height;
-        projection = perspective(31.f, aspect, 10.f, 10000.f);
+        projection = perspective(31.f, aspect, nearPlane, farPlane);
+        lodPixelScale = projection[1][1] * height * 0.5f;
     }
 }
 
@@ -193,6 +673,21 @@ static void glfw_key_callback(GLFWwindow* window, int key, int scancode, int act
         }
     } else if (key == GLFW_KEY_P) {
         materialPreview = !materialPreview;
+    } else if (key == GLFW_KEY_L) {
+        useLods = !useLods;
+        printf("LODs %s\n", useLods ? "on" : "off");
+    } else if (key == GLFW_KEY_K) {
+        useCulling = !useCulling;
+        printf("Culling %s\n", useCulling ? "on" : "off");
+    } else if (key == GLFW_KEY_O) {
+        useOcclusion = !useOcclusion;
+        printf("Occlusion culling %s\n", useOcclusion ? "on" : "off");
+    } else if (key == GLFW_KEY_G) {
+        useGpuCulling = !useGpuCulling;
+        printf("GPU culling %s\n", useGpuCulling ? "on" : "off");
+    } else if (key == GLFW_KEY_Q) {
+        useQueries = !useQueries;
+        printf("Occlusion %s\n", useQueries ? "queries on the GPU" : "test on the CPU");
     } else if (key == GLFW_KEY_C) {
         currentCamera++;
         if (currentCamera >= nCameras) {
@@ -239,6 +734,8 @@ void glfw_error_callback(int error, const char* description) {
     cerr << "GLFW Error: " << description << " (error " << error << ")" << endl;
 }
 
+static int uploadTexture(GLuint texname, unsigned char *pixels, int width, int height, int bpp, int format);
+
 /**
  * Loads a texture from the filesystem into OpenGL. Returns the number of channels loaded, or 0 on failure.
  * @param texname
@@ -247,8 +744,6 @@ void glfw_error_callback(int error, const char* description) {
  * @return
  */
 int loadTexture(GLuint texname, const char *filename, int format /* = STBI_default */) {
-    glBindTexture(GL_TEXTURE_2D, texname);
-
     int width, height, bpp;
     unsigned char *pixels = stbi_load(filename, &width, &height, &bpp, format);
     if (pixels == nullptr) {
@@ -256,6 +751,26 @@ int loadTexture(GLuint texname, const char *filename, int format /* = STBI_defau
         return 0;
     }
     cout << "Loaded " << filename << ", " << height << 'x' << width << ", comp = " << bpp << endl;
+    return uploadTexture(texname, pixels, width, height, bpp, format);
+}
+
+/**
+ * Like loadTexture, but decodes an image file that's already in memory. name is only for logging.
+ */
+int loadTextureFromMemory(GLuint texname, const u8 *data, u32 size, const char *name, int format /* = STBI_default */) {
+    int width, height, bpp;
+    unsigned char *pixels = stbi_load_from_memory(data, int(size), &width, &height, &bpp, format);
+    if (pixels == nullptr) {
+        cout << "Failed to load image " << name << " (" << stbi_failure_reason() << ")" << endl;
+        return 0;
+    }
+    cout << "Loaded " << name << ", " << height << 'x' << width << ", comp = " << bpp << endl;
+    return uploadTexture(texname, pixels, width, height, bpp, format);
+}
+
+// Uploads and frees pixels as returned by stbi_load.
+static int uploadTexture(GLuint texname, unsigned char *pixels, int width, int height, int bpp, int format) {
+    glBindTexture(GL_TEXTURE_2D, texname);
 
     if (format != STBI_default && format != bpp) {
         cout << "Changing num channels from " << bpp << " to " << format << endl;
@@ -295,7 +810,27 @@ int loadTexture(GLuint texname, const char *filename, int format /* = STBI_defau
     return bpp;
 }
 
-int main() {
+int main(int argc, char **argv) {
+    for (int c = 1; c < argc; c++) {
+        if (strcmp(argv[c], "--stream") == 0) {
+            streamLoad = true;
+        } else if (strcmp(argv[c], "--out-of-core") == 0) {
+            outOfCore = true;
+        } else if (strncmp(argv[c], "--gpu-budget=", 13) == 0) {
+            gpuBudget = u64(atoi(argv[c] + 13)) << 20;
+        } else if (strcmp(argv[c], "--float-vertices") == 0) {
+            vertexFormat = kFloatVertex;
+        } else if (strncmp(argv[c], "--split-triangles=", 18) == 0) {
+            splitTriangles = u32(atoi(argv[c] + 18));
+        } else if (strcmp(argv[c], "--depth-bench") == 0) {
+            depthBench = true;
+        } else if (strncmp(argv[c], "--gltf=", 7) == 0) {
+            gltfFile = argv[c] + 7;
+        } else {
+            cout << "Unknown argument: " << argv[c] << endl;
+        }
+    }
+
     if (!glfwInit()) {
         cout << "Failed to init GLFW" << endl;
         exit(-1);
@@ -304,13 +839,19 @@ int main() {
 
     glfwSetErrorCallback(glfw_error_callback);
 
+    // GPU culling (G) needs 4.3 for compute shaders. Everything else runs on 4.0, so fall back to
+    // that where 4.3 isn't there (macOS stops at 4.1), and G just stays off.
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 #ifdef APPLE
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 #endif
     window = glfwCreateWindow(640, 480, "Sponza Playground", NULL, NULL);
+    if (!window) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+        window = glfwCreateWindow(640, 480, "Sponza Playground", NULL, NULL);
+    }
     if (!window) {
         cout << "Failed to create window" << endl;
         exit(-1);
@@ -340,6 +881,14 @@ int main() {
     glfwGetFramebufferSize(window, &width, &height);
     glfw_resize_callback(window, width, height); // call resize once with the initial size
 
+    if (depthBench) {
+        Camera *cam = cameras[currentCamera];
+        cam->update(0);
+        runDepthBench(mesh, projection * cam->m_view);
+        glfwTerminate();
+        return 0;
+    }
+
     // make sure performance data is clean going into main loop
     markPerformanceFrame();
     printPerformanceData();
@@ -352,6 +901,16 @@ int main() {
             glfwPollEvents();
             checkError();
         }
+        if (outOfCore) {
+            Perf stat("Cells");
+            updateCells(mesh, cameras[currentCamera]->m_pos, gpuBudget);
+            checkError();
+        }
+        if (isStreaming()) {
+            Perf stat("Streaming");
+            updateStreaming(mesh);
+            checkError();
+        }
         {
             Perf stat("Draw");
             clock_t now = clock() * 1000 / CLOCKS_PER_SEC;
@@ -371,9 +930,12 @@ int main() {
         double now = glfwGetTime();
         if (now - lastPerfPrintTime > 10.0) {
             printPerformanceData();
+            printDrawStats();
             lastPerfPrintTime = now;
         }
     }
 
+    stopStreaming();
+    closeCellFile();
     return 0;
 }
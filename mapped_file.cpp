@@ -0,0 +1,92 @@
+#include "mapped_file.h"
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef WINDOWS
+
+bool mapFile(const std::string &filename, MappedFile &file) {
+    HANDLE handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size)) {
+        CloseHandle(handle);
+        return false;
+    }
+
+    file.file = handle;
+    file.size = u64(size.QuadPart);
+    if (file.size == 0) {
+        return true;
+    }
+
+    HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(handle);
+        file.file = nullptr;
+        return false;
+    }
+
+    file.mapping = mapping;
+    file.data = (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!file.data) {
+        unmapFile(file);
+        return false;
+    }
+    return true;
+}
+
+void unmapFile(MappedFile &file) {
+    if (file.data) UnmapViewOfFile(file.data);
+    if (file.mapping) CloseHandle((HANDLE) file.mapping);
+    if (file.file) CloseHandle((HANDLE) file.file);
+    file = MappedFile();
+}
+
+#else
+
+bool mapFile(const std::string &filename, MappedFile &file) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return false;
+    }
+
+    file.fd = fd;
+    file.size = u64(info.st_size);
+    if (file.size == 0) {
+        return true;
+    }
+
+    void *data = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        unmapFile(file);
+        return false;
+    }
+    madvise(data, file.size, MADV_SEQUENTIAL);
+    file.data = (const char *) data;
+    return true;
+}
+
+void unmapFile(MappedFile &file) {
+    if (file.data) munmap((void *) file.data, file.size);
+    if (file.fd >= 0) close(file.fd);
+    file = MappedFile();
+}
+
+#endif
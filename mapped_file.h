@@ -0,0 +1,23 @@
+#ifndef SPONZA_MAPPED_FILE_H
+#define SPONZA_MAPPED_FILE_H
+
+#include <string>
+#include "types.h"
+
+// A read-only view of an entire file, mapped into memory.
+// data is nullptr for empty files, which is not an error.
+struct MappedFile {
+    const char *data = nullptr;
+    u64 size = 0;
+#ifdef WINDOWS
+    void *file = nullptr;
+    void *mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+bool mapFile(const std::string &filename, MappedFile &file);
+void unmapFile(MappedFile &file);
+
+#endif //SPONZA_MAPPED_FILE_H
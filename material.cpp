@@ -15,11 +15,22 @@ using namespace glm;
 const char *vert = GLSL(
         uniform mat4 mvp;
 
+        // Set for CompactVertex buffers (see mesh.h). Their positions are unorms within the
+        // mesh's box, and their normals and tangents are octahedral.
+        uniform bool compactVertex;
+        uniform vec3 positionOffset;
+        uniform vec3 positionScale;
+
+        // Set when drawing instances (see Mesh::instances). Each transform is four texels,
+        // and instance gl_InstanceID uses the one instanceOffset + gl_InstanceID along.
+        uniform int instanceOffset; // -1 when not drawing instances
+        uniform samplerBuffer instanceTransforms;
+
         // These constants are duplicated in material.h as VAO_*
-        layout(location=0) in vec3 position;
+        layout(location=0) in vec4 position; // compact: w is 1 if the bitangent is cross(normal, tangent), else 0
         layout(location=1) in vec3 normal;
         layout(location=2) in vec2 tex;
-        layout(location=3) in vec3 tangent;
+        layout(location=3) in vec4 tangent; // w is the handedness if there's no bitangent
         layout(location=4) in vec3 bitangent;
 
         out vec3 f_position;
@@ -28,16 +39,72 @@ const char *vert = GLSL(
         out vec3 f_tangent;
         out vec3 f_bitangent;
 
+        vec3 octDecode(vec2 e) {
+            vec3 v = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+            if (v.z < 0.0) v.xy = (1.0 - abs(v.yx)) * mix(vec2(-1.0), vec2(1.0), greaterThanEqual(v.xy, vec2(0.0)));
+            return normalize(v);
+        }
+
+        mat4 instanceTransform() {
+            if (instanceOffset < 0) return mat4(1.0);
+            int texel = (instanceOffset + gl_InstanceID) * 4;
+            return mat4(texelFetch(instanceTransforms, texel), texelFetch(instanceTransforms, texel + 1),
+                        texelFetch(instanceTransforms, texel + 2), texelFetch(instanceTransforms, texel + 3));
+        }
+
         void main() {
-            gl_Position = mvp * vec4(position, 1.0);
-            f_position = position;
-            f_normal = normal;
+            vec3 pos = position.xyz;
+            vec3 nor = normal;
+            vec3 tan = tangent.xyz;
+            float handedness = tangent.w;
+            if (compactVertex) {
+                pos = positionOffset + positionScale * position.xyz;
+                nor = octDecode(normal.xy);
+                tan = octDecode(tangent.xy);
+                handedness = position.w * 2.0 - 1.0;
+            }
+
+            // Instances are only ever moved and turned, so the normals can go through the same matrix.
+            mat4 model = instanceTransform();
+            vec3 btn = dot(bitangent, bitangent) > 0 ? bitangent : cross(nor, tan) * handedness;
+            pos = (model * vec4(pos, 1.0)).xyz;
+
+            gl_Position = mvp * vec4(pos, 1.0);
+            f_position = pos;
+            f_normal = mat3(model) * nor;
             f_tex = tex;
-            f_tangent = tangent;
-            f_bitangent = bitangent;
+            f_tangent = mat3(model) * tan;
+            f_bitangent = mat3(model) * btn;
+        }
+);
+
+// Writes nothing but depth, so it only reads the positions (see Mesh::positionVao).
+const char *depthVert = GLSL(
+        uniform mat4 mvp;
+        uniform bool compactVertex;
+        uniform vec3 positionOffset;
+        uniform vec3 positionScale;
+        uniform int instanceOffset;
+        uniform samplerBuffer instanceTransforms;
+
+        layout(location=0) in vec4 position;
+
+        void main() {
+            vec3 pos = compactVertex ? positionOffset + positionScale * position.xyz : position.xyz;
+            if (instanceOffset >= 0) {
+                int texel = (instanceOffset + gl_InstanceID) * 4;
+                pos = (mat4(texelFetch(instanceTransforms, texel), texelFetch(instanceTransforms, texel + 1),
+                            texelFetch(instanceTransforms, texel + 2), texelFetch(instanceTransforms, texel + 3)) *
+                       vec4(pos, 1.0)).xyz;
+            }
+            gl_Position = mvp * vec4(pos, 1.0);
         }
 );
 
+const char *depthFrag = GLSL(
+        void main() {}
+);
+
 // ------------------ End Shader Text -----------------------
 
 
@@ -244,6 +311,11 @@ inline void disableAll() {
 struct CommonUniforms {
     GLuint mvp;
     GLuint lightPos;
+    GLuint compactVertex;
+    GLuint positionOffset;
+    GLuint positionScale;
+    GLuint instanceOffset;
+    GLuint instanceTransforms;
 };
 
 struct DiffuseUniforms {
@@ -282,8 +354,16 @@ struct Shader {
 };
 
 Shader shaders[kNumShaders];
+Shader depthShader;
 const Shader *currentShader = nullptr;
 
+// Set by bindVertexFormat, applied by bindMaterial.
+struct {
+    VertexFormat format = kFloatVertex;
+    vec3 positionOffset = vec3(0);
+    vec3 positionScale = vec3(1);
+} vertexFormat;
+
 // ------------------ End Shader Data -----------------------
 
 
@@ -299,6 +379,11 @@ inline Uniforms buildUniforms(GLuint shader, u32 flags) {
 
     getUniform(common, mvp);
     getUniform(common, lightPos);
+    getUniform(common, compactVertex);
+    getUniform(common, positionOffset);
+    getUniform(common, positionScale);
+    getUniform(common, instanceOffset);
+    getUniform(common, instanceTransforms);
 
     if (flags & fDiffuseTex) {
         getUniform(diffuse, ambientTex);
@@ -324,6 +409,11 @@ inline Uniforms buildUniforms(GLuint shader, u32 flags) {
 inline void bindUniformsBase(const CommonUniforms &uniforms, const glm::mat4 &mvp, const glm::vec3 &lightPos) {
     glUniformMatrix4fv(uniforms.mvp, 1, GL_FALSE, &mvp[0][0]);
     glUniform3f(uniforms.lightPos, lightPos.x, lightPos.y, lightPos.z);
+    glUniform1i(uniforms.compactVertex, vertexFormat.format == kCompactVertex);
+    glUniform3fv(uniforms.positionOffset, 1, &vertexFormat.positionOffset[0]);
+    glUniform3fv(uniforms.positionScale, 1, &vertexFormat.positionScale[0]);
+    glUniform1i(uniforms.instanceOffset, -1);
+    glUniform1i(uniforms.instanceTransforms, 5);
 }
 
 inline void bindUniformsDiffuse(const DiffuseUniforms &uniforms, const Mesh &mesh, const Material &material) {
@@ -366,6 +456,10 @@ inline void bindUniformsBump(const BumpUniforms &uniforms, const Mesh &mesh, con
 
 void bindUniforms(const Uniforms &uniforms, const glm::mat4 &mvp, const glm::vec3 camPos, const glm::vec3 &lightPos, const Mesh &mesh, const Material &material) {
     bindUniformsBase(uniforms.common, mvp, lightPos);
+    if (mesh.instanceTexture) {
+        glActiveTexture(GL_TEXTURE5);
+        glBindTexture(GL_TEXTURE_BUFFER, mesh.instanceTexture);
+    }
 
     if (uniforms.flags & fDiffuseTex) {
         bindUniformsDiffuse(uniforms.diffuse, mesh, material);
@@ -419,6 +513,11 @@ void initShaders() {
     initShader(kDiffuseAlphaBumpTex, fAmbientTex | fDiffuseTex | fTransparencyTex | fNormalTangentTex);
     initShader(kSpecularAlphaBumpTex, fAmbientTex | fDiffuseTex | fSpecularTex | fTransparencyTex | fNormalTangentTex);
 
+    depthShader.program = compileShader(depthVert, depthFrag);
+    depthShader.uniforms = buildUniforms(depthShader.program, 0);
+    assert(glGetAttribLocation(depthShader.program, "position") == VAO_POS);
+    checkError();
+
     bindShader(kTexCoord);
 
     for (int c = 0; c < kNumShaders; c++) {
@@ -474,6 +573,25 @@ void bindShader(u16 handle) {
     checkError();
 }
 
+void bindVertexFormat(VertexFormat format, const vec3 &positionOffset, const vec3 &positionScale) {
+    vertexFormat.format = format;
+    vertexFormat.positionOffset = positionOffset;
+    vertexFormat.positionScale = positionScale;
+}
+
+void bindDepthShader(const glm::mat4 &mvp) {
+    if (currentShader != &depthShader) {
+        glUseProgram(depthShader.program);
+        currentShader = &depthShader;
+    }
+    bindUniformsBase(depthShader.uniforms.common, mvp, vec3(0));
+    checkError();
+}
+
+void bindInstances(s32 firstInstance) {
+    glUniform1i(currentShader->uniforms.common.instanceOffset, firstInstance);
+}
+
 void bindMaterial(const glm::mat4 &mvp, const glm::vec3 &camPos, const glm::vec3 &lightPos, const Mesh &mesh, const Material &material) {
     bindUniforms(currentShader->uniforms, mvp, camPos, lightPos, mesh, material);
     checkError();
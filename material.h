@@ -35,6 +35,15 @@ enum : u16 {
 void initShaders();
 u16 findShader(const Mesh &mesh, const Material &material);
 void bindShader(u16 shader);
+// Sets how the vertices drawn after the next bindMaterial are stored (see Mesh). Defaults to floats.
+void bindVertexFormat(VertexFormat format, const glm::vec3 &positionOffset = glm::vec3(0),
+                      const glm::vec3 &positionScale = glm::vec3(1));
+// Binds a shader that only writes depth, for the vertex format set by bindVertexFormat.
+// It reads nothing but the position attribute, so it can draw with Mesh::positionVao.
+void bindDepthShader(const glm::mat4 &mvp);
+// Makes the next draws place instance gl_InstanceID with Mesh::instances[firstInstance + gl_InstanceID],
+// or draw untransformed with -1. Call after bindMaterial or bindDepthShader, which reset it to -1.
+void bindInstances(s32 firstInstance);
 void bindMaterial(const glm::mat4 &mvp, const glm::vec3 &camPos, const glm::vec3 &lightPos, const Mesh &mesh, const Material &material);
 
 #endif //SPONZA_MATERIAL_H
@@ -0,0 +1,34 @@
+#include "memory_usage.h"
+
+#include <cstdio>
+
+#ifdef WINDOWS
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+u64 peakResidentBytes() {
+#ifdef WINDOWS
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return u64(counters.PeakWorkingSetSize);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef APPLE
+    return u64(usage.ru_maxrss); // bytes on OS X
+#else
+    return u64(usage.ru_maxrss) * 1024; // kilobytes on Linux
+#endif
+#endif
+}
+
+void printPeakMemory(const char *stage) {
+    printf("Peak memory after %s: %.1f MB\n", stage, peakResidentBytes() / (1024.0 * 1024.0));
+}
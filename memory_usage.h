@@ -0,0 +1,12 @@
+#ifndef SPONZA_MEMORY_USAGE_H
+#define SPONZA_MEMORY_USAGE_H
+
+#include "types.h"
+
+// The most memory the process has had resident at once so far, in bytes. 0 if the OS won't say.
+u64 peakResidentBytes();
+
+// Prints the peak resident memory, labeled with what just finished.
+void printPeakMemory(const char *stage);
+
+#endif //SPONZA_MEMORY_USAGE_H
@@ -3,15 +3,27 @@
 //
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <glm/gtc/half_float.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mesh.h"
 #include "obj.h"
 #include "material.h"
+#include "meshcache.h"
+#include "parallel.h"
+#include "simplify.h"
+#include "instancing.h"
+#include "occlusion.h"
 
 using namespace std;
 using namespace glm;
 
-GLuint createVao() {
+GLuint createVao(VertexFormat format, u32 splitVerts) {
     GLuint vao;
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
@@ -23,54 +35,849 @@ GLuint createVao() {
     glBindBuffer(GL_ARRAY_BUFFER, verts);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices);
 
+    bindVertexAttribs(format, splitVerts);
+
+    return vao;
+}
+
+GLuint createPositionVao(GLuint vao, VertexFormat format, u32 splitVerts) {
+    GLint verts, indices;
+    glBindVertexArray(vao);
+    glGetVertexAttribiv(VAO_POS, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &verts);
+    glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &indices);
+
+    GLuint positionVao;
+    glGenVertexArrays(1, &positionVao);
+    glBindVertexArray(positionVao);
+    glBindBuffer(GL_ARRAY_BUFFER, GLuint(verts));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, GLuint(indices));
+    glEnableVertexAttribArray(VAO_POS);
+    GLsizei stride = GLsizei(splitVerts ? positionSize(format) : vertexSize(format));
+    if (format == kCompactVertex) {
+        glVertexAttribPointer(VAO_POS, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride, 0);
+    } else {
+        glVertexAttribPointer(VAO_POS, 3, GL_FLOAT, GL_FALSE, stride, 0);
+    }
+    checkError();
+
+    glBindVertexArray(vao);
+    return positionVao;
+}
+
+void bindVertexAttribs(VertexFormat format, u32 splitVerts) {
+    // Interleaved, every attribute is at its offset in the vertex. Split, the positions come
+    // first and the other attributes are packed after them without the position.
+    u32 size = vertexSize(format);
+    u32 stride = splitVerts ? size - positionSize(format) : size;
+    u64 base = splitVerts ? u64(splitVerts) * positionSize(format) - positionSize(format) : 0;
+    auto attrib = [&](u32 offset) { return (void *)(uintptr_t)(base + offset); };
+    GLsizei positionStride = GLsizei(splitVerts ? positionSize(format) : size);
+
+    if (format == kCompactVertex) {
+        glEnableVertexAttribArray(VAO_POS);
+        glEnableVertexAttribArray(VAO_NOR);
+        glEnableVertexAttribArray(VAO_TAN);
+        glDisableVertexAttribArray(VAO_BTN);
+        glEnableVertexAttribArray(VAO_TEX);
+        glVertexAttribPointer(VAO_POS, 4, GL_UNSIGNED_SHORT, GL_TRUE, positionStride, 0);
+        glVertexAttribPointer(VAO_NOR, 2, GL_SHORT, GL_TRUE, stride, attrib(offsetof(CompactVertex, normal)));
+        glVertexAttribPointer(VAO_TAN, 2, GL_SHORT, GL_TRUE, stride, attrib(offsetof(CompactVertex, tangent)));
+        glVertexAttribPointer(VAO_TEX, 2, GL_HALF_FLOAT, GL_FALSE, stride, attrib(offsetof(CompactVertex, tex)));
+        checkError();
+        return;
+    }
+
     glEnableVertexAttribArray(VAO_POS);
     glEnableVertexAttribArray(VAO_NOR);
     glEnableVertexAttribArray(VAO_TAN);
     glEnableVertexAttribArray(VAO_BTN);
     glEnableVertexAttribArray(VAO_TEX);
-    glVertexAttribPointer(VAO_POS, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
-    glVertexAttribPointer(VAO_NOR, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) sizeof(vec3));
-    glVertexAttribPointer(VAO_TAN, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) (sizeof(vec3) * 2));
-    glVertexAttribPointer(VAO_BTN, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) (sizeof(vec3) * 3));
-    glVertexAttribPointer(VAO_TEX, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) (sizeof(vec3) * 4));
+    glVertexAttribPointer(VAO_POS, 3, GL_FLOAT, GL_FALSE, positionStride, 0);
+    glVertexAttribPointer(VAO_NOR, 3, GL_FLOAT, GL_FALSE, stride, attrib(offsetof(Vertex, normal)));
+    glVertexAttribPointer(VAO_TAN, 3, GL_FLOAT, GL_FALSE, stride, attrib(offsetof(Vertex, tangent)));
+    glVertexAttribPointer(VAO_BTN, 3, GL_FLOAT, GL_FALSE, stride, attrib(offsetof(Vertex, bitangent)));
+    glVertexAttribPointer(VAO_TEX, 2, GL_FLOAT, GL_FALSE, stride, attrib(offsetof(Vertex, tex)));
     checkError();
+}
 
-    return vao;
+void splitVertexData(const void *verts, u32 numVerts, VertexFormat format, vector<u8> &split) {
+    u32 size = vertexSize(format);
+    u32 position = positionSize(format);
+    split.resize(u64(numVerts) * size);
+    const u8 *in = (const u8 *) verts;
+    u8 *positions = split.data();
+    u8 *attributes = split.data() + u64(numVerts) * position;
+    for (u32 c = 0; c < numVerts; c++) {
+        memcpy(positions + u64(c) * position, in + u64(c) * size, position);
+        memcpy(attributes + u64(c) * (size - position), in + u64(c) * size + position, size - position);
+    }
+}
+
+// ------------------ Begin Vertex Cache Optimization -------------------
+
+// Triangles are reordered with Tom Forsyth's linear-speed vertex cache optimization
+// (https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html). Each vertex is scored by
+// its place in a simulated LRU cache and by how many triangles still use it, and the best
+// scoring triangle touching the cache is emitted next.
+const u32 kCacheSize = 32;
+const u32 kMaxValence = 32; // valences past this score the same
+// Reported ACMR and ATVR are for a FIFO of this size, like a typical post-transform cache.
+const u32 kMeasureCacheSize = 16;
+
+struct CacheScores {
+    f32 position[kCacheSize];
+    f32 valence[kMaxValence];
+};
+
+static CacheScores makeCacheScores() {
+    CacheScores scores;
+    for (u32 c = 0; c < kCacheSize; c++) {
+        // The last triangle's vertices score the same, so its winding order doesn't matter.
+        scores.position[c] = c < 3 ? 0.75f : pow(1.f - f32(c - 3) / (kCacheSize - 3), 1.5f);
+    }
+    scores.valence[0] = -1; // unused, such vertices have no triangles left to score
+    for (u32 c = 1; c < kMaxValence; c++) {
+        // Vertices with few triangles left score high, to finish them off and free the slot.
+        scores.valence[c] = 2.f * pow(f32(c), -0.5f);
+    }
+    return scores;
+}
+
+static f32 vertexScore(const CacheScores &scores, s32 cachePos, u32 remaining) {
+    if (remaining == 0) return -1;
+    f32 score = cachePos < 0 ? 0 : scores.position[cachePos];
+    return score + scores.valence[std::min(remaining, kMaxValence - 1)];
+}
+
+// Reuses its arrays across calls. localIndex is sized for the whole mesh and is left all
+// UNUSED_VERTEX between calls; everything else is per range.
+struct CacheScratch {
+    vector<u32> localIndex;
+    vector<u32> localToGlobal;
+    vector<u32> corners;       // local vertex of every corner in the range
+    vector<u32> adjacency;     // triangles of each vertex, the first adjacentCount of them not yet emitted
+    vector<u32> adjacencyStart;
+    vector<u32> adjacentCount;
+    vector<s32> cachePos;
+    vector<f32> vertScore;
+    vector<f32> triScore;
+    vector<bool> emitted;
+};
+
+#define UNUSED_VERTEX 0xFFFFFFFF
+
+// Reorders the triangles in indices[0, numIndices) for the post-transform cache.
+static void optimizeVertexCache(u32 *indices, u32 numIndices, const CacheScores &scores, CacheScratch &scratch) {
+    u32 numTris = numIndices / 3;
+    if (numTris < 2) return;
+
+    // Number the range's vertices locally so that every array below is sized to the range.
+    scratch.localToGlobal.clear();
+    scratch.corners.resize(numIndices);
+    for (u32 c = 0; c < numIndices; c++) {
+        u32 &local = scratch.localIndex[indices[c]];
+        if (local == UNUSED_VERTEX) {
+            local = u32(scratch.localToGlobal.size());
+            scratch.localToGlobal.push_back(indices[c]);
+        }
+        scratch.corners[c] = local;
+    }
+    u32 numVerts = u32(scratch.localToGlobal.size());
+
+    scratch.adjacentCount.assign(numVerts, 0);
+    for (u32 c = 0; c < numIndices; c++) {
+        scratch.adjacentCount[scratch.corners[c]]++;
+    }
+    scratch.adjacencyStart.resize(numVerts);
+    u32 start = 0;
+    for (u32 v = 0; v < numVerts; v++) {
+        scratch.adjacencyStart[v] = start;
+        start += scratch.adjacentCount[v];
+        scratch.adjacentCount[v] = 0;
+    }
+    scratch.adjacency.resize(numIndices);
+    for (u32 c = 0; c < numIndices; c++) {
+        u32 v = scratch.corners[c];
+        scratch.adjacency[scratch.adjacencyStart[v] + scratch.adjacentCount[v]++] = c / 3;
+    }
+
+    scratch.cachePos.assign(numVerts, -1);
+    scratch.vertScore.resize(numVerts);
+    for (u32 v = 0; v < numVerts; v++) {
+        scratch.vertScore[v] = vertexScore(scores, -1, scratch.adjacentCount[v]);
+    }
+    scratch.triScore.resize(numTris);
+    scratch.emitted.assign(numTris, false);
+    u32 bestTri = 0;
+    for (u32 t = 0; t < numTris; t++) {
+        const u32 *corners = &scratch.corners[t * 3];
+        scratch.triScore[t] = scratch.vertScore[corners[0]] + scratch.vertScore[corners[1]] + scratch.vertScore[corners[2]];
+        if (scratch.triScore[t] > scratch.triScore[bestTri]) bestTri = t;
+    }
+
+    // The cache holds kCacheSize vertices, plus room for the three pushed out by each triangle.
+    u32 cache[kCacheSize + 3];
+    u32 cacheCount = 0;
+    u32 scanPos = 0;
+    vector<u32> result(numIndices);
+    for (u32 out = 0; out < numTris; out++) {
+        if (bestTri == UNUSED_VERTEX) {
+            // Nothing in the cache touches a triangle that's left, so start a new area.
+            while (scratch.emitted[scanPos]) scanPos++;
+            bestTri = scanPos;
+        }
+        const u32 *corners = &scratch.corners[bestTri * 3];
+        scratch.emitted[bestTri] = true;
+        for (u32 k = 0; k < 3; k++) {
+            result[out * 3 + k] = scratch.localToGlobal[corners[k]];
+            u32 v = corners[k];
+            u32 *adjacent = &scratch.adjacency[scratch.adjacencyStart[v]];
+            u32 &count = scratch.adjacentCount[v];
+            for (u32 a = 0; a < count; a++) {
+                if (adjacent[a] == bestTri) {
+                    adjacent[a] = adjacent[--count];
+                    break;
+                }
+            }
+        }
+
+        // Move the triangle's vertices to the front of the cache.
+        u32 newCache[kCacheSize + 3];
+        u32 newCount = 0;
+        for (u32 k = 0; k < 3; k++) {
+            newCache[newCount++] = corners[k];
+        }
+        for (u32 c = 0; c < cacheCount; c++) {
+            u32 v = cache[c];
+            if (v != corners[0] && v != corners[1] && v != corners[2]) newCache[newCount++] = v;
+        }
+
+        // Rescore the cached vertices, and the ones that just fell out, and their triangles.
+        for (u32 c = 0; c < newCount; c++) {
+            u32 v = newCache[c];
+            s32 pos = c < kCacheSize ? s32(c) : -1;
+            scratch.cachePos[v] = pos;
+            f32 score = vertexScore(scores, pos, scratch.adjacentCount[v]);
+            f32 delta = score - scratch.vertScore[v];
+            scratch.vertScore[v] = score;
+            const u32 *adjacent = &scratch.adjacency[scratch.adjacencyStart[v]];
+            for (u32 a = 0, n = scratch.adjacentCount[v]; a < n; a++) {
+                scratch.triScore[adjacent[a]] += delta;
+            }
+        }
+        cacheCount = std::min(newCount, kCacheSize);
+        memcpy(cache, newCache, cacheCount * sizeof(u32));
+
+        bestTri = UNUSED_VERTEX;
+        f32 bestScore = -FLT_MAX;
+        for (u32 c = 0; c < cacheCount; c++) {
+            u32 v = cache[c];
+            const u32 *adjacent = &scratch.adjacency[scratch.adjacencyStart[v]];
+            for (u32 a = 0, n = scratch.adjacentCount[v]; a < n; a++) {
+                if (scratch.triScore[adjacent[a]] > bestScore) {
+                    bestScore = scratch.triScore[adjacent[a]];
+                    bestTri = adjacent[a];
+                }
+            }
+        }
+    }
+
+    memcpy(indices, result.data(), numIndices * sizeof(u32));
+    for (u32 global : scratch.localToGlobal) {
+        scratch.localIndex[global] = UNUSED_VERTEX;
+    }
+}
+
+// Renumbers the vertices in the order the indices first use them, so that vertex fetch walks
+// forwards through memory. Vertices no triangle uses are dropped.
+static void optimizeVertexFetch(vector<OBJVertex> &verts, vector<u32> &indices) {
+    vector<u32> remap(verts.size(), UNUSED_VERTEX);
+    vector<OBJVertex> newVerts;
+    newVerts.reserve(verts.size());
+    for (u32 &index : indices) {
+        u32 &newIndex = remap[index];
+        if (newIndex == UNUSED_VERTEX) {
+            newIndex = u32(newVerts.size());
+            newVerts.push_back(verts[index]);
+        }
+        index = newIndex;
+    }
+    verts = std::move(newVerts);
+}
+
+// A simulated FIFO of kMeasureCacheSize vertices. A vertex is in the cache if fewer than
+// kMeasureCacheSize misses happened since it went in.
+struct FifoCache {
+    vector<u32> cachedAt; // 0 for vertices never seen
+    u32 time;
+};
+
+static void initCache(FifoCache &cache, u32 numVerts) {
+    cache.cachedAt.assign(numVerts, 0);
+    cache.time = kMeasureCacheSize + 1;
+}
+
+static void flushCache(FifoCache &cache) {
+    cache.time += kMeasureCacheSize + 1;
+}
+
+// Returns the number of vertices of the triangle that had to be transformed.
+static u32 cacheMisses(FifoCache &cache, const u32 *tri) {
+    u32 misses = 0;
+    for (u32 k = 0; k < 3; k++) {
+        if (cache.time - cache.cachedAt[tri[k]] > kMeasureCacheSize) {
+            cache.cachedAt[tri[k]] = cache.time++;
+            misses++;
+        }
+    }
+    return misses;
+}
+
+// Average cache miss ratio (transformed vertices per triangle, 0.5 at best and 3 at worst) and
+// average transform to vertex ratio (1 at best) of indices, for a FIFO of kMeasureCacheSize.
+static void measureVertexCache(const vector<u32> &indices, u32 numVerts, f32 &acmr, f32 &atvr) {
+    FifoCache cache;
+    initCache(cache, numVerts);
+    u32 transforms = 0;
+    for (u32 c = 0, n = u32(indices.size()); c < n; c += 3) {
+        transforms += cacheMisses(cache, &indices[c]);
+    }
+    u32 uniqueVerts = 0;
+    for (u32 cachedAt : cache.cachedAt) {
+        if (cachedAt != 0) uniqueVerts++;
+    }
+    acmr = indices.empty() ? 0 : f32(transforms) / (indices.size() / 3);
+    atvr = uniqueVerts == 0 ? 0 : f32(transforms) / uniqueVerts;
+}
+
+// ------------------ End Vertex Cache Optimization -------------------
+
+
+
+// ------------------ Begin Overdraw Optimization -------------------
+
+// The vertex cache order ignores depth. Following Sander, Nehab and Barczak, "Fast Triangle
+// Reordering for Vertex Locality and Reduced Overdraw" (2007), that order is cut into clusters
+// that each stay close to its ACMR, and the clusters that face away from the center of their
+// object part draw first. Those are the outside surfaces, which tend to hide the rest.
+const f32 kOverdrawThreshold = 1.05f; // how much a cluster's ACMR may exceed the cache order's
+
+struct OverdrawCluster {
+    u32 start; // first triangle
+    u32 end;
+    f32 sortKey;
+};
+
+// Appends the starts of runs of triangles in [start, end) whose own ACMR, with a flushed
+// cache, is within kOverdrawThreshold of the whole run's.
+static void splitCluster(const u32 *indices, u32 start, u32 end, FifoCache &cache, vector<u32> &starts) {
+    flushCache(cache);
+    u32 misses = 0;
+    for (u32 t = start; t < end; t++) {
+        misses += cacheMisses(cache, &indices[t * 3]);
+    }
+    f32 threshold = kOverdrawThreshold * misses / (end - start);
+
+    flushCache(cache);
+    starts.push_back(start);
+    u32 runMisses = 0;
+    u32 runTris = 0;
+    for (u32 t = start; t < end; t++) {
+        runMisses += cacheMisses(cache, &indices[t * 3]);
+        runTris++;
+        if (f32(runMisses) <= threshold * runTris && t + 1 < end) {
+            starts.push_back(t + 1);
+            flushCache(cache);
+            runMisses = 0;
+            runTris = 0;
+        }
+    }
 }
 
-void optimizeMesh(vector<MeshPart> &parts, vector<u32> &indices) {
+// Reorders the clusters of the triangles in indices[0, numIndices). Returns the number of clusters.
+static u32 optimizeOverdraw(u32 *indices, u32 numIndices, const vector<OBJVertex> &verts, FifoCache &cache) {
+    u32 numTris = numIndices / 3;
+    if (numTris < 2) return 1;
+
+    // Where all three vertices miss, the cache order has usually moved on to a new patch.
+    vector<u32> hardStarts;
+    flushCache(cache);
+    for (u32 t = 0; t < numTris; t++) {
+        if (cacheMisses(cache, &indices[t * 3]) == 3 || t == 0) hardStarts.push_back(t);
+    }
+    hardStarts.push_back(numTris);
+    vector<u32> starts;
+    for (u32 c = 0, n = u32(hardStarts.size()) - 1; c < n; c++) {
+        splitCluster(indices, hardStarts[c], hardStarts[c + 1], cache, starts);
+    }
+    starts.push_back(numTris);
+
+    // Area weighted centroids and normals, for each cluster and for the whole range.
+    vector<OverdrawCluster> clusters(starts.size() - 1);
+    vector<vec3> centroids(clusters.size());
+    vector<vec3> normals(clusters.size());
+    vec3 rangeCentroid(0);
+    f32 rangeArea = 0;
+    for (u32 c = 0, n = u32(clusters.size()); c < n; c++) {
+        clusters[c].start = starts[c];
+        clusters[c].end = starts[c + 1];
+        vec3 centroid(0);
+        vec3 normal(0);
+        f32 area = 0;
+        for (u32 t = clusters[c].start; t < clusters[c].end; t++) {
+            vec3 p0 = verts[indices[t * 3 + 0]].position;
+            vec3 p1 = verts[indices[t * 3 + 1]].position;
+            vec3 p2 = verts[indices[t * 3 + 2]].position;
+            vec3 triNormal = cross(p1 - p0, p2 - p0); // length is twice the area
+            f32 triArea = length(triNormal);
+            centroid += (p0 + p1 + p2) * (triArea / 3);
+            normal += triNormal;
+            area += triArea;
+        }
+        rangeCentroid += centroid;
+        rangeArea += area;
+        centroids[c] = area > 0 ? centroid / area : centroid;
+        normals[c] = normal;
+    }
+    if (rangeArea > 0) rangeCentroid /= rangeArea;
+    for (u32 c = 0, n = u32(clusters.size()); c < n; c++) {
+        f32 normalLength = length(normals[c]);
+        vec3 normal = normalLength > 0 ? normals[c] / normalLength : vec3(0);
+        clusters[c].sortKey = dot(centroids[c] - rangeCentroid, normal);
+    }
+
+    stable_sort(clusters.begin(), clusters.end(), [](const OverdrawCluster &a, const OverdrawCluster &b) {
+        return a.sortKey > b.sortKey;
+    });
+    vector<u32> result;
+    result.reserve(numIndices);
+    for (const OverdrawCluster &cluster : clusters) {
+        result.insert(result.end(), &indices[cluster.start * 3], &indices[cluster.end * 3]);
+    }
+    memcpy(indices, result.data(), numIndices * sizeof(u32));
+    return u32(clusters.size());
+}
+
+// ------------------ End Overdraw Optimization -------------------
+
+// ------------------ Begin Spatial Splitting -------------------
+
+struct SplitTriangle {
+    vec3 centroid;
+    u32 first; // index of its first corner
+};
+
+// Halves triangles [begin, end) along the longest axis of their centroids until each piece has
+// at most maxTriangles, numbering the pieces from numCells in triangleCells.
+static void splitCells(vector<SplitTriangle> &tris, u32 begin, u32 end, u32 maxTriangles, u32 &numCells,
+                       vector<u32> &triangleCells) {
+    if (end - begin <= maxTriangles) {
+        for (u32 c = begin; c < end; c++) {
+            triangleCells[tris[c].first / 3] = numCells;
+        }
+        numCells++;
+        return;
+    }
+    vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    for (u32 c = begin; c < end; c++) {
+        lo = min(lo, tris[c].centroid);
+        hi = max(hi, tris[c].centroid);
+    }
+    vec3 size = hi - lo;
+    int axis = size.x >= size.y && size.x >= size.z ? 0 : size.y >= size.z ? 1 : 2;
+    u32 middle = begin + (end - begin) / 2;
+    nth_element(tris.begin() + begin, tris.begin() + middle, tris.begin() + end,
+                [axis](const SplitTriangle &a, const SplitTriangle &b) { return a.centroid[axis] < b.centroid[axis]; });
+    splitCells(tris, begin, middle, maxTriangles, numCells, triangleCells);
+    splitCells(tris, middle, end, maxTriangles, numCells, triangleCells);
+}
+
+// Splits every object with more than maxTriangles triangles into cells of at most that many, by
+// halving it along its longest axis, so that culling and level of detail can treat each cell on
+// its own. Each cell becomes an object with the same name and its own bounds, and each part is
+// reordered and split into one part per cell, which optimizeMesh merges back by material.
+// Cells are simplified separately, so buildLods locks the vertices on the seams between them
+// (see findSharedVertices), or neighbors drawn at different levels would crack apart.
+// Fewer triangles per cell culls more finely but draws more ranges. Objects that are drawn
+// as instances are left whole, and 0 splits nothing.
+void splitObjects(OBJMesh &obj, const vector<InstanceGroup> &instanceGroups, u32 maxTriangles) {
+    if (maxTriangles == 0) return;
+    u32 numObjects = u32(obj.objects.size());
+    vector<u32> objectTriangles(numObjects);
+    for (const OBJMeshPart &part : obj.meshParts) {
+        objectTriangles[part.objectIndex] += part.indexSize / 3;
+    }
+    for (const InstanceGroup &group : instanceGroups) {
+        objectTriangles[group.object] = 0;
+    }
+
+    vector<u32> partOrder(obj.meshParts.size());
+    for (u32 c = 0, n = u32(partOrder.size()); c < n; c++) {
+        partOrder[c] = c;
+    }
+    stable_sort(partOrder.begin(), partOrder.end(), [&](u32 a, u32 b) {
+        return obj.meshParts[a].objectIndex < obj.meshParts[b].objectIndex;
+    });
+
+    // Every triangle's cell, as the index of the object it moves to.
+    vector<u32> triangleObjects(obj.indices.size() / 3);
+    vector<SplitTriangle> tris;
+    u32 numSplit = 0;
+    for (u32 first = 0, n = u32(partOrder.size()); first < n;) {
+        u32 object = obj.meshParts[partOrder[first]].objectIndex;
+        u32 last = first;
+        while (last < n && obj.meshParts[partOrder[last]].objectIndex == object) last++;
+        if (objectTriangles[object] > maxTriangles) {
+            tris.clear();
+            for (u32 c = first; c < last; c++) {
+                const OBJMeshPart &part = obj.meshParts[partOrder[c]];
+                for (u32 i = part.indexOffset, end = part.indexOffset + part.indexSize; i + 3 <= end; i += 3) {
+                    vec3 centroid = obj.verts[obj.indices[i]].position + obj.verts[obj.indices[i + 1]].position +
+                                    obj.verts[obj.indices[i + 2]].position;
+                    tris.push_back(SplitTriangle { centroid / 3.f, i });
+                }
+            }
+            u32 numCells = 0;
+            splitCells(tris, 0, u32(tris.size()), maxTriangles, numCells, triangleObjects);
+            // The first cell keeps the object, the rest are added after the existing objects.
+            u32 firstNew = u32(obj.objects.size()) - 1;
+            for (const SplitTriangle &tri : tris) {
+                u32 &cell = triangleObjects[tri.first / 3];
+                cell = cell == 0 ? object : firstNew + cell;
+            }
+            obj.objects[object].bounds = emptyBounds();
+            OBJObject cell = { obj.objects[object].name, emptyBounds() };
+            obj.objects.resize(obj.objects.size() + numCells - 1, cell);
+            numSplit++;
+        }
+        first = last;
+    }
+    if (numSplit == 0) return;
+
+    // Sort each split part's triangles by cell, then give each cell its own part.
+    vector<OBJMeshPart> newParts;
+    vector<u32> order;
+    vector<u32> sorted;
+    for (const OBJMeshPart &part : obj.meshParts) {
+        if (objectTriangles[part.objectIndex] <= maxTriangles || part.indexSize < 3) {
+            newParts.push_back(part);
+            continue;
+        }
+        u32 numTriangles = part.indexSize / 3;
+        order.resize(numTriangles);
+        for (u32 c = 0; c < numTriangles; c++) {
+            order[c] = part.indexOffset / 3 + c;
+        }
+        stable_sort(order.begin(), order.end(), [&](u32 a, u32 b) { return triangleObjects[a] < triangleObjects[b]; });
+        sorted.resize(numTriangles * 3);
+        for (u32 c = 0; c < numTriangles; c++) {
+            memcpy(&sorted[c * 3], &obj.indices[order[c] * 3], 3 * sizeof(u32));
+        }
+        memcpy(&obj.indices[part.indexOffset], sorted.data(), numTriangles * 3 * sizeof(u32));
+        for (u32 c = 0; c < numTriangles; c++) {
+            u32 cell = triangleObjects[order[c]];
+            if (c == 0 || cell != newParts.back().objectIndex) {
+                newParts.push_back(OBJMeshPart { part.materialIndex, part.indexOffset + c * 3, 0, cell });
+            }
+            newParts.back().indexSize += 3;
+        }
+    }
+    obj.meshParts = std::move(newParts);
+
+    // Bounds of the cells, with the sphere centered on the box as in finishObjects.
+    auto isCell = [&](u32 object) {
+        return object >= numObjects || objectTriangles[object] > maxTriangles;
+    };
+    for (const OBJMeshPart &part : obj.meshParts) {
+        if (!isCell(part.objectIndex)) continue;
+        for (u32 i = part.indexOffset, end = part.indexOffset + part.indexSize; i < end; i++) {
+            addPoint(obj.objects[part.objectIndex].bounds, obj.verts[obj.indices[i]].position);
+        }
+    }
+    for (u32 c = 0, n = u32(obj.objects.size()); c < n; c++) {
+        if (isCell(c)) centerBounds(obj.objects[c].bounds);
+    }
+    for (const OBJMeshPart &part : obj.meshParts) {
+        if (!isCell(part.objectIndex)) continue;
+        for (u32 i = part.indexOffset, end = part.indexOffset + part.indexSize; i < end; i++) {
+            addSpherePoint(obj.objects[part.objectIndex].bounds, obj.verts[obj.indices[i]].position);
+        }
+    }
+
+    printf("Split %u objects into %zu objects of at most %u triangles\n", numSplit, obj.objects.size(), maxTriangles);
+}
+
+// ------------------ End Spatial Splitting -------------------
+
+// Merges the parts into one part per material, keeping each object's triangles
+// together within it. partObjects holds the object of each part. Then reorders the
+// triangles of each object part for the vertex cache and, if it's opaque, for overdraw,
+// and the vertices for fetch.
+void optimizeMesh(vector<MeshPart> &parts, const vector<u32> &partObjects, const vector<Material> &materials,
+                  vector<ObjectPart> &objectParts, vector<u32> &indices, vector<OBJVertex> &verts) {
     if (parts.size() == 0)
         return; // shouldn't happen but JIC
 
-    stable_sort(parts.begin(), parts.end(),
-                [](const MeshPart &a, const MeshPart &b) {
-                    return a.material < b.material;
+    vector<u32> order(parts.size());
+    for (u32 c = 0, n = u32(order.size()); c < n; c++) {
+        order[c] = c;
+    }
+    stable_sort(order.begin(), order.end(),
+                [&](u32 a, u32 b) {
+                    if (parts[a].material != parts[b].material) return parts[a].material < parts[b].material;
+                    return partObjects[a] < partObjects[b];
                 });
 
     vector<u32> newIndices(indices.size());
     vector<MeshPart> newMeshParts;
-    u16 currentMaterial = parts[0].material;
+    objectParts.clear();
+    u16 currentMaterial = parts[order[0]].material;
     u32 pos = 0;
-    newMeshParts.push_back(MeshPart {pos, 0, 0, currentMaterial});
-    for (MeshPart &part : parts) {
+    newMeshParts.push_back(MeshPart {pos, 0, 0, currentMaterial, 0, GL_UNSIGNED_INT});
+    for (u32 c : order) {
+        const MeshPart &part = parts[c];
         u16 mat = part.material;
         if (mat != currentMaterial) {
             newMeshParts.back().size = pos - newMeshParts.back().offset;
             currentMaterial = mat;
-            newMeshParts.push_back(MeshPart {pos, 0, 0, currentMaterial});
+            newMeshParts.push_back(MeshPart {pos, 0, 0, currentMaterial, 0, GL_UNSIGNED_INT});
+        }
+        u32 newPart = u32(newMeshParts.size() - 1);
+        if (objectParts.empty() || objectParts.back().object != partObjects[c] || objectParts.back().part != newPart) {
+            objectParts.push_back(ObjectPart { pos, 0, partObjects[c], newPart });
         }
         memcpy(&newIndices[pos], &indices[part.offset], part.size * sizeof(u32));
         pos += part.size;
+        objectParts.back().size += part.size;
     }
     assert(pos == indices.size());
     newMeshParts.back().size = pos - newMeshParts.back().offset;
 
-    printf("Mesh optimized; number of parts reduced from %lu to %lu\n", parts.size(), newMeshParts.size());
+    printf("Mesh optimized; number of parts reduced from %zu to %zu (%zu object parts)\n",
+           parts.size(), newMeshParts.size(), objectParts.size());
 
     parts = std::move(newMeshParts);
     indices = std::move(newIndices);
+
+    // Object parts don't share triangles, so reordering within each keeps every part and object part intact.
+    f32 acmrBefore, atvrBefore, acmrAfter, atvrAfter;
+    measureVertexCache(indices, u32(verts.size()), acmrBefore, atvrBefore);
+    CacheScores scores = makeCacheScores();
+    CacheScratch scratch;
+    scratch.localIndex.assign(verts.size(), UNUSED_VERTEX);
+    for (const ObjectPart &objectPart : objectParts) {
+        optimizeVertexCache(&indices[objectPart.offset], objectPart.size, scores, scratch);
+    }
+    scratch = CacheScratch();
+
+    // Blended parts would look different in another order, so only opaque ones are sorted.
+    f32 acmrCache, atvrCache;
+    measureVertexCache(indices, u32(verts.size()), acmrCache, atvrCache);
+    FifoCache cache;
+    initCache(cache, u32(verts.size()));
+    u32 numClusters = 0;
+    for (const ObjectPart &objectPart : objectParts) {
+        if (materials[parts[objectPart.part].material].flags & MAT_TRANSPARENCY) continue;
+        numClusters += optimizeOverdraw(&indices[objectPart.offset], objectPart.size, verts, cache);
+    }
+    cache = FifoCache();
+
+    u32 numVerts = u32(verts.size());
+    optimizeVertexFetch(verts, indices);
+    measureVertexCache(indices, u32(verts.size()), acmrAfter, atvrAfter);
+
+    printf("Vertex cache optimized; ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (FIFO %u), %u vertices -> %zu\n",
+           acmrBefore, acmrCache, atvrBefore, atvrCache, kMeasureCacheSize, numVerts, verts.size());
+    printf("Overdraw optimized; %u clusters, ACMR %.3f -> %.3f\n", numClusters, acmrCache, acmrAfter);
+}
+
+// ------------------ Begin Meshlets -------------------
+
+static void finishMeshlet(const vector<OBJVertex> &verts, const vector<u32> &indices, u32 offset, u32 size, Meshlet &meshlet) {
+    Bounds bounds = emptyBounds();
+    for (u32 c = offset; c < offset + size; c++) {
+        addPoint(bounds, verts[indices[c]].position);
+    }
+    centerBounds(bounds);
+    for (u32 c = offset; c < offset + size; c++) {
+        addSpherePoint(bounds, verts[indices[c]].position);
+    }
+
+    // The cone holds every triangle's normal. Triangles with no area face nowhere and are skipped.
+    vec3 axis(0);
+    for (u32 c = offset; c < offset + size; c += 3) {
+        vec3 a = verts[indices[c]].position, b = verts[indices[c + 1]].position, d = verts[indices[c + 2]].position;
+        vec3 normal = cross(b - a, d - a);
+        f32 len = length(normal);
+        if (len > 0) axis += normal / len;
+    }
+    f32 axisLength = length(axis);
+    f32 minDot = 1;
+    if (axisLength > 0) {
+        axis /= axisLength;
+        for (u32 c = offset; c < offset + size; c += 3) {
+            vec3 a = verts[indices[c]].position, b = verts[indices[c + 1]].position, d = verts[indices[c + 2]].position;
+            vec3 normal = cross(b - a, d - a);
+            f32 len = length(normal);
+            if (len > 0) minDot = std::min(minDot, dot(axis, normal / len));
+        }
+    }
+
+    meshlet.offset = offset;
+    meshlet.size = size;
+    meshlet.center = bounds.center;
+    meshlet.radius = std::max(bounds.radius, 0.f);
+    meshlet.coneAxis = axis;
+    meshlet.coneCutoff = axisLength > 0 && minDot > 0 ? sqrt(1 - minDot * minDot) : 1;
 }
 
+// Cuts each object part into meshlets in the order its triangles are already in, starting a new one
+// whenever the vertex or triangle limit would be passed. The cache and overdraw orders keep
+// neighboring triangles together, so the meshlets come out compact without moving anything.
+void buildMeshlets(Mesh &mesh, const vector<OBJVertex> &verts, const vector<u32> &indices) {
+    mesh.meshlets.clear();
+    mesh.firstMeshlet.resize(mesh.objectParts.size() + 1);
+    vector<u32> lastMeshlet(verts.size(), 0xFFFFFFFF); // of each vertex, to count the ones in the current meshlet
+    u32 totalVerts = 0;
+    for (u32 c = 0, n = u32(mesh.objectParts.size()); c < n; c++) {
+        const ObjectPart &objectPart = mesh.objectParts[c];
+        mesh.firstMeshlet[c] = u32(mesh.meshlets.size());
+        u32 start = objectPart.offset, end = objectPart.offset + objectPart.size;
+        u32 current = u32(mesh.meshlets.size());
+        u32 numVerts = 0;
+        for (u32 i = start; i < end; i += 3) {
+            u32 newVerts = 0;
+            for (u32 k = 0; k < 3; k++) {
+                if (lastMeshlet[indices[i + k]] != current) newVerts++;
+            }
+            if (i > start && (numVerts + newVerts > MESHLET_MAX_VERTICES || (i - start) / 3 >= MESHLET_MAX_TRIANGLES)) {
+                mesh.meshlets.emplace_back();
+                finishMeshlet(verts, indices, start, i - start, mesh.meshlets.back());
+                totalVerts += numVerts;
+                start = i;
+                current++;
+                numVerts = 0;
+            }
+            for (u32 k = 0; k < 3; k++) {
+                if (lastMeshlet[indices[i + k]] != current) {
+                    lastMeshlet[indices[i + k]] = current;
+                    numVerts++;
+                }
+            }
+        }
+        if (end > start) {
+            mesh.meshlets.emplace_back();
+            finishMeshlet(verts, indices, start, end - start, mesh.meshlets.back());
+            totalVerts += numVerts;
+        }
+    }
+    mesh.firstMeshlet.back() = u32(mesh.meshlets.size());
+
+    u32 numCones = 0;
+    for (const Meshlet &meshlet : mesh.meshlets) {
+        if (meshlet.coneCutoff < 1) numCones++;
+    }
+    u64 numMeshlets = std::max(mesh.meshlets.size(), size_t(1));
+    printf("Built %zu meshlets; %.1f triangles and %.1f vertices each, %u can be backface culled\n",
+           mesh.meshlets.size(), mesh.size / 3.0 / numMeshlets, f64(totalVerts) / numMeshlets, numCones);
+}
+
+// ------------------ End Meshlets -------------------
+
+// ------------------ Begin Level of Detail -------------------
+
+// Each level aims for half the triangles of the one before.
+static const f32 kLodReduction = 0.5f;
+// Levels that save less than this are dropped, as are levels of tiny object parts.
+static const f32 kMinLodSaving = 0.1f;
+static const u32 kMinLodTriangles = 32;
+
+// Marks the vertices whose position is used by more than one object part, where materials or
+// objects (including the cells of splitObjects) meet.
+static void findSharedVertices(const Mesh &mesh, const vector<OBJVertex> &verts, const vector<u32> &indices,
+                               vector<u8> &shared) {
+    const u32 kNoPart = 0xFFFFFFFF, kManyParts = 0xFFFFFFFE;
+    vector<u32> owner(verts.size(), kNoPart);
+    for (u32 c = 0, n = u32(mesh.objectParts.size()); c < n; c++) {
+        const ObjectPart &objectPart = mesh.objectParts[c];
+        for (u32 i = objectPart.offset, end = objectPart.offset + objectPart.size; i < end; i++) {
+            u32 &part = owner[indices[i]];
+            part = part == kNoPart || part == c ? c : kManyParts;
+        }
+    }
+
+    vector<u32> order;
+    for (u32 c = 0, n = u32(verts.size()); c < n; c++) {
+        if (owner[c] != kNoPart) order.push_back(c);
+    }
+    sort(order.begin(), order.end(), [&](u32 a, u32 b) {
+        const vec3 &pa = verts[a].position, &pb = verts[b].position;
+        if (pa.x != pb.x) return pa.x < pb.x;
+        if (pa.y != pb.y) return pa.y < pb.y;
+        return pa.z < pb.z;
+    });
+    shared.assign(verts.size(), 0);
+    for (u32 start = 0, end, n = u32(order.size()); start < n; start = end) {
+        bool many = owner[order[start]] == kManyParts;
+        for (end = start + 1; end < n && verts[order[end]].position == verts[order[start]].position; end++) {
+            many |= owner[order[end]] != owner[order[start]];
+        }
+        for (u32 c = start; many && c < end; c++) {
+            shared[order[c]] = 1;
+        }
+    }
+}
+
+// Simplifies each object part down a chain of levels, each from the one before, and appends
+// them to indices. The vertices are shared with the full detail mesh, so only indices are added.
+// Object parts are simplified separately, so the positions they share are locked, which keeps
+// them meeting at every combination of levels.
+void buildLods(Mesh &mesh, const vector<OBJVertex> &verts, vector<u32> &indices) {
+    auto startTime = chrono::high_resolution_clock::now();
+    u32 numIndices = u32(indices.size());
+    vector<u8> shared;
+    findSharedVertices(mesh, verts, indices, shared);
+
+    mesh.lods.resize(mesh.objectParts.size() * MAX_LODS);
+    CacheScores scores = makeCacheScores();
+    CacheScratch scratch;
+    scratch.localIndex.assign(verts.size(), UNUSED_VERTEX);
+    vector<u32> simplified;
+    u32 levelCounts[MAX_LODS] = {};
+    for (u32 c = 0, n = u32(mesh.objectParts.size()); c < n; c++) {
+        const ObjectPart &objectPart = mesh.objectParts[c];
+        LodLevel *levels = &mesh.lods[c * MAX_LODS];
+        levels[0] = LodLevel { objectPart.offset, objectPart.size, 0 };
+        levelCounts[0]++;
+        bool done = false;
+        for (u32 l = 1; l < MAX_LODS; l++) {
+            const LodLevel &prev = levels[l - 1];
+            levels[l] = prev;
+            if (done || prev.size / 3 < kMinLodTriangles) {
+                done = true;
+                continue;
+            }
+            u32 target = u32(prev.size / 3 * kLodReduction) * 3;
+            f32 error = simplifyTriangles(verts, &indices[prev.offset], prev.size, target, shared.data(), simplified);
+            if (simplified.empty() || simplified.size() > prev.size * (1 - kMinLodSaving)) {
+                done = true;
+                continue;
+            }
+            u32 offset = u32(indices.size());
+            indices.insert(indices.end(), simplified.begin(), simplified.end());
+            optimizeVertexCache(&indices[offset], u32(simplified.size()), scores, scratch);
+            levels[l] = LodLevel { offset, u32(simplified.size()), prev.error + error };
+            levelCounts[l]++;
+        }
+    }
+
+    chrono::duration<double> seconds = chrono::high_resolution_clock::now() - startTime;
+    printf("Built LODs in %ums; %u indices -> %zu (object parts with 2/3/4 levels: %u/%u/%u)\n",
+           u32(seconds.count() * 1000), numIndices, indices.size(), levelCounts[1], levelCounts[2], levelCounts[3]);
+}
+
+// ------------------ End Level of Detail -------------------
+
 void obj2mesh_texture(const OBJTexture &obj, Texture &tex) {
     tex.glHandle = obj.texName;
 }
@@ -109,88 +916,438 @@ void obj2mesh_meshPart(const OBJMeshPart &obj, MeshPart &part) {
     part.offset = obj.indexOffset;
     part.size = obj.indexSize;
     part.material = u16(obj.materialIndex);
+    part.baseVertex = 0;
+    part.indexType = GL_UNSIGNED_INT;
+}
+
+// Gives the object part of each repeated piece its transforms. Each piece is an object with
+// one material, so it ends up as exactly one object part.
+void addInstances(Mesh &mesh, const vector<InstanceGroup> &groups) {
+    mesh.instances.clear();
+    mesh.firstInstance.clear();
+    if (groups.empty()) return;
+
+    u32 numGroups = u32(groups.size());
+    vector<u32> groupOf(mesh.objects.size(), numGroups); // numGroups for objects that don't repeat
+    for (u32 c = 0; c < numGroups; c++) {
+        groupOf[groups[c].object] = c;
+    }
+    for (const ObjectPart &objectPart : mesh.objectParts) {
+        mesh.firstInstance.push_back(u32(mesh.instances.size()));
+        u32 group = groupOf[objectPart.object];
+        if (group == numGroups) continue;
+        mesh.instances.insert(mesh.instances.end(), groups[group].transforms.begin(), groups[group].transforms.end());
+    }
+    mesh.firstInstance.push_back(u32(mesh.instances.size()));
+}
+
+// ------------------ Begin Index Packing -------------------
+
+// Moves each part's indices, full detail and LODs, into one block of either 16 or 32 bit indices,
+// relative to the part's lowest vertex. The 16 bit blocks go first so the 32 bit ones stay aligned.
+// Every offset in the mesh is updated to count indices of its part's type.
+void packIndices(Mesh &mesh, const vector<u32> &indices, vector<u8> &packed) {
+    u32 numParts = u32(mesh.parts.size());
+    vector<u32> minVertex(numParts, 0xFFFFFFFF), maxVertex(numParts, 0);
+    auto addRange = [&](u32 part, u32 offset, u32 size) {
+        for (u32 c = offset; c < offset + size; c++) {
+            minVertex[part] = std::min(minVertex[part], indices[c]);
+            maxVertex[part] = std::max(maxVertex[part], indices[c]);
+        }
+    };
+    for (u32 c = 0; c < numParts; c++) {
+        addRange(c, mesh.parts[c].offset, mesh.parts[c].size);
+    }
+    // LOD levels only use vertices of their full detail object part, so they fit its part's range.
+
+    // Where each part's block goes, in bytes, and the old index offset each block starts at.
+    struct Block {
+        u32 oldOffset;
+        u32 size;
+        u64 newByte;
+        u32 part;
+    };
+    vector<Block> blocks;
+    u64 numBytes = 0;
+    u32 numShort = 0;
+    for (u32 pass = 0; pass < 2; pass++) {
+        bool shortPass = pass == 0;
+        if (!shortPass) numBytes = (numBytes + 3) & ~u64(3);
+        for (u32 c = 0; c < numParts; c++) {
+            MeshPart &part = mesh.parts[c];
+            bool fits = part.size == 0 || maxVertex[c] - minVertex[c] <= 0xFFFF;
+            if (fits != shortPass) continue;
+            numShort += fits;
+            part.indexType = fits ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+            part.baseVertex = part.size ? minVertex[c] : 0;
+            u32 stride = indexSize(part.indexType);
+            blocks.push_back(Block { part.offset, part.size, numBytes, c });
+            u32 shift = u32(numBytes / stride) - part.offset; // modulo 2^32
+            part.offset += shift;
+            numBytes += u64(part.size) * stride;
+
+            // Object parts and their meshlets move with the part; their LOD levels follow it.
+            for (u32 k = 0, n = u32(mesh.objectParts.size()); k < n; k++) {
+                ObjectPart &objectPart = mesh.objectParts[k];
+                if (objectPart.part != c) continue;
+                objectPart.offset += shift;
+                if (!mesh.meshlets.empty()) {
+                    for (u32 m = mesh.firstMeshlet[k]; m < mesh.firstMeshlet[k + 1]; m++) {
+                        mesh.meshlets[m].offset += shift;
+                    }
+                }
+                if (mesh.lods.empty()) continue;
+                LodLevel *levels = &mesh.lods[k * MAX_LODS];
+                u32 previous = levels[0].offset;
+                levels[0].offset = objectPart.offset;
+                for (u32 l = 1; l < MAX_LODS; l++) {
+                    if (levels[l].offset == previous) {
+                        levels[l].offset = levels[l - 1].offset; // repeats the level before
+                        continue;
+                    }
+                    previous = levels[l].offset;
+                    blocks.push_back(Block { levels[l].offset, levels[l].size, numBytes, c });
+                    levels[l].offset = u32(numBytes / stride);
+                    numBytes += u64(levels[l].size) * stride;
+                }
+            }
+        }
+    }
+
+    packed.resize(numBytes);
+    for (const Block &block : blocks) {
+        const MeshPart &part = mesh.parts[block.part];
+        if (part.indexType == GL_UNSIGNED_SHORT) {
+            u16 *out = (u16 *) &packed[block.newByte];
+            for (u32 c = 0; c < block.size; c++) {
+                out[c] = u16(indices[block.oldOffset + c] - part.baseVertex);
+            }
+        } else {
+            u32 *out = (u32 *) &packed[block.newByte];
+            for (u32 c = 0; c < block.size; c++) {
+                out[c] = indices[block.oldOffset + c] - part.baseVertex;
+            }
+        }
+    }
+
+    printf("Index buffer is %.1f MB; %u of %u parts use 16 bit indices\n", numBytes / (1024.0 * 1024.0), numShort, numParts);
 }
 
+// ------------------ End Index Packing -------------------
+
+// ------------------ Begin Tangent Frames -------------------
+
 inline float cross(vec2 a, vec2 b) {
     return a.x * b.y - b.x * a.y;
 }
 
-void bufferObjVertexData(const OBJMesh &obj) {
-    vector<Vertex> updatedVerts;
-    updatedVerts.resize(obj.verts.size());
-    for (u32 c = 0, n = obj.verts.size(); c < n; c++) {
-        const OBJVertex &overt = obj.verts[c];
-        Vertex &vert = updatedVerts[c];
-        vert.position = overt.position;
-        vert.normal = overt.normal;
-        vert.tex = overt.texture;
+// What one triangle adds to the tangent and bitangent of each of its vertices.
+// Zero if the triangle has no area or no uv area.
+struct TriangleFrame {
+    f32 tangent[3];
+    f32 bitangent[3];
+};
+
+// Triangles or vertices per parallel job.
+static const u32 kFrameBlock = 1 << 14;
+
+static void triangleFrame(const vector<OBJVertex> &verts, const u32 *tri, TriangleFrame &frame) {
+    memset(&frame, 0, sizeof(frame));
+    const OBJVertex &v0 = verts[tri[0]];
+    const OBJVertex &v1 = verts[tri[1]];
+    const OBJVertex &v2 = verts[tri[2]];
+
+    vec3 p1 = v1.position - v0.position;
+    vec3 p2 = v2.position - v0.position;
+
+    vec3 normal = cross(p1, p2);
+    if (normal == vec3(0)) return;
+    else normal = normalize(normal);
+    assert(!any(isnan(normal)));
+
+    vec2 t1 = v1.texture - v0.texture;
+    vec2 t2 = v2.texture - v0.texture;
+
+    float r = 1.f / cross(t1, t2);
+    if (glm::isinf(r)) return;
+
+    vec3 pu = (t2.y * p1 - t1.y * p2) * r;
+    vec3 pv = (t1.x * p2 - t2.x * p1) * r;
+    assert(!glm::isnan(r));
+    assert(!any(isnan(pu)));
+    assert(!any(isnan(pv)));
+
+    vec3 tan = cross(pv, normal);
+    vec3 btn = cross(normal, pu);
+    if (dot(tan, pu) < 0) {
+        tan = -tan;
+        btn = -btn;
     }
+    assert(!any(isnan(tan)));
+    assert(!any(isnan(btn)));
 
-    for (u32 c = 0, n = obj.indices.size(); c < n; c += 3) {
-        int idx0 = obj.indices[c+0];
-        int idx1 = obj.indices[c+1];
-        int idx2 = obj.indices[c+2];
-        Vertex &v0 = updatedVerts[idx0];
-        Vertex &v1 = updatedVerts[idx1];
-        Vertex &v2 = updatedVerts[idx2];
+    for (int k = 0; k < 3; k++) {
+        frame.tangent[k] = tan[k];
+        frame.bitangent[k] = btn[k];
+    }
+}
+
+#ifdef __SSE2__
+// triangleFrame for four triangles at once, one per lane. Every operation is the same one
+// glm does in the same order, so the results match it bit for bit.
+static void triangleFrames4(const vector<OBJVertex> &verts, const u32 *tris, TriangleFrame *frames) {
+    alignas(16) f32 pos[3][3][4];
+    alignas(16) f32 tex[3][2][4];
+    for (int lane = 0; lane < 4; lane++) {
+        for (int k = 0; k < 3; k++) {
+            const OBJVertex &vert = verts[tris[lane * 3 + k]];
+            pos[k][0][lane] = vert.position.x;
+            pos[k][1][lane] = vert.position.y;
+            pos[k][2][lane] = vert.position.z;
+            tex[k][0][lane] = vert.texture.x;
+            tex[k][1][lane] = vert.texture.y;
+        }
+    }
 
-        vec3 p1 = v1.position - v0.position;
-        vec3 p2 = v2.position - v0.position;
+    __m128 p1x = _mm_sub_ps(_mm_load_ps(pos[1][0]), _mm_load_ps(pos[0][0]));
+    __m128 p1y = _mm_sub_ps(_mm_load_ps(pos[1][1]), _mm_load_ps(pos[0][1]));
+    __m128 p1z = _mm_sub_ps(_mm_load_ps(pos[1][2]), _mm_load_ps(pos[0][2]));
+    __m128 p2x = _mm_sub_ps(_mm_load_ps(pos[2][0]), _mm_load_ps(pos[0][0]));
+    __m128 p2y = _mm_sub_ps(_mm_load_ps(pos[2][1]), _mm_load_ps(pos[0][1]));
+    __m128 p2z = _mm_sub_ps(_mm_load_ps(pos[2][2]), _mm_load_ps(pos[0][2]));
 
-        vec3 normal = cross(p1, p2);
-        if (normal == vec3(0)) continue;
-        else normal = normalize(normal);
-        assert(!any(isnan(normal)));
+    __m128 nx = _mm_sub_ps(_mm_mul_ps(p1y, p2z), _mm_mul_ps(p2y, p1z));
+    __m128 ny = _mm_sub_ps(_mm_mul_ps(p1z, p2x), _mm_mul_ps(p2z, p1x));
+    __m128 nz = _mm_sub_ps(_mm_mul_ps(p1x, p2y), _mm_mul_ps(p2x, p1y));
+    __m128 zero = _mm_setzero_ps();
+    __m128 noArea = _mm_and_ps(_mm_and_ps(_mm_cmpeq_ps(nx, zero), _mm_cmpeq_ps(ny, zero)), _mm_cmpeq_ps(nz, zero));
+    __m128 sqr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+    __m128 inv = _mm_div_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(sqr));
+    nx = _mm_mul_ps(nx, inv);
+    ny = _mm_mul_ps(ny, inv);
+    nz = _mm_mul_ps(nz, inv);
 
-        vec2 t1 = v1.tex - v0.tex;
-        vec2 t2 = v2.tex - v0.tex;
+    __m128 t1x = _mm_sub_ps(_mm_load_ps(tex[1][0]), _mm_load_ps(tex[0][0]));
+    __m128 t1y = _mm_sub_ps(_mm_load_ps(tex[1][1]), _mm_load_ps(tex[0][1]));
+    __m128 t2x = _mm_sub_ps(_mm_load_ps(tex[2][0]), _mm_load_ps(tex[0][0]));
+    __m128 t2y = _mm_sub_ps(_mm_load_ps(tex[2][1]), _mm_load_ps(tex[0][1]));
+    __m128 r = _mm_div_ps(_mm_set1_ps(1.f), _mm_sub_ps(_mm_mul_ps(t1x, t2y), _mm_mul_ps(t2x, t1y)));
+    __m128 signBit = _mm_set1_ps(-0.f);
+    __m128 noUvArea = _mm_cmpeq_ps(_mm_andnot_ps(signBit, r), _mm_set1_ps(INFINITY));
 
-        float r = 1.f / cross(t1, t2);
-        if (glm::isinf(r)) continue;
+    __m128 pux = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(t2y, p1x), _mm_mul_ps(t1y, p2x)), r);
+    __m128 puy = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(t2y, p1y), _mm_mul_ps(t1y, p2y)), r);
+    __m128 puz = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(t2y, p1z), _mm_mul_ps(t1y, p2z)), r);
+    __m128 pvx = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(t1x, p2x), _mm_mul_ps(t2x, p1x)), r);
+    __m128 pvy = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(t1x, p2y), _mm_mul_ps(t2x, p1y)), r);
+    __m128 pvz = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(t1x, p2z), _mm_mul_ps(t2x, p1z)), r);
 
-        vec3 pu = (t2.y * p1 - t1.y * p2) * r;
-        vec3 pv = (t1.x * p2 - t2.x * p1) * r;
-        assert(!glm::isnan(r));
-        assert(!any(isnan(pu)));
-        assert(!any(isnan(pv)));
+    __m128 out[6];
+    out[0] = _mm_sub_ps(_mm_mul_ps(pvy, nz), _mm_mul_ps(ny, pvz)); // cross(pv, normal)
+    out[1] = _mm_sub_ps(_mm_mul_ps(pvz, nx), _mm_mul_ps(nz, pvx));
+    out[2] = _mm_sub_ps(_mm_mul_ps(pvx, ny), _mm_mul_ps(nx, pvy));
+    out[3] = _mm_sub_ps(_mm_mul_ps(ny, puz), _mm_mul_ps(puy, nz)); // cross(normal, pu)
+    out[4] = _mm_sub_ps(_mm_mul_ps(nz, pux), _mm_mul_ps(puz, nx));
+    out[5] = _mm_sub_ps(_mm_mul_ps(nx, puy), _mm_mul_ps(pux, ny));
+    __m128 facing = _mm_add_ps(_mm_add_ps(_mm_mul_ps(out[0], pux), _mm_mul_ps(out[1], puy)), _mm_mul_ps(out[2], puz));
+    __m128 flip = _mm_and_ps(_mm_cmplt_ps(facing, zero), signBit);
+    __m128 skip = _mm_or_ps(noArea, noUvArea);
 
-        vec3 tan = cross(pv, normal);
-        vec3 btn = cross(normal, pu);
-        if (dot(tan, pu) < 0) {
-            tan = -tan;
-            btn = -btn;
+    alignas(16) f32 result[6][4];
+    for (int k = 0; k < 6; k++) {
+        _mm_store_ps(result[k], _mm_andnot_ps(skip, _mm_xor_ps(out[k], flip)));
+    }
+    for (int lane = 0; lane < 4; lane++) {
+        for (int k = 0; k < 3; k++) {
+            frames[lane].tangent[k] = result[k][lane];
+            frames[lane].bitangent[k] = result[k + 3][lane];
         }
-        assert(!any(isnan(tan)));
-        assert(!any(isnan(btn)));
+    }
+}
+#endif
 
-        v0.tangent += tan;
-        v1.tangent += tan;
-        v2.tangent += tan;
-        v0.bitangent += btn;
-        v1.bitangent += btn;
-        v2.bitangent += btn;
+// Fills in frames[0, count) for the triangles starting at first.
+static void triangleFrames(const vector<OBJVertex> &verts, const vector<u32> &indices, u32 first, u32 count, TriangleFrame *frames) {
+    u32 c = 0;
+#ifdef __SSE2__
+    for (; c + 4 <= count; c += 4) {
+        triangleFrames4(verts, &indices[(first + c) * 3], &frames[c]);
     }
+#endif
+    for (; c < count; c++) {
+        triangleFrame(verts, &indices[(first + c) * 3], frames[c]);
+    }
+}
+
+static void addFrame(Vertex &vert, const TriangleFrame &frame) {
+    vert.tangent += vec3(frame.tangent[0], frame.tangent[1], frame.tangent[2]);
+    vert.bitangent += vec3(frame.bitangent[0], frame.bitangent[1], frame.bitangent[2]);
+}
+
+static void finishFrame(Vertex &vert) {
+    if (vert.bitangent != vec3(0) || vert.tangent != vec3(0)) {
+        if (vert.bitangent == vec3(0)) {
+            vert.tangent = normalize(vert.tangent);
+            vert.bitangent = normalize(cross(vert.normal, vert.tangent));
+        } else if (vert.tangent == vec3(0)) {
+            vert.bitangent = normalize(vert.bitangent);
+            vert.tangent = normalize(cross(vert.bitangent, vert.normal));
+        } else {
+            vert.tangent = normalize(vert.tangent);
+            vert.bitangent = normalize(vert.bitangent);
+        }
+    }
+}
+
+// The triangles are independent, so their frames are computed in parallel blocks, four at a
+// time with SSE. Each vertex then sums its triangles' frames in triangle order, the same order
+// a serial loop over the triangles adds them in, so the result doesn't depend on the threads.
+void buildVertexData(const vector<OBJVertex> &objVerts, const vector<u32> &indices, vector<Vertex> &updatedVerts) {
+    u32 numVerts = u32(objVerts.size());
+    u32 numTriangles = u32(indices.size() / 3);
+    u32 numThreads = hardwareThreads();
 
-    for (u32 c = 0, n = updatedVerts.size(); c < n; c++) {
+    updatedVerts.resize(numVerts);
+    auto initVertex = [&](u32 c) {
+        const OBJVertex &overt = objVerts[c];
         Vertex &vert = updatedVerts[c];
-        if (vert.bitangent != vec3(0) || vert.tangent != vec3(0)) {
-            if (vert.bitangent == vec3(0)) {
-                vert.tangent = normalize(vert.tangent);
-                vert.bitangent = normalize(cross(vert.normal, vert.tangent));
-            } else if (vert.tangent == vec3(0)) {
-                vert.bitangent = normalize(vert.bitangent);
-                vert.tangent = normalize(cross(vert.bitangent, vert.normal));
-            } else {
-                vert.tangent = normalize(vert.tangent);
-                vert.bitangent = normalize(vert.bitangent);
+        vert.position = overt.position;
+        vert.normal = overt.normal;
+        vert.tex = overt.texture;
+        vert.tangent = vec3(0);
+        vert.bitangent = vec3(0);
+    };
+
+    if (numThreads == 1 || numTriangles < kFrameBlock) {
+        // Not worth gathering; add each frame to its vertices as soon as it's ready.
+        for (u32 c = 0; c < numVerts; c++) {
+            initVertex(c);
+        }
+        TriangleFrame frames[4];
+        for (u32 c = 0; c < numTriangles; c += 4) {
+            u32 count = std::min(numTriangles - c, 4u);
+            triangleFrames(objVerts, indices, c, count, frames);
+            for (u32 k = 0; k < count * 3; k++) {
+                addFrame(updatedVerts[indices[c * 3 + k]], frames[k / 3]);
+            }
+        }
+        for (Vertex &vert : updatedVerts) {
+            finishFrame(vert);
+        }
+        return;
+    }
+
+    vector<TriangleFrame> frames(numTriangles);
+    parallelFor((numTriangles + kFrameBlock - 1) / kFrameBlock, numThreads, [&](u32 block) {
+        u32 first = block * kFrameBlock;
+        triangleFrames(objVerts, indices, first, std::min(kFrameBlock, numTriangles - first), &frames[first]);
+    });
+
+    // The triangles around each vertex, in order.
+    vector<u32> cornerStart(numVerts + 1, 0);
+    for (u32 index : indices) {
+        cornerStart[index + 1]++;
+    }
+    for (u32 c = 0; c < numVerts; c++) {
+        cornerStart[c + 1] += cornerStart[c];
+    }
+    vector<u32> cornerTriangles(numTriangles * 3);
+    {
+        vector<u32> fill(cornerStart.begin(), cornerStart.end() - 1);
+        for (u32 c = 0; c < numTriangles * 3; c++) {
+            cornerTriangles[fill[indices[c]]++] = c / 3;
+        }
+    }
+
+    parallelFor((numVerts + kFrameBlock - 1) / kFrameBlock, numThreads, [&](u32 block) {
+        for (u32 c = block * kFrameBlock, end = std::min(c + kFrameBlock, numVerts); c < end; c++) {
+            initVertex(c);
+            for (u32 k = cornerStart[c]; k < cornerStart[c + 1]; k++) {
+                addFrame(updatedVerts[c], frames[cornerTriangles[k]]);
             }
+            finishFrame(updatedVerts[c]);
         }
+    });
+}
+
+// ------------------ End Tangent Frames -------------------
+
+// Maps a unit vector onto the octahedron |x| + |y| + |z| = 1, then folds the lower half over
+// the upper, giving a square in [-1, 1] that covers the sphere evenly.
+static vec2 octEncode(vec3 n) {
+    f32 sum = abs(n.x) + abs(n.y) + abs(n.z);
+    if (sum == 0) return vec2(1, 0); // no direction, happens for tangents of vertices without texture coordinates
+    n /= sum;
+    if (n.z >= 0) return vec2(n.x, n.y);
+    return vec2((1 - abs(n.y)) * (n.x >= 0 ? 1 : -1), (1 - abs(n.x)) * (n.y >= 0 ? 1 : -1));
+}
+
+static s16 snorm16(f32 value) {
+    return s16(glm::round(glm::clamp(value, -1.f, 1.f) * 32767));
+}
+
+static u16 unorm16(f32 value) {
+    return u16(glm::round(glm::clamp(value, 0.f, 1.f) * 65535));
+}
+
+void compactVertexData(const vector<Vertex> &verts, vector<CompactVertex> &compact, Mesh &mesh) {
+    vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    for (const Vertex &vert : verts) {
+        lo = glm::min(lo, vert.position);
+        hi = glm::max(hi, vert.position);
     }
+    if (verts.empty()) lo = hi = vec3(0);
+    mesh.vertexFormat = kCompactVertex;
+    mesh.positionOffset = lo;
+    mesh.positionScale = glm::max(hi - lo, vec3(FLT_MIN)); // flat meshes still decode to lo
+    vec3 toUnit = 1.f / mesh.positionScale;
 
-    glBufferData(GL_ARRAY_BUFFER, updatedVerts.size() * sizeof(updatedVerts[0]), updatedVerts.data(), GL_STATIC_DRAW);
+    compact.resize(verts.size());
+    for (u32 c = 0, n = u32(verts.size()); c < n; c++) {
+        const Vertex &vert = verts[c];
+        CompactVertex &out = compact[c];
+        vec3 unit = (vert.position - lo) * toUnit;
+        out.position[0] = unorm16(unit.x);
+        out.position[1] = unorm16(unit.y);
+        out.position[2] = unorm16(unit.z);
+        out.position[3] = dot(cross(vert.normal, vert.tangent), vert.bitangent) < 0 ? 0 : 0xFFFF;
+        vec2 normal = octEncode(vert.normal);
+        vec2 tangent = octEncode(vert.tangent);
+        out.normal[0] = snorm16(normal.x);
+        out.normal[1] = snorm16(normal.y);
+        out.tangent[0] = snorm16(tangent.x);
+        out.tangent[1] = snorm16(tangent.y);
+        out.tex[0] = u16(detail::toFloat16(vert.tex.x));
+        out.tex[1] = u16(detail::toFloat16(vert.tex.y));
+    }
+}
+
+void createInstanceTexture(Mesh &mesh) {
+    if (mesh.instances.empty()) return;
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, mesh.instances.size() * sizeof(mat4), mesh.instances.data(), GL_STATIC_DRAW);
+    glGenTextures(1, &mesh.instanceTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, mesh.instanceTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    checkError();
+}
+
+void assignShaders(Mesh &mesh) {
+    for (int c = 0, n = mesh.parts.size(); c < n; c++) {
+        mesh.parts[c].shader = findShader(mesh, mesh.materials[mesh.parts[c].material]);
+    }
 }
 
-void obj2mesh(OBJMesh &obj, Mesh &mesh) {
+void obj2mesh(OBJMesh &obj, Mesh &mesh, const string &objFile, VertexFormat format, u32 splitTriangles) {
+    selectOccluders(obj, mesh.occluders);
+    vector<InstanceGroup> instanceGroups;
+    findInstances(obj, instanceGroups);
+    splitObjects(obj, instanceGroups, splitTriangles);
+
     mesh.parts.resize(obj.meshParts.size());
     mesh.materials.resize(obj.materials.size());
     mesh.textures.resize(obj.textures.size());
@@ -204,18 +1361,59 @@ void obj2mesh(OBJMesh &obj, Mesh &mesh) {
         obj2mesh_material(obj.materials[c], mesh.materials[c]);
     }
 
+    vector<u32> partObjects(obj.meshParts.size());
     for (int c = 0, n = obj.meshParts.size(); c < n; c++) {
         obj2mesh_meshPart(obj.meshParts[c], mesh.parts[c]);
+        partObjects[c] = obj.meshParts[c].objectIndex;
     }
 
-    optimizeMesh(mesh.parts, obj.indices);
+    mesh.objects.resize(obj.objects.size());
+    for (int c = 0, n = obj.objects.size(); c < n; c++) {
+        mesh.objects[c].name = obj.objects[c].name;
+        mesh.objects[c].bounds = obj.objects[c].bounds;
+    }
 
-    for (int c = 0, n = mesh.parts.size(); c < n; c++) {
-        mesh.parts[c].shader = findShader(mesh, mesh.materials[mesh.parts[c].material]);
+    optimizeMesh(mesh.parts, partObjects, mesh.materials, mesh.objectParts, obj.indices, obj.verts);
+    assignShaders(mesh);
+    addInstances(mesh, instanceGroups);
+
+    vector<Vertex> verts;
+    buildVertexData(obj.verts, obj.indices, verts);
+    buildMeshlets(mesh, obj.verts, obj.indices);
+    buildLods(mesh, obj.verts, obj.indices);
+    vector<OBJVertex>().swap(obj.verts);
+    vector<u8> indexData;
+    packIndices(mesh, obj.indices, indexData);
+    vector<u32>().swap(obj.indices);
+
+    vector<CompactVertex> compact;
+    const void *vertexData = verts.data();
+    u32 numVerts = u32(verts.size());
+    mesh.vertexFormat = kFloatVertex;
+    if (format == kCompactVertex) {
+        compactVertexData(verts, compact, mesh);
+        vector<Vertex>().swap(verts);
+        vertexData = compact.data();
+    }
+    vector<u8> split;
+    splitVertexData(vertexData, numVerts, mesh.vertexFormat, split);
+    vector<Vertex>().swap(verts);
+    vector<CompactVertex>().swap(compact);
+    printf("Vertex buffer is %.1f MB (%u bytes per vertex, %u of them positions)\n", split.size() / (1024.0 * 1024.0),
+           vertexSize(mesh.vertexFormat), positionSize(mesh.vertexFormat));
+
+    // The cache is written first so that each array can be released as soon as the driver has its copy.
+    if (!objFile.empty()) {
+        saveMeshCache(objFile, obj.materialLibraries, obj.textures, mesh, split.data(), numVerts, indexData.data(),
+                      indexData.size(), splitTriangles);
     }
 
-    mesh.vao = createVao();
-    bufferObjVertexData(obj);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, obj.indices.size() * sizeof(obj.indices[0]), obj.indices.data(), GL_STATIC_DRAW);
+    mesh.vao = createVao(mesh.vertexFormat, numVerts);
+    glBufferData(GL_ARRAY_BUFFER, split.size(), split.data(), GL_STATIC_DRAW);
+    vector<u8>().swap(split);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size(), indexData.data(), GL_STATIC_DRAW);
+    vector<u8>().swap(indexData);
+    mesh.positionVao = createPositionVao(mesh.vao, mesh.vertexFormat, numVerts);
+    createInstanceTexture(mesh);
     checkError();
 }
@@ -6,9 +6,11 @@
 #define SPONZA_MESH_H
 
 #include <glm/glm.hpp>
+#include <string>
 #include <vector>
 #include "gl_includes.h"
 #include "types.h"
+#include "bounds.h"
 
 struct Texture {
     u32 glHandle;
@@ -60,19 +62,103 @@ struct Material {
     MaterialFlags flags;  // MAT_* flags. 1 if field is initialized, 0 otherwise.
 };
 
+// Each part's indices are all of one type, and the offsets of everything in the part (its
+// object parts, their LOD levels and meshlets) count indices of that type. Parts whose
+// vertices span less than 64K are stored in 16 bits, relative to their lowest vertex.
 struct MeshPart {
-    u32 offset;    // The first index in the mesh to draw
-    u32 size;      // The number of indices in the mesh to draw
-    u16 shader;    // The shader to use when drawing this object
-    u16 material;  // The material properties to set when drawing this object
+    u32 offset;     // The first index in the mesh to draw
+    u32 size;       // The number of indices in the mesh to draw
+    u16 shader;     // The shader to use when drawing this object
+    u16 material;   // The material properties to set when drawing this object
+    u32 baseVertex; // Added to every index
+    u32 indexType;  // GL_UNSIGNED_BYTE, _SHORT or _INT, or 0 to draw the vertices in order
+};
+
+inline u32 indexSize(u32 indexType) {
+    return indexType == GL_UNSIGNED_BYTE ? 1 : indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+}
+
+// A group or object from the source file, for culling and LOD at a finer grain than materials.
+struct MeshObject {
+    std::string name;
+    Bounds bounds;
+};
+
+// The triangles of one object within one part. Each part's object parts are contiguous
+// and cover the part exactly, so either list can be drawn from the same index buffer.
+struct ObjectPart {
+    u32 offset; // The first index in the mesh to draw
+    u32 size;   // The number of indices in the mesh to draw
+    u32 object; // Index into Mesh::objects
+    u32 part;   // Index into Mesh::parts, for the shader and material
+};
+
+// Every object part has MAX_LODS levels of detail, the first being the object part itself.
+// The simplified ones are stored after their part's full detail triangles in the index buffer. Levels
+// that weren't worth building repeat the one before.
+#define MAX_LODS 4
+
+struct LodLevel {
+    u32 offset; // The first index in the mesh to draw
+    u32 size;   // The number of indices in the mesh to draw
+    f32 error;  // How far the surface may be from the full detail one, in object space
+};
+
+// A small cluster of an object part's full detail triangles, contiguous in the index buffer,
+// for culling at a finer grain than objects.
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+struct Meshlet {
+    u32 offset;         // The first index in the mesh to draw
+    u32 size;           // The number of indices in the mesh to draw
+    glm::vec3 center;   // bounding sphere
+    f32 radius;
+    glm::vec3 coneAxis; // the average direction the triangles face
+    f32 coneCutoff;     // sine of the widest angle between the axis and a triangle, or 1 if they face every way
+};
+
+// True if every triangle in the meshlet faces away from a camera at camPos.
+inline bool isBackfacing(const Meshlet &meshlet, glm::vec3 camPos) {
+    glm::vec3 view = meshlet.center - camPos;
+    return glm::dot(view, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(view) + meshlet.radius;
+}
+
+// How to draw a part that doesn't live in the mesh's own vertex and index buffers,
+// as loaded from glTF (see gltf.h).
+struct PartBinding {
+    u32 vao;             // vertex layout and index buffer for the part
+    glm::mat4 transform; // object to world
+    glm::mat4 inverse;   // world to object, for moving the camera and light into the part's space
+};
+
+// How the vertices in a mesh's vertex buffer are stored. The vertex shader decodes either.
+enum VertexFormat : u8 {
+    kFloatVertex,   // Vertex, 56 bytes
+    kCompactVertex, // CompactVertex, 20 bytes
 };
 
 struct Mesh {
     u32 vao;
-    u32 size; // total number of indices
+    u32 positionVao = 0; // just the positions from vao's buffers, for depth only passes, or 0 if there's none
+    u32 size; // number of full detail indices
     std::vector<Texture> textures;
     std::vector<Material> materials;
     std::vector<MeshPart> parts;
+    std::vector<MeshObject> objects;
+    std::vector<ObjectPart> objectParts; // in index buffer order
+    std::vector<LodLevel> lods; // MAX_LODS per object part, or empty if there are no simplified levels
+    std::vector<Meshlet> meshlets; // in index buffer order, or empty
+    std::vector<u32> firstMeshlet; // per object part, plus one past the end, into meshlets
+    std::vector<glm::mat4> instances; // object to world, for object parts drawn more than once (see instancing.h)
+    std::vector<u32> firstInstance; // per object part, plus one past the end, into instances, or empty if nothing repeats.
+                                    // Object parts without instances are drawn once, as they are.
+    u32 instanceTexture = 0; // GL_TEXTURE_BUFFER of instances, four RGBA32F texels each
+    std::vector<glm::vec3> occluders; // world space triangles for software occlusion culling (see occlusion.h)
+    std::vector<PartBinding> partBindings; // one per part, or empty if every part draws from vao untransformed
+    VertexFormat vertexFormat = kFloatVertex;
+    glm::vec3 positionOffset = glm::vec3(0); // compact positions decode to offset + scale * unorm
+    glm::vec3 positionScale = glm::vec3(1);
 };
 
 struct Vertex {
@@ -83,10 +169,57 @@ struct Vertex {
     glm::vec2 tex;
 };
 
+// Vertex quantized to fit the same data in 20 bytes. The bitangent is rebuilt from the
+// normal and tangent in the shader, so only its handedness is kept.
+struct CompactVertex {
+    u16 position[4]; // xyz quantized to the mesh's bounding box, w is 0xFFFF if the bitangent is cross(normal, tangent), else 0
+    s16 normal[2];   // octahedral encoding
+    s16 tangent[2];  // octahedral encoding
+    u16 tex[2];      // half floats
+};
+
+inline u32 vertexSize(VertexFormat format) {
+    return format == kCompactVertex ? sizeof(CompactVertex) : sizeof(Vertex);
+}
 
-GLuint createVao();
+inline u32 positionSize(VertexFormat format) {
+    return format == kCompactVertex ? sizeof(CompactVertex::position) : sizeof(Vertex::position);
+}
+
+// Vertex buffers are either interleaved, one whole vertex after another, or split into two
+// streams: the positions of all splitVerts vertices packed together, then the rest of each
+// vertex. Passes that only need positions then fetch nothing else. obj2mesh meshes are split.
+
+// Creates a VAO with new vertex and index buffers, leaving all three bound.
+GLuint createVao(VertexFormat format = kFloatVertex, u32 splitVerts = 0);
+// Creates a VAO reading only the positions from vao's buffers, and binds vao again.
+GLuint createPositionVao(GLuint vao, VertexFormat format, u32 splitVerts);
+// Points the vertex attributes of the bound VAO at the bound GL_ARRAY_BUFFER.
+void bindVertexAttribs(VertexFormat format = kFloatVertex, u32 splitVerts = 0);
+// Rearranges numVerts interleaved vertices into the split layout.
+void splitVertexData(const void *verts, u32 numVerts, VertexFormat format, std::vector<u8> &split);
+
+// Uploads mesh.instances to mesh.instanceTexture, if there are any.
+void createInstanceTexture(Mesh &mesh);
+
+// Picks the shader for each part. Call again if the textures change.
+void assignShaders(Mesh &mesh);
 
 struct OBJMesh;
-void obj2mesh(OBJMesh &obj, Mesh &mesh);
+struct OBJMaterial;
+struct OBJVertex;
+void obj2mesh_material(const OBJMaterial &obj, Material &mat);
+// Converts OBJ vertices and fills in tangents and bitangents from the triangles in indices.
+void buildVertexData(const std::vector<OBJVertex> &objVerts, const std::vector<u32> &indices, std::vector<Vertex> &verts);
+// Quantizes verts, filling in the position decoding for the mesh.
+void compactVertexData(const std::vector<Vertex> &verts, std::vector<CompactVertex> &compact, Mesh &mesh);
+// Objects with more triangles than this are split into spatial cells by default, see splitObjects in mesh.cpp.
+#define DEFAULT_SPLIT_TRIANGLES 8192
+
+// Builds and uploads the mesh. If objFile is given, the result is also cached next to it (see meshcache.h).
+// obj's vertices and indices are released along the way to keep the peak memory down. Objects are split
+// into cells of at most splitTriangles triangles for culling, or not at all if it's 0.
+void obj2mesh(OBJMesh &obj, Mesh &mesh, const std::string &objFile = std::string(), VertexFormat format = kCompactVertex,
+              u32 splitTriangles = DEFAULT_SPLIT_TRIANGLES);
 
 #endif //SPONZA_MESH_H
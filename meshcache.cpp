@@ -0,0 +1,530 @@
+#include "meshcache.h"
+#include "mapped_file.h"
+#include "meshcodec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace glm;
+
+#define MESH_CACHE_MAGIC 0x4D5A5053 // "SPZM"
+
+struct MeshCacheHeader {
+    u32 magic;
+    u32 version;
+    u32 vertexSize;   // of the vertex format, in case the layout changes without a version bump
+    u32 numTextures;
+    u32 numMaterials;
+    u32 numParts;
+    u32 numObjects;
+    u32 numObjectParts;
+    u32 numVerts;
+    u32 numMeshIndices; // just the full detail ones, see Mesh::size
+    u32 numLods;
+    u32 numMeshlets;
+    u32 numInstances;
+    u32 numOccluders; // corners, three per triangle
+    u32 numLibraries;
+    u32 vertexFormat;
+    u32 splitTriangles; // see obj2mesh
+    f32 positionOffset[3]; // compact vertex decoding, see Mesh
+    f32 positionScale[3];
+    u64 sourceSize;
+    s64 sourceMtime;
+    u64 sourceHash;
+    u64 indexBytes;      // 16 and 32 bit indices by part, see MeshPart
+    u64 shortIndexBytes; // of those, the 16 bit ones that come first, with any padding after them
+    u64 texturesOffset;  // CachedString[numTextures]
+    u64 materialsOffset; // CachedMaterial[numMaterials]
+    u64 partsOffset;     // MeshPart[numParts]
+    u64 objectsOffset;   // CachedObject[numObjects]
+    u64 objectPartsOffset; // ObjectPart[numObjectParts]
+    u64 lodsOffset;      // LodLevel[numLods]
+    u64 meshletsOffset;  // Meshlet[numMeshlets]
+    u64 firstMeshletOffset; // u32[numObjectParts + 1], if there are meshlets
+    u64 instancesOffset; // mat4[numInstances]
+    u64 firstInstanceOffset; // u32[numObjectParts + 1], if there are instances
+    u64 occludersOffset; // vec3[numOccluders]
+    u64 librariesOffset; // CachedLibrary[numLibraries]
+    // The vertex and index buffers, coded with meshcodec.h. Vertices are split as in createVao.
+    u64 positionsOffset; // numVerts positions
+    u64 positionsSize;
+    u64 attributesOffset; // the rest of numVerts vertices
+    u64 attributesSize;
+    u64 shortIndicesOffset; // shortIndexBytes of 16 bit indices
+    u64 shortIndicesSize;
+    u64 longIndicesOffset; // the remaining indexBytes, of 32 bit indices
+    u64 longIndicesSize;
+    u64 stringsOffset;   // characters for every CachedString
+    u64 fileSize;
+};
+
+struct CachedObject {
+    CachedString name;
+    Bounds bounds;
+};
+
+// Hashes 32 bytes per step in four independent lanes, so the multiplies overlap.
+static u64 hashBytes(const char *data, u64 size) {
+    const u64 k0 = 0x9E3779B97F4A7C15ULL;
+    const u64 k1 = 0xC2B2AE3D27D4EB4FULL;
+    u64 lanes[4] = { size ^ k0, size ^ k1, ~size ^ k0, ~size ^ k1 };
+
+    u64 pos = 0;
+    for (; pos + 32 <= size; pos += 32) {
+        for (int c = 0; c < 4; c++) {
+            u64 word;
+            memcpy(&word, data + pos + c * 8, sizeof(word));
+            lanes[c] = (lanes[c] ^ word) * k0;
+            lanes[c] ^= lanes[c] >> 31;
+        }
+    }
+    u64 hash = lanes[0] ^ (lanes[1] * k1) ^ (lanes[2] * k0) ^ (lanes[3] * k1);
+    for (; pos < size; pos++) {
+        hash = (hash ^ u8(data[pos])) * k1;
+    }
+    hash ^= hash >> 33;
+    hash *= k0;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+bool statSource(const string &filename, SourceInfo &info) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        return false;
+    }
+    info.size = u64(st.st_size);
+    info.mtime = s64(st.st_mtime);
+    return true;
+}
+
+bool hashSource(const string &filename, u64 &hash) {
+    MappedFile source;
+    if (!mapFile(filename, source)) {
+        return false;
+    }
+    hash = hashBytes(source.data, source.size);
+    unmapFile(source);
+    return true;
+}
+
+bool sourceUnchanged(const string &filename, u64 size, s64 mtime, u64 hash) {
+    SourceInfo source;
+    if (!statSource(filename, source) || source.size != size) {
+        return false;
+    }
+    u64 newHash;
+    return source.mtime == mtime || (hashSource(filename, newHash) && newHash == hash);
+}
+
+static string cacheFileFor(const string &objFile) {
+    return objFile + ".meshcache";
+}
+
+bool packLibrary(const string &filename, string &strings, CachedLibrary &cached) {
+    SourceInfo source;
+    if (!statSource(filename, source) || !hashSource(filename, cached.hash)) {
+        return false;
+    }
+    cached.name = addCachedString(strings, filename);
+    cached.size = source.size;
+    cached.mtime = source.mtime;
+    return true;
+}
+
+CachedString addCachedString(string &strings, const string &str) {
+    CachedString cached = { u32(strings.size()), u32(str.size()) };
+    strings += str;
+    return cached;
+}
+
+string readCachedString(const char *strings, const CachedString &str) {
+    return string(strings + str.offset, str.length);
+}
+
+void packMaterial(const Material &mat, string &strings, CachedMaterial &cached) {
+    cached.name = addCachedString(strings, mat.name);
+    cached.Ns = mat.Ns;
+    cached.d = mat.d;
+    cached.Tf = mat.Tf;
+    cached.Ka = mat.Ka;
+    cached.Kd = mat.Kd;
+    cached.Ks = mat.Ks;
+    cached.Ke = mat.Ke;
+    cached.map_Ka = mat.map_Ka;
+    cached.map_Kd = mat.map_Kd;
+    cached.map_Ks = mat.map_Ks;
+    cached.map_Ke = mat.map_Ke;
+    cached.map_Ns = mat.map_Ns;
+    cached.map_d = mat.map_d;
+    cached.map_bump = mat.map_bump;
+    cached.flags = mat.flags;
+}
+
+void unpackMaterial(const CachedMaterial &cached, const char *strings, Material &mat) {
+    mat.name = readCachedString(strings, cached.name);
+    mat.Ns = cached.Ns;
+    mat.d = cached.d;
+    mat.Tf = cached.Tf;
+    mat.Ka = cached.Ka;
+    mat.Kd = cached.Kd;
+    mat.Ks = cached.Ks;
+    mat.Ke = cached.Ke;
+    mat.map_Ka = cached.map_Ka;
+    mat.map_Kd = cached.map_Kd;
+    mat.map_Ks = cached.map_Ks;
+    mat.map_Ke = cached.map_Ke;
+    mat.map_Ns = cached.map_Ns;
+    mat.map_d = cached.map_d;
+    mat.map_bump = cached.map_bump;
+    mat.flags = cached.flags;
+}
+
+u64 align16(u64 offset) {
+    return (offset + 15) & ~u64(15);
+}
+
+// Compact vertices are all 16 bit fields, float ones all 32 bit.
+static u32 vertexLaneSize(VertexFormat format) {
+    return format == kCompactVertex ? sizeof(u16) : sizeof(f32);
+}
+
+bool loadMeshCache(const string &objFile, Mesh &mesh, vector<OBJTexture> &textures, VertexFormat format,
+                   u32 splitTriangles) {
+    auto startTime = chrono::high_resolution_clock::now();
+
+    string cacheFile = cacheFileFor(objFile);
+    MappedFile file;
+    if (!mapFile(cacheFile, file)) {
+        return false; // no cache yet
+    }
+
+    MeshCacheHeader header;
+    bool valid = file.size >= sizeof(header);
+    if (valid) {
+        memcpy(&header, file.data, sizeof(header));
+        valid = header.magic == MESH_CACHE_MAGIC &&
+                header.version == MESH_CACHE_VERSION &&
+                header.vertexFormat == format &&
+                header.splitTriangles == splitTriangles &&
+                header.vertexSize == vertexSize(format) &&
+                header.fileSize == file.size;
+    }
+    if (!valid) {
+        printf("Mesh cache %s is out of date\n", cacheFile.c_str());
+        unmapFile(file);
+        return false;
+    }
+
+    // Every section and string has to lie within the file before anything is read from it, so a
+    // corrupt cache is rebuilt instead of crashing.
+    auto inFile = [&](u64 offset, u64 size) {
+        return offset <= file.size && size <= file.size - offset;
+    };
+    u64 stringsSize = header.stringsOffset <= file.size ? file.size - header.stringsOffset : 0;
+    auto stringInFile = [&](const CachedString &str) {
+        return str.offset <= stringsSize && str.length <= stringsSize - str.offset;
+    };
+    u64 numFirstMeshlets = header.numMeshlets ? u64(header.numObjectParts) + 1 : 0;
+    u64 numFirstInstances = header.numInstances ? u64(header.numObjectParts) + 1 : 0;
+    valid = inFile(header.stringsOffset, 0) &&
+            inFile(header.texturesOffset, u64(header.numTextures) * sizeof(CachedString)) &&
+            inFile(header.materialsOffset, u64(header.numMaterials) * sizeof(CachedMaterial)) &&
+            inFile(header.partsOffset, u64(header.numParts) * sizeof(MeshPart)) &&
+            inFile(header.objectsOffset, u64(header.numObjects) * sizeof(CachedObject)) &&
+            inFile(header.objectPartsOffset, u64(header.numObjectParts) * sizeof(ObjectPart)) &&
+            inFile(header.lodsOffset, u64(header.numLods) * sizeof(LodLevel)) &&
+            inFile(header.meshletsOffset, u64(header.numMeshlets) * sizeof(Meshlet)) &&
+            inFile(header.firstMeshletOffset, numFirstMeshlets * sizeof(u32)) &&
+            inFile(header.instancesOffset, u64(header.numInstances) * sizeof(mat4)) &&
+            inFile(header.firstInstanceOffset, numFirstInstances * sizeof(u32)) &&
+            inFile(header.occludersOffset, u64(header.numOccluders) * sizeof(vec3)) &&
+            inFile(header.librariesOffset, u64(header.numLibraries) * sizeof(CachedLibrary));
+    const CachedString *cachedTextures = (const CachedString *) (file.data + header.texturesOffset);
+    const CachedMaterial *cachedMaterials = (const CachedMaterial *) (file.data + header.materialsOffset);
+    const CachedObject *cachedObjects = (const CachedObject *) (file.data + header.objectsOffset);
+    const CachedLibrary *libraries = (const CachedLibrary *) (file.data + header.librariesOffset);
+    for (u32 c = 0; valid && c < header.numTextures; c++) valid = stringInFile(cachedTextures[c]);
+    for (u32 c = 0; valid && c < header.numMaterials; c++) valid = stringInFile(cachedMaterials[c].name);
+    for (u32 c = 0; valid && c < header.numObjects; c++) valid = stringInFile(cachedObjects[c].name);
+    for (u32 c = 0; valid && c < header.numLibraries; c++) valid = stringInFile(libraries[c].name);
+    if (!valid) {
+        printf("Mesh cache %s is corrupt\n", cacheFile.c_str());
+        unmapFile(file);
+        return false;
+    }
+
+    const char *strings = file.data + header.stringsOffset;
+    auto readString = [&](const CachedString &str) {
+        return readCachedString(strings, str);
+    };
+
+    // Touched files are only treated as changed if their contents actually did.
+    valid = sourceUnchanged(objFile, header.sourceSize, header.sourceMtime, header.sourceHash);
+    for (u32 c = 0; valid && c < header.numLibraries; c++) {
+        valid = sourceUnchanged(readString(libraries[c].name), libraries[c].size, libraries[c].mtime, libraries[c].hash);
+    }
+    if (!valid) {
+        printf("Mesh cache %s is out of date\n", cacheFile.c_str());
+        unmapFile(file);
+        return false;
+    }
+
+    textures.resize(header.numTextures);
+    for (u32 c = 0; c < header.numTextures; c++) {
+        textures[c].name = readString(cachedTextures[c]);
+        textures[c].texName = UNLOADED;
+    }
+    mesh.textures.assign(header.numTextures, Texture { BAD_TEX });
+
+    mesh.materials.resize(header.numMaterials);
+    for (u32 c = 0; c < header.numMaterials; c++) {
+        unpackMaterial(cachedMaterials[c], strings, mesh.materials[c]);
+    }
+
+    const MeshPart *parts = (const MeshPart *) (file.data + header.partsOffset);
+    mesh.parts.assign(parts, parts + header.numParts);
+
+    mesh.objects.resize(header.numObjects);
+    for (u32 c = 0; c < header.numObjects; c++) {
+        mesh.objects[c].name = readString(cachedObjects[c].name);
+        mesh.objects[c].bounds = cachedObjects[c].bounds;
+    }
+    const ObjectPart *objectParts = (const ObjectPart *) (file.data + header.objectPartsOffset);
+    mesh.objectParts.assign(objectParts, objectParts + header.numObjectParts);
+    const LodLevel *lods = (const LodLevel *) (file.data + header.lodsOffset);
+    mesh.lods.assign(lods, lods + header.numLods);
+    const Meshlet *meshlets = (const Meshlet *) (file.data + header.meshletsOffset);
+    mesh.meshlets.assign(meshlets, meshlets + header.numMeshlets);
+    const u32 *firstMeshlet = (const u32 *) (file.data + header.firstMeshletOffset);
+    mesh.firstMeshlet.assign(firstMeshlet, firstMeshlet + numFirstMeshlets);
+    const mat4 *instances = (const mat4 *) (file.data + header.instancesOffset);
+    mesh.instances.assign(instances, instances + header.numInstances);
+    const u32 *firstInstance = (const u32 *) (file.data + header.firstInstanceOffset);
+    mesh.firstInstance.assign(firstInstance, firstInstance + numFirstInstances);
+    const vec3 *occluders = (const vec3 *) (file.data + header.occludersOffset);
+    mesh.occluders.assign(occluders, occluders + header.numOccluders);
+    mesh.size = header.numMeshIndices;
+
+    mesh.vertexFormat = format;
+    mesh.positionOffset = vec3(header.positionOffset[0], header.positionOffset[1], header.positionOffset[2]);
+    mesh.positionScale = vec3(header.positionScale[0], header.positionScale[1], header.positionScale[2]);
+    mesh.vao = createVao(format, header.numVerts);
+
+    // Decode straight into the buffers, so the data is only written once.
+    auto decodeStartTime = chrono::high_resolution_clock::now();
+    const u8 *data = (const u8 *) file.data;
+    u32 laneSize = vertexLaneSize(format);
+    u64 vertexBytes = u64(header.numVerts) * header.vertexSize;
+    u64 positionBytes = u64(header.numVerts) * positionSize(format);
+    glBufferData(GL_ARRAY_BUFFER, vertexBytes, nullptr, GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, header.indexBytes, nullptr, GL_STATIC_DRAW);
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+    u8 *verts = vertexBytes ? (u8 *) glMapBufferRange(GL_ARRAY_BUFFER, 0, vertexBytes, access) : nullptr;
+    u8 *indices = header.indexBytes ? (u8 *) glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, header.indexBytes, access)
+                                    : nullptr;
+    bool decoded = (verts || !vertexBytes) && (indices || !header.indexBytes) &&
+        header.shortIndexBytes <= header.indexBytes &&
+        inFile(header.positionsOffset, header.positionsSize) && inFile(header.attributesOffset, header.attributesSize) &&
+        inFile(header.shortIndicesOffset, header.shortIndicesSize) &&
+        inFile(header.longIndicesOffset, header.longIndicesSize) &&
+        decodeVertices(data + header.positionsOffset, header.positionsSize, verts, header.numVerts,
+                       positionSize(format), laneSize) &&
+        decodeVertices(data + header.attributesOffset, header.attributesSize, verts + positionBytes, header.numVerts,
+                       header.vertexSize - positionSize(format), laneSize) &&
+        decodeIndices(data + header.shortIndicesOffset, header.shortIndicesSize, indices,
+                      u32(header.shortIndexBytes / sizeof(u16)), sizeof(u16)) &&
+        decodeIndices(data + header.longIndicesOffset, header.longIndicesSize, indices + header.shortIndexBytes,
+                      u32((header.indexBytes - header.shortIndexBytes) / sizeof(u32)), sizeof(u32));
+    if (verts && !glUnmapBuffer(GL_ARRAY_BUFFER)) decoded = false;
+    if (indices && !glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER)) decoded = false;
+    chrono::duration<double> decodeSeconds = chrono::high_resolution_clock::now() - decodeStartTime;
+    if (!decoded) {
+        printf("Mesh cache %s is corrupt\n", cacheFile.c_str());
+        GLint buffers[2]; // still bound from createVao
+        glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &buffers[0]);
+        glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &buffers[1]);
+        glDeleteVertexArrays(1, &mesh.vao);
+        glDeleteBuffers(2, (const GLuint *) buffers);
+        mesh = Mesh();
+        unmapFile(file);
+        return false;
+    }
+    u64 decodedBytes = vertexBytes + header.indexBytes;
+    printf("Decoded %.1f MB of vertices and indices in %.1fms (%.2f GB/s)\n", decodedBytes / (1024.0 * 1024.0),
+           decodeSeconds.count() * 1000, decodedBytes / (decodeSeconds.count() * 1024.0 * 1024.0 * 1024.0));
+
+    mesh.positionVao = createPositionVao(mesh.vao, format, header.numVerts);
+    createInstanceTexture(mesh);
+    checkError();
+
+    unmapFile(file);
+
+    chrono::duration<double> seconds = chrono::high_resolution_clock::now() - startTime;
+    printf("Loaded mesh cache %s in %ums (%u vertices, %u indices, %u parts, %u objects)\n", cacheFile.c_str(),
+           u32(seconds.count() * 1000), header.numVerts, header.numMeshIndices, header.numParts, header.numObjects);
+    return true;
+}
+
+bool saveMeshCache(const string &objFile, const vector<string> &materialLibraries, const vector<OBJTexture> &textures,
+                   const Mesh &mesh, const void *verts, u32 numVerts, const void *indices, u64 indexBytes,
+                   u32 splitTriangles) {
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+
+    SourceInfo source;
+    if (!statSource(objFile, source) || !hashSource(objFile, header.sourceHash)) {
+        printf("Warning: Could not read %s, not writing a mesh cache\n", objFile.c_str());
+        return false;
+    }
+    header.sourceSize = source.size;
+    header.sourceMtime = source.mtime;
+
+    string strings;
+    auto addString = [&](const string &str) {
+        return addCachedString(strings, str);
+    };
+
+    vector<CachedLibrary> libraries(materialLibraries.size());
+    for (u32 c = 0, n = u32(materialLibraries.size()); c < n; c++) {
+        if (!packLibrary(materialLibraries[c], strings, libraries[c])) {
+            printf("Warning: Could not read %s, not writing a mesh cache\n", materialLibraries[c].c_str());
+            return false;
+        }
+    }
+
+    vector<CachedString> cachedTextures;
+    for (const OBJTexture &tex : textures) {
+        cachedTextures.push_back(addString(tex.name));
+    }
+
+    vector<CachedMaterial> cachedMaterials(mesh.materials.size());
+    for (u32 c = 0, n = u32(mesh.materials.size()); c < n; c++) {
+        packMaterial(mesh.materials[c], strings, cachedMaterials[c]);
+    }
+
+    vector<CachedObject> cachedObjects;
+    for (const MeshObject &object : mesh.objects) {
+        cachedObjects.push_back(CachedObject { addString(object.name), object.bounds });
+    }
+
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.vertexSize = vertexSize(mesh.vertexFormat);
+    header.vertexFormat = mesh.vertexFormat;
+    header.splitTriangles = splitTriangles;
+    memcpy(header.positionOffset, &mesh.positionOffset[0], sizeof(header.positionOffset));
+    memcpy(header.positionScale, &mesh.positionScale[0], sizeof(header.positionScale));
+    header.numTextures = u32(cachedTextures.size());
+    header.numMaterials = u32(cachedMaterials.size());
+    header.numParts = u32(mesh.parts.size());
+    header.numObjects = u32(cachedObjects.size());
+    header.numObjectParts = u32(mesh.objectParts.size());
+    header.numVerts = numVerts;
+    header.indexBytes = indexBytes;
+    header.numMeshIndices = mesh.size;
+    header.numLods = u32(mesh.lods.size());
+    header.numMeshlets = u32(mesh.meshlets.size());
+    header.numInstances = u32(mesh.instances.size());
+    header.numOccluders = u32(mesh.occluders.size());
+    header.numLibraries = u32(libraries.size());
+
+    // 16 bit indices end where the first 32 bit part starts, see packIndices.
+    header.shortIndexBytes = indexBytes;
+    for (const MeshPart &part : mesh.parts) {
+        if (part.indexType == GL_UNSIGNED_INT) {
+            header.shortIndexBytes = std::min(header.shortIndexBytes, u64(part.offset) * sizeof(u32));
+        }
+    }
+    u32 laneSize = vertexLaneSize(mesh.vertexFormat);
+    u32 position = positionSize(mesh.vertexFormat);
+    vector<u8> positions, attributes, shortIndices, longIndices;
+    encodeVertices(verts, numVerts, position, laneSize, positions);
+    encodeVertices((const u8 *) verts + u64(numVerts) * position, numVerts, header.vertexSize - position, laneSize,
+                   attributes);
+    encodeIndices(indices, u32(header.shortIndexBytes / sizeof(u16)), sizeof(u16), shortIndices);
+    encodeIndices((const u8 *) indices + header.shortIndexBytes, u32((indexBytes - header.shortIndexBytes) / sizeof(u32)),
+                  sizeof(u32), longIndices);
+    header.positionsSize = positions.size();
+    header.attributesSize = attributes.size();
+    header.shortIndicesSize = shortIndices.size();
+    header.longIndicesSize = longIndices.size();
+
+    // Every section starts on a 16 byte boundary.
+    header.texturesOffset = align16(sizeof(header));
+    header.materialsOffset = align16(header.texturesOffset + cachedTextures.size() * sizeof(CachedString));
+    header.partsOffset = align16(header.materialsOffset + cachedMaterials.size() * sizeof(CachedMaterial));
+    header.objectsOffset = align16(header.partsOffset + mesh.parts.size() * sizeof(MeshPart));
+    header.objectPartsOffset = align16(header.objectsOffset + cachedObjects.size() * sizeof(CachedObject));
+    header.lodsOffset = align16(header.objectPartsOffset + mesh.objectParts.size() * sizeof(ObjectPart));
+    header.meshletsOffset = align16(header.lodsOffset + mesh.lods.size() * sizeof(LodLevel));
+    header.firstMeshletOffset = align16(header.meshletsOffset + mesh.meshlets.size() * sizeof(Meshlet));
+    header.instancesOffset = align16(header.firstMeshletOffset + mesh.firstMeshlet.size() * sizeof(u32));
+    header.firstInstanceOffset = align16(header.instancesOffset + mesh.instances.size() * sizeof(mat4));
+    header.occludersOffset = align16(header.firstInstanceOffset + mesh.firstInstance.size() * sizeof(u32));
+    header.librariesOffset = align16(header.occludersOffset + mesh.occluders.size() * sizeof(vec3));
+    header.positionsOffset = align16(header.librariesOffset + libraries.size() * sizeof(CachedLibrary));
+    header.attributesOffset = align16(header.positionsOffset + positions.size());
+    header.shortIndicesOffset = align16(header.attributesOffset + attributes.size());
+    header.longIndicesOffset = align16(header.shortIndicesOffset + shortIndices.size());
+    header.stringsOffset = align16(header.longIndicesOffset + longIndices.size());
+    header.fileSize = header.stringsOffset + strings.size();
+
+    // Write to a temporary file first, so a crash never leaves a truncated cache behind.
+    string cacheFile = cacheFileFor(objFile);
+    string tempFile = cacheFile + ".tmp";
+    ofstream output(tempFile, ios::binary | ios::trunc);
+    if (!output) {
+        printf("Warning: Could not write mesh cache %s\n", cacheFile.c_str());
+        return false;
+    }
+
+    auto writeSection = [&](u64 offset, const void *data, u64 size) {
+        static const char padding[16] = {};
+        output.write(padding, streamsize(offset - u64(output.tellp())));
+        output.write((const char *) data, streamsize(size));
+    };
+    output.write((const char *) &header, sizeof(header));
+    writeSection(header.texturesOffset, cachedTextures.data(), cachedTextures.size() * sizeof(CachedString));
+    writeSection(header.materialsOffset, cachedMaterials.data(), cachedMaterials.size() * sizeof(CachedMaterial));
+    writeSection(header.partsOffset, mesh.parts.data(), mesh.parts.size() * sizeof(MeshPart));
+    writeSection(header.objectsOffset, cachedObjects.data(), cachedObjects.size() * sizeof(CachedObject));
+    writeSection(header.objectPartsOffset, mesh.objectParts.data(), mesh.objectParts.size() * sizeof(ObjectPart));
+    writeSection(header.lodsOffset, mesh.lods.data(), mesh.lods.size() * sizeof(LodLevel));
+    writeSection(header.meshletsOffset, mesh.meshlets.data(), mesh.meshlets.size() * sizeof(Meshlet));
+    writeSection(header.firstMeshletOffset, mesh.firstMeshlet.data(), mesh.firstMeshlet.size() * sizeof(u32));
+    writeSection(header.instancesOffset, mesh.instances.data(), mesh.instances.size() * sizeof(mat4));
+    writeSection(header.firstInstanceOffset, mesh.firstInstance.data(), mesh.firstInstance.size() * sizeof(u32));
+    writeSection(header.occludersOffset, mesh.occluders.data(), mesh.occluders.size() * sizeof(vec3));
+    writeSection(header.librariesOffset, libraries.data(), libraries.size() * sizeof(CachedLibrary));
+    writeSection(header.positionsOffset, positions.data(), positions.size());
+    writeSection(header.attributesOffset, attributes.data(), attributes.size());
+    writeSection(header.shortIndicesOffset, shortIndices.data(), shortIndices.size());
+    writeSection(header.longIndicesOffset, longIndices.data(), longIndices.size());
+    writeSection(header.stringsOffset, strings.data(), strings.size());
+    output.close();
+    if (!output) {
+        printf("Warning: Failed writing mesh cache %s\n", cacheFile.c_str());
+        remove(tempFile.c_str());
+        return false;
+    }
+
+    remove(cacheFile.c_str()); // rename won't replace an existing file on Windows
+    if (rename(tempFile.c_str(), cacheFile.c_str()) != 0) {
+        printf("Warning: Could not replace mesh cache %s\n", cacheFile.c_str());
+        return false;
+    }
+
+    u64 rawBytes = u64(numVerts) * header.vertexSize + indexBytes;
+    u64 codedBytes = positions.size() + attributes.size() + shortIndices.size() + longIndices.size();
+    printf("Saved mesh cache %s (%.1f MB, vertices and indices %.1f MB coded to %.1f MB, %.2fx)\n", cacheFile.c_str(),
+           header.fileSize / (1024.0 * 1024.0), rawBytes / (1024.0 * 1024.0), codedBytes / (1024.0 * 1024.0),
+           codedBytes ? double(rawBytes) / codedBytes : 1.0);
+    return true;
+}
@@ -0,0 +1,79 @@
+#ifndef SPONZA_MESHCACHE_H
+#define SPONZA_MESHCACHE_H
+
+#include <string>
+#include <vector>
+#include "mesh.h"
+#include "obj.h"
+
+// Binary cache of everything obj2mesh produces, stored next to the OBJ file as <objFile>.meshcache.
+// The cache is keyed on the size, modification time and a hash of the contents of the OBJ file and
+// of every material library it loaded. Textures are read from their own files on every load.
+// Bump MESH_CACHE_VERSION whenever the layout or the processing in obj2mesh changes.
+#define MESH_CACHE_VERSION 14
+
+// Loads the cached mesh for objFile if there is an up to date cache in the given vertex format and split,
+// creating its VAO and decoding the compressed vertex and index buffers straight into mapped GL buffers.
+// Textures are returned by name; the caller loads them and fills in mesh.textures.
+bool loadMeshCache(const std::string &objFile, Mesh &mesh, std::vector<OBJTexture> &textures,
+                   VertexFormat format = kCompactVertex, u32 splitTriangles = DEFAULT_SPLIT_TRIANGLES);
+
+// materialLibraries are the .mtl files the OBJ loaded, see OBJMesh. verts are numVerts vertices in
+// mesh.vertexFormat, split as in createVao. splitTriangles is what obj2mesh split the objects with.
+bool saveMeshCache(const std::string &objFile, const std::vector<std::string> &materialLibraries,
+                   const std::vector<OBJTexture> &textures, const Mesh &mesh, const void *verts, u32 numVerts,
+                   const void *indices, u64 indexBytes, u32 splitTriangles);
+
+// Pieces of the cache format that other binary files (see outofcore.h) share.
+
+struct CachedString {
+    u32 offset; // relative to the file's string table
+    u32 length;
+};
+
+// Material, with the name moved into the string table.
+struct CachedMaterial {
+    CachedString name;
+    f32 Ns;
+    f32 d;
+    glm::vec3 Tf;
+    glm::vec3 Ka;
+    glm::vec3 Kd;
+    glm::vec3 Ks;
+    glm::vec3 Ke;
+    u16 map_Ka;
+    u16 map_Kd;
+    u16 map_Ks;
+    u16 map_Ke;
+    u16 map_Ns;
+    u16 map_d;
+    u16 map_bump;
+    MaterialFlags flags;
+};
+
+struct SourceInfo {
+    u64 size;
+    s64 mtime;
+};
+
+// A material library the OBJ loaded, keyed like the OBJ itself.
+struct CachedLibrary {
+    CachedString name;
+    u64 size;
+    s64 mtime;
+    u64 hash;
+};
+
+bool statSource(const std::string &filename, SourceInfo &info);
+bool hashSource(const std::string &filename, u64 &hash);
+// True if filename still has the given size and contents. The contents are only hashed if the
+// modification time changed.
+bool sourceUnchanged(const std::string &filename, u64 size, s64 mtime, u64 hash);
+bool packLibrary(const std::string &filename, std::string &strings, CachedLibrary &cached);
+CachedString addCachedString(std::string &strings, const std::string &str);
+std::string readCachedString(const char *strings, const CachedString &str);
+void packMaterial(const Material &mat, std::string &strings, CachedMaterial &cached);
+void unpackMaterial(const CachedMaterial &cached, const char *strings, Material &mat);
+u64 align16(u64 offset);
+
+#endif //SPONZA_MESHCACHE_H
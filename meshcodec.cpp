@@ -0,0 +1,512 @@
+#include "meshcodec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include "parallel.h"
+
+using namespace std;
+
+// Blocks are the unit of parallel decoding; these keep each one's scratch within L2.
+const u32 kVertexBlock = 8192;   // vertices
+const u32 kIndexBlock = 3 * 8192; // indices
+
+// Encoded streams start with the number of blocks and where each one ends, counted from the
+// end of the table. Each block is a method byte, the size of the rearranged bytes and then
+// those bytes, either as they are or compressed.
+enum BlockMethod : u8 {
+    kStored,
+    kCompressed,
+};
+
+static inline u32 load32(const u8 *p) {
+    u32 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// ------------------ Begin LZ -------------------
+
+// Sequences of literals followed by a match, like LZ4: a token with the literal length in the
+// high nibble and the match length minus 4 in the low one (15 means more length bytes follow,
+// each adding up to 255), the literals, then a 16 bit offset back to the match. The stream
+// ends with a sequence of only literals.
+const u32 kMinMatch = 4;
+const u32 kHashBits = 14;
+const u32 kMaxOffset = 65535;
+
+static void writeLength(vector<u8> &out, u64 length) {
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back(u8(length));
+}
+
+static void writeSequence(vector<u8> &out, const u8 *literals, u64 numLiterals, u32 offset, u64 matchLength) {
+    u64 match = matchLength ? matchLength - kMinMatch : 0;
+    out.push_back(u8((std::min<u64>(numLiterals, 15) << 4) | std::min<u64>(match, 15)));
+    if (numLiterals >= 15) writeLength(out, numLiterals - 15);
+    out.insert(out.end(), literals, literals + numLiterals);
+    if (!matchLength) return;
+    out.push_back(u8(offset));
+    out.push_back(u8(offset >> 8));
+    if (match >= 15) writeLength(out, match - 15);
+}
+
+static void lzCompress(const u8 *in, u64 size, vector<u8> &out) {
+    vector<u32> table(1 << kHashBits, 0xFFFFFFFF);
+    u64 anchor = 0, pos = 0;
+    while (pos + kMinMatch <= size) {
+        u32 sequence = load32(in + pos);
+        u32 hash = (sequence * 2654435761u) >> (32 - kHashBits);
+        u32 candidate = table[hash];
+        table[hash] = u32(pos);
+        if (candidate == 0xFFFFFFFF || pos - candidate > kMaxOffset || load32(in + candidate) != sequence) {
+            pos++;
+            continue;
+        }
+        u64 length = kMinMatch;
+        while (pos + length < size && in[candidate + length] == in[pos + length]) length++;
+        writeSequence(out, in + anchor, pos - anchor, u32(pos - candidate), length);
+        pos += length;
+        anchor = pos;
+    }
+    writeSequence(out, in + anchor, size - anchor, 0, 0);
+}
+
+static bool readLength(const u8 *&ip, const u8 *end, u64 &length) {
+    u8 byte;
+    do {
+        if (ip >= end) return false;
+        byte = *ip++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+static bool lzDecompress(const u8 *in, u64 size, u8 *out, u64 outSize) {
+    const u8 *ip = in, *end = in + size;
+    u8 *op = out, *outEnd = out + outSize;
+    while (ip < end) {
+        u32 token = *ip++;
+        u64 numLiterals = token >> 4;
+        if (numLiterals == 15 && !readLength(ip, end, numLiterals)) return false;
+        if (numLiterals > u64(end - ip) || numLiterals > u64(outEnd - op)) return false;
+        if (numLiterals <= 16 && end - ip >= 16 && outEnd - op >= 16) {
+            memcpy(op, ip, 16); // a fixed size copy is much faster, the extra bytes get overwritten
+        } else {
+            memcpy(op, ip, numLiterals);
+        }
+        op += numLiterals;
+        ip += numLiterals;
+        if (ip == end) break; // the last sequence has no match
+
+        if (end - ip < 2) return false;
+        u32 offset = ip[0] | u32(ip[1]) << 8;
+        ip += 2;
+        u64 length = token & 15;
+        if (length == 15 && !readLength(ip, end, length)) return false;
+        length += kMinMatch;
+        if (offset == 0 || offset > u64(op - out) || length > u64(outEnd - op)) return false;
+        const u8 *match = op - offset;
+        if (offset >= 16 && length <= 16 && outEnd - op >= 16) {
+            memcpy(op, match, 16);
+        } else if (offset >= length) {
+            memcpy(op, match, length);
+        } else if (offset == 1) {
+            memset(op, *match, length); // runs of zeros in the high byte planes
+        } else {
+            // The match overlaps what it writes, repeating the last offset bytes. Everything from
+            // match up to where the copy has got to repeats too, so copy that much at a time.
+            u8 *to = op;
+            for (u64 left = length; left;) {
+                u64 chunk = std::min<u64>(u64(to - match), left);
+                memcpy(to, match, chunk);
+                to += chunk;
+                left -= chunk;
+            }
+        }
+        op += length;
+    }
+    return op == outEnd;
+}
+
+// ------------------ End LZ -------------------
+
+// ------------------ Begin Blocks -------------------
+
+static void writeBlocks(const vector<vector<u8>> &blocks, vector<u8> &out) {
+    out.clear();
+    u32 numBlocks = u32(blocks.size());
+    out.resize(sizeof(u32) + numBlocks * sizeof(u64));
+    memcpy(out.data(), &numBlocks, sizeof(u32));
+    u64 end = 0;
+    for (u32 c = 0; c < numBlocks; c++) {
+        end += blocks[c].size();
+        memcpy(&out[sizeof(u32) + c * sizeof(u64)], &end, sizeof(u64));
+    }
+    for (const vector<u8> &block : blocks) {
+        out.insert(out.end(), block.begin(), block.end());
+    }
+}
+
+// Compresses the rearranged bytes of one block, or keeps them as they are if that's smaller.
+static void packBlock(const vector<u8> &bytes, vector<u8> &block) {
+    block.assign(1 + sizeof(u32), 0);
+    u32 size = u32(bytes.size());
+    memcpy(&block[1], &size, sizeof(u32));
+    vector<u8> compressed;
+    lzCompress(bytes.data(), bytes.size(), compressed);
+    if (compressed.size() < bytes.size()) {
+        block[0] = kCompressed;
+        block.insert(block.end(), compressed.begin(), compressed.end());
+    } else {
+        block[0] = kStored;
+        block.insert(block.end(), bytes.begin(), bytes.end());
+    }
+}
+
+// Calls unpack(block, bytes, size) with each block's rearranged bytes, in parallel.
+template <typename Unpack>
+static bool readBlocks(const u8 *data, u64 size, u32 expectedBlocks, const Unpack &unpack) {
+    if (size < sizeof(u32)) return false;
+    u32 numBlocks = load32(data);
+    u64 tableSize = sizeof(u32) + u64(numBlocks) * sizeof(u64);
+    if (numBlocks != expectedBlocks || size < tableSize) return false;
+    const u8 *blocks = data + tableSize;
+    u64 blocksSize = size - tableSize;
+
+    atomic<bool> valid(true);
+    parallelFor(numBlocks, hardwareThreads(), [&](u32 c) {
+        u64 start = 0, end;
+        if (c > 0) memcpy(&start, data + sizeof(u32) + (c - 1) * sizeof(u64), sizeof(u64));
+        memcpy(&end, data + sizeof(u32) + c * sizeof(u64), sizeof(u64));
+        if (start > end || end > blocksSize || end - start < 1 + sizeof(u32)) {
+            valid = false;
+            return;
+        }
+        const u8 *block = blocks + start;
+        u32 rawSize = load32(block + 1);
+        const u8 *payload = block + 1 + sizeof(u32);
+        u64 payloadSize = end - start - 1 - sizeof(u32);
+        if (block[0] == kStored) {
+            if (payloadSize != rawSize || !unpack(c, payload, rawSize)) valid = false;
+            return;
+        }
+        unique_ptr<u8[]> bytes(new u8[rawSize]); // not a vector, which would clear it first
+        if (block[0] != kCompressed || !lzDecompress(payload, payloadSize, bytes.get(), rawSize) ||
+            !unpack(c, bytes.get(), rawSize)) {
+            valid = false;
+        }
+    });
+    return valid;
+}
+
+static u32 numBlocksFor(u32 count, u32 blockSize) {
+    return (count + blockSize - 1) / blockSize;
+}
+
+// ------------------ End Blocks -------------------
+
+// ------------------ Begin Vertices -------------------
+
+// Byte b of lane l of vertex i goes to out[(l * sizeof(T) + b) * numVerts + i].
+template <typename T>
+static void encodeLanes(const u8 *verts, u32 numVerts, u32 stride, u8 *out) {
+    typedef typename make_signed<T>::type S;
+    const u32 numLanes = stride / sizeof(T);
+    for (u32 lane = 0; lane < numLanes; lane++) {
+        u8 *planes[sizeof(T)];
+        for (u32 b = 0; b < sizeof(T); b++) {
+            planes[b] = out + (u64(lane) * sizeof(T) + b) * numVerts;
+        }
+        T previous = 0;
+        const u8 *in = verts + lane * sizeof(T);
+        for (u32 c = 0; c < numVerts; c++, in += stride) {
+            T value;
+            memcpy(&value, in, sizeof(T));
+            T delta = T(value - previous);
+            T zigzag = T(T(delta << 1) ^ T(S(delta) >> (sizeof(T) * 8 - 1)));
+            for (u32 b = 0; b < sizeof(T); b++) {
+                planes[b][c] = u8(zigzag >> (b * 8));
+            }
+            previous = value;
+        }
+    }
+}
+
+template <typename T>
+static void decodeLanes(const u8 *in, u32 numVerts, u32 stride, u8 *verts) {
+    const u32 numLanes = stride / sizeof(T);
+    for (u32 lane = 0; lane < numLanes; lane++) {
+        const u8 *planes[sizeof(T)];
+        for (u32 b = 0; b < sizeof(T); b++) {
+            planes[b] = in + (u64(lane) * sizeof(T) + b) * numVerts;
+        }
+        T value = 0;
+        u8 *out = verts + lane * sizeof(T);
+        for (u32 c = 0; c < numVerts; c++, out += stride) {
+            T zigzag = planes[0][c];
+            for (u32 b = 1; b < sizeof(T); b++) {
+                zigzag |= T(T(planes[b][c]) << (b * 8));
+            }
+            value = T(value + T(T(zigzag >> 1) ^ T(0 - (zigzag & 1))));
+            memcpy(out, &value, sizeof(T));
+        }
+    }
+}
+
+void encodeVertices(const void *verts, u32 numVerts, u32 stride, u32 laneSize, vector<u8> &out) {
+    u32 numBlocks = numBlocksFor(numVerts, kVertexBlock);
+    vector<vector<u8>> blocks(numBlocks);
+    parallelFor(numBlocks, hardwareThreads(), [&](u32 c) {
+        u32 first = c * kVertexBlock, count = std::min(kVertexBlock, numVerts - first);
+        const u8 *in = (const u8 *) verts + u64(first) * stride;
+        vector<u8> bytes(u64(count) * stride);
+        if (laneSize == 2) {
+            encodeLanes<u16>(in, count, stride, bytes.data());
+        } else {
+            encodeLanes<u32>(in, count, stride, bytes.data());
+        }
+        packBlock(bytes, blocks[c]);
+    });
+    writeBlocks(blocks, out);
+}
+
+bool decodeVertices(const u8 *data, u64 size, void *verts, u32 numVerts, u32 stride, u32 laneSize) {
+    return readBlocks(data, size, numBlocksFor(numVerts, kVertexBlock), [&](u32 c, const u8 *bytes, u32 numBytes) {
+        u32 first = c * kVertexBlock, count = std::min(kVertexBlock, numVerts - first);
+        if (numBytes != u64(count) * stride) return false;
+        u8 *out = (u8 *) verts + u64(first) * stride;
+        if (laneSize == 2) {
+            decodeLanes<u16>(bytes, count, stride, out);
+        } else {
+            decodeLanes<u32>(bytes, count, stride, out);
+        }
+        return true;
+    });
+}
+
+// ------------------ End Vertices -------------------
+
+// ------------------ Begin Indices -------------------
+
+const u32 kFifoSize = 16;
+const u32 kNoVertex = 0xFFFFFFFF;
+
+// Codes for a vertex.
+const u8 kNextVertex = 0;                 // the next vertex never seen before
+const u8 kCachedVertex = 1;               // 1 + slot of one of the last new vertices
+const u8 kExplicitVertex = 1 + kFifoSize; // followed by the zigzagged difference from the last new vertex
+// A triangle that starts with a higher byte shares an edge with an earlier one. The byte is
+// kSharedEdge + (slot * 3 + rotation) * 4 + third, where slot picks the edge in the edge FIFO,
+// rotation is the corner it starts at and third codes the vertex opposite it: the next new
+// vertex, the first or second slot of the vertex FIFO, or kThirdFollows for any other vertex,
+// whose code follows. Otherwise the byte is the code of the triangle's first vertex, followed by
+// the codes of the other two.
+const u8 kSharedEdge = kExplicitVertex + 1;
+const u8 kThirdFollows = 3;
+
+// The state the encoder and decoder keep in step. Slot 0 of each FIFO is the newest entry.
+struct IndexState {
+    u32 edges[kFifoSize][2];
+    u32 edgeHead;
+    u32 verts[kFifoSize];
+    u32 vertHead;
+    u32 next;
+    u32 last;
+};
+
+static void resetState(IndexState &state) {
+    for (u32 c = 0; c < kFifoSize; c++) {
+        state.edges[c][0] = state.edges[c][1] = kNoVertex;
+        state.verts[c] = kNoVertex;
+    }
+    state.edgeHead = state.vertHead = 0;
+    state.next = state.last = 0;
+}
+
+static inline void pushEdge(IndexState &state, u32 a, u32 b) {
+    u32 slot = state.edgeHead++ % kFifoSize;
+    state.edges[slot][0] = a;
+    state.edges[slot][1] = b;
+}
+
+static inline const u32 *edgeAt(const IndexState &state, u32 slot) {
+    return state.edges[(state.edgeHead - 1 - slot) % kFifoSize];
+}
+
+static inline void pushVertex(IndexState &state, u32 v) {
+    state.verts[state.vertHead++ % kFifoSize] = v;
+    state.last = v;
+    if (v >= state.next) state.next = v + 1;
+}
+
+static inline u32 vertexAt(const IndexState &state, u32 slot) {
+    return state.verts[(state.vertHead - 1 - slot) % kFifoSize];
+}
+
+static void encodeVertex(IndexState &state, u32 v, vector<u8> &out) {
+    if (v == state.next) {
+        out.push_back(kNextVertex);
+        pushVertex(state, v);
+        return;
+    }
+    for (u32 slot = 0; slot < kFifoSize; slot++) {
+        if (vertexAt(state, slot) == v) {
+            out.push_back(u8(kCachedVertex + slot));
+            return;
+        }
+    }
+    out.push_back(kExplicitVertex);
+    u32 delta = v - state.last;
+    u32 zigzag = (delta << 1) ^ u32(s32(delta) >> 31);
+    while (zigzag >= 0x80) {
+        out.push_back(u8(zigzag | 0x80));
+        zigzag >>= 7;
+    }
+    out.push_back(u8(zigzag));
+    pushVertex(state, v);
+}
+
+static inline bool decodeVertex(IndexState &state, u8 code, const u8 *&ip, const u8 *end, u32 &v) {
+    if (code == kNextVertex) {
+        v = state.next;
+    } else if (code < kExplicitVertex) {
+        v = vertexAt(state, code - kCachedVertex);
+        return v != kNoVertex;
+    } else if (code == kExplicitVertex) {
+        u32 zigzag = 0;
+        for (u32 shift = 0;; shift += 7) {
+            if (ip >= end || shift > 28) return false;
+            u8 byte = *ip++;
+            zigzag |= u32(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        v = state.last + ((zigzag >> 1) ^ (0 - (zigzag & 1)));
+    } else {
+        return false;
+    }
+    pushVertex(state, v);
+    return true;
+}
+
+static inline u32 readIndex(const void *indices, u32 indexSize, u32 c) {
+    return indexSize == 2 ? ((const u16 *) indices)[c] : ((const u32 *) indices)[c];
+}
+
+static void encodeIndexBlock(const void *indices, u32 first, u32 count, u32 indexSize, vector<u8> &out) {
+    IndexState state;
+    resetState(state);
+    u32 numTriangleIndices = count - count % 3;
+    for (u32 c = first; c < first + numTriangleIndices; c += 3) {
+        u32 tri[3] = { readIndex(indices, indexSize, c), readIndex(indices, indexSize, c + 1),
+                       readIndex(indices, indexSize, c + 2) };
+        bool shared = false;
+        for (u32 slot = 0; slot < kFifoSize && !shared; slot++) {
+            const u32 *edge = edgeAt(state, slot);
+            for (u32 rotation = 0; rotation < 3; rotation++) {
+                u32 x = tri[rotation], y = tri[(rotation + 1) % 3], z = tri[(rotation + 2) % 3];
+                if (edge[0] != x || edge[1] != y) continue;
+                u32 third = z == state.next ? 0 : z == vertexAt(state, 0) ? 1 : z == vertexAt(state, 1) ? 2 : kThirdFollows;
+                out.push_back(u8(kSharedEdge + (slot * 3 + rotation) * 4 + third));
+                if (third == 0) {
+                    pushVertex(state, z);
+                } else if (third == kThirdFollows) {
+                    encodeVertex(state, z, out);
+                }
+                pushEdge(state, z, y);
+                pushEdge(state, x, z);
+                shared = true;
+                break;
+            }
+        }
+        if (shared) continue;
+        encodeVertex(state, tri[0], out);
+        encodeVertex(state, tri[1], out);
+        encodeVertex(state, tri[2], out);
+        pushEdge(state, tri[1], tri[0]);
+        pushEdge(state, tri[2], tri[1]);
+        pushEdge(state, tri[0], tri[2]);
+    }
+    for (u32 c = first + numTriangleIndices; c < first + count; c++) {
+        encodeVertex(state, readIndex(indices, indexSize, c), out);
+    }
+}
+
+template <typename T>
+static bool decodeIndexBlock(const u8 *in, u32 size, T *out, u32 count) {
+    IndexState state;
+    resetState(state);
+    const u8 *ip = in, *end = in + size;
+    u32 numTriangleIndices = count - count % 3;
+    for (u32 c = 0; c < numTriangleIndices; c += 3) {
+        if (ip >= end) return false;
+        u8 code = *ip++;
+        u32 tri[3];
+        if (code >= kSharedEdge) {
+            u32 edgeCode = (code - kSharedEdge) >> 2, third = (code - kSharedEdge) & 3;
+            u32 slot = edgeCode / 3, rotation = edgeCode % 3;
+            if (slot >= kFifoSize) return false;
+            const u32 *edge = edgeAt(state, slot);
+            u32 x = edge[0], y = edge[1], z;
+            if (x == kNoVertex) return false;
+            if (third == 0) {
+                z = state.next;
+                pushVertex(state, z);
+            } else if (third < kThirdFollows) {
+                z = vertexAt(state, third - 1);
+                if (z == kNoVertex) return false;
+            } else if (ip >= end || !decodeVertex(state, *ip++, ip, end, z)) {
+                return false;
+            }
+            tri[rotation] = x;
+            tri[(rotation + 1) % 3] = y;
+            tri[(rotation + 2) % 3] = z;
+            pushEdge(state, z, y);
+            pushEdge(state, x, z);
+        } else {
+            if (!decodeVertex(state, code, ip, end, tri[0])) return false;
+            if (ip >= end || !decodeVertex(state, *ip++, ip, end, tri[1])) return false;
+            if (ip >= end || !decodeVertex(state, *ip++, ip, end, tri[2])) return false;
+            pushEdge(state, tri[1], tri[0]);
+            pushEdge(state, tri[2], tri[1]);
+            pushEdge(state, tri[0], tri[2]);
+        }
+        out[c] = T(tri[0]);
+        out[c + 1] = T(tri[1]);
+        out[c + 2] = T(tri[2]);
+    }
+    for (u32 c = numTriangleIndices; c < count; c++) {
+        u32 v;
+        if (ip >= end || !decodeVertex(state, *ip++, ip, end, v)) return false;
+        out[c] = T(v);
+    }
+    return ip == end;
+}
+
+void encodeIndices(const void *indices, u32 numIndices, u32 indexSize, vector<u8> &out) {
+    u32 numBlocks = numBlocksFor(numIndices, kIndexBlock);
+    vector<vector<u8>> blocks(numBlocks);
+    parallelFor(numBlocks, hardwareThreads(), [&](u32 c) {
+        u32 first = c * kIndexBlock, count = std::min(kIndexBlock, numIndices - first);
+        vector<u8> bytes;
+        encodeIndexBlock(indices, first, count, indexSize, bytes);
+        packBlock(bytes, blocks[c]);
+    });
+    writeBlocks(blocks, out);
+}
+
+bool decodeIndices(const u8 *data, u64 size, void *indices, u32 numIndices, u32 indexSize) {
+    return readBlocks(data, size, numBlocksFor(numIndices, kIndexBlock), [&](u32 c, const u8 *bytes, u32 numBytes) {
+        u32 first = c * kIndexBlock, count = std::min(kIndexBlock, numIndices - first);
+        if (indexSize == 2) {
+            return decodeIndexBlock(bytes, numBytes, (u16 *) indices + first, count);
+        }
+        return decodeIndexBlock(bytes, numBytes, (u32 *) indices + first, count);
+    });
+}
+
+// ------------------ End Indices -------------------
@@ -0,0 +1,34 @@
+#ifndef SPONZA_MESHCODEC_H
+#define SPONZA_MESHCODEC_H
+
+#include <vector>
+#include "types.h"
+
+// Compression for the vertex and index buffers in mesh files (see meshcache.h). Each stream is
+// cut into blocks that are coded independently, so they decode in parallel, straight into a
+// mapped GL buffer. Every block is first rearranged so that similar bytes line up, then packed
+// with a byte oriented LZ77 that decodes with little more than memcpy.
+//
+// Vertices are coded lane by lane, a lane being one 16 or 32 bit field of the vertex. Each lane
+// is stored as the zigzagged difference from the previous vertex, with the bytes of all those
+// differences in separate planes, so the mostly zero high bytes end up in long runs.
+//
+// Indices are coded a triangle at a time. A triangle that shares an edge with one of the last
+// 16 triangles names that edge and codes only its third vertex. A vertex is coded as the next
+// unused one, as one of the last 16 new vertices, or as a difference from the last new one.
+// After the vertex cache and fetch optimizations in obj2mesh, most triangles continue a strip or
+// fan and take a single byte.
+// Triangle order and the order of the corners within each triangle are kept exactly.
+
+// Codes numVerts records of stride bytes, made of lanes of laneSize bytes (2 or 4).
+void encodeVertices(const void *verts, u32 numVerts, u32 stride, u32 laneSize, std::vector<u8> &out);
+// Decodes what encodeVertices wrote for the same numVerts, stride and laneSize. False if it's corrupt.
+bool decodeVertices(const u8 *data, u64 size, void *verts, u32 numVerts, u32 stride, u32 laneSize);
+
+// Codes numIndices indices of indexSize bytes (2 or 4). Any indices after the last whole
+// triangle are coded on their own.
+void encodeIndices(const void *indices, u32 numIndices, u32 indexSize, std::vector<u8> &out);
+// Decodes what encodeIndices wrote for the same numIndices and indexSize. False if it's corrupt.
+bool decodeIndices(const u8 *data, u64 size, void *indices, u32 numIndices, u32 indexSize);
+
+#endif //SPONZA_MESHCODEC_H
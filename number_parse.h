@@ -0,0 +1,176 @@
+#ifndef SPONZA_NUMBER_PARSE_H
+#define SPONZA_NUMBER_PARSE_H
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "types.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define NUMBER_PARSE_SSE2
+#endif
+
+// Number parsing kernels for OBJ's number grammar: [+-]digits[.digits][(e|E)[+-]digits].
+// Anything outside of that grammar (inf, nan, hex floats, 20+ digit mantissas) falls back
+// to strtof, so results are always bit-exact with strtof.
+
+// Returns the number of consecutive decimal digits starting at pos.
+inline u32 countDigits(const char *pos, const char *end) {
+    const char *start = pos;
+#ifdef NUMBER_PARSE_SSE2
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+    while (end - pos >= 16) {
+        __m128i values = _mm_sub_epi8(_mm_loadu_si128((const __m128i *) pos), zero);
+        // unsigned min(x, 9) == x only for the bytes that were '0'-'9'
+        __m128i digits = _mm_cmpeq_epi8(_mm_min_epu8(values, nine), values);
+        u32 others = ~u32(_mm_movemask_epi8(digits)) & 0xFFFF;
+        if (others) {
+            return u32(pos - start) + __builtin_ctz(others);
+        }
+        pos += 16;
+    }
+#endif
+    while (pos < end && u8(*pos - '0') < 10) pos++;
+    return u32(pos - start);
+}
+
+// Converts count (at most 8) digits to an integer. The 8 bytes at pos must be readable.
+inline u32 convertDigitsSwar(const char *pos, u32 count) {
+    u64 value;
+    memcpy(&value, pos, sizeof(value));
+    value -= 0x3030303030303030ULL;
+    // shift out the bytes past the end, which leaves zeros (leading zero digits) in their place
+    value <<= 8 * (8 - count);
+    value = (value * 10) + (value >> 8);
+    value = (((value & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+             (((value >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return u32(value);
+}
+
+// Appends count digits to value. The caller must make sure the result fits in a u64.
+inline u64 accumulateDigits(u64 value, const char *pos, u32 count, const char *end) {
+    static const u32 pow10[9] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+#ifdef NUMBER_PARSE_SSE2
+    while (count > 0 && end - pos >= 8) {
+        u32 n = count < 8 ? count : 8;
+        value = value * pow10[n] + convertDigitsSwar(pos, n);
+        pos += n;
+        count -= n;
+    }
+#endif
+    for (; count > 0; count--, pos++) {
+        value = value * 10 + u32(*pos - '0');
+    }
+    return value;
+}
+
+inline bool parseFloatFast(const char *&pos, const char *end, f32 &value) {
+    static const f32 pow10f[11] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+    static const f64 pow10[23] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char *p = pos;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    const char *intStart = p;
+    u32 intDigits = countDigits(p, end);
+    p += intDigits;
+    const char *fracStart = p;
+    u32 fracDigits = 0;
+    if (p < end && *p == '.') {
+        fracStart = ++p;
+        fracDigits = countDigits(p, end);
+        p += fracDigits;
+    }
+    // 19 digits always fit in a u64
+    if (intDigits + fracDigits == 0 || intDigits + fracDigits > 19) return false;
+
+    s32 exponent = 0;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *e = p + 1;
+        bool negativeExp = false;
+        if (e < end && (*e == '-' || *e == '+')) {
+            negativeExp = *e == '-';
+            e++;
+        }
+        u32 expDigits = countDigits(e, end);
+        if (expDigits == 0 || expDigits > 4) return false;
+        exponent = s32(accumulateDigits(0, e, expDigits, end));
+        if (negativeExp) exponent = -exponent;
+        p = e + expDigits;
+    }
+    exponent -= s32(fracDigits);
+
+    u64 mantissa = accumulateDigits(0, intStart, intDigits, end);
+    mantissa = accumulateDigits(mantissa, fracStart, fracDigits, end);
+    if (mantissa == 0) {
+        value = negative ? -0.f : 0.f;
+        pos = p;
+        return true;
+    }
+
+    // When both the mantissa and the power of ten are exact floats, one float
+    // multiply or divide gives the correctly rounded result (Clinger's fast path).
+    if (mantissa <= (1ULL << 24) && exponent >= -10 && exponent <= 10) {
+        f32 f = exponent < 0 ? f32(mantissa) / pow10f[-exponent] : f32(mantissa) * pow10f[exponent];
+        value = negative ? -f : f;
+        pos = p;
+        return true;
+    }
+
+    // The same goes for doubles, which cover mantissas up to 2^53.
+    if (mantissa > (1ULL << 53) || exponent < -22 || exponent > 22) return false;
+    f64 d = exponent < 0 ? f64(mantissa) / pow10[-exponent] : f64(mantissa) * pow10[exponent];
+
+    // But rounding that double to float is only wrong when it lands exactly halfway
+    // between two floats, since every such midpoint is itself a double.
+    f32 f = f32(d);
+    if (f64(f) != d) {
+        f32 other = nextafterf(f, f64(f) < d ? INFINITY : -INFINITY);
+        if ((f64(f) + f64(other)) * 0.5 == d) return false;
+    }
+
+    value = negative ? -f : f;
+    pos = p;
+    return true;
+}
+
+// Parses all of [pos, end) as a float, with the same result as strtof on a terminated copy.
+inline f32 parseFloat(const char *pos, const char *end) {
+    f32 value;
+    const char *p = pos;
+    if (parseFloatFast(p, end, value) && p == end) {
+        return value;
+    }
+
+    // strtof needs a terminator, and the mapped file doesn't have one.
+    char buffer[64];
+    size_t len = size_t(end - pos) < sizeof(buffer) - 1 ? size_t(end - pos) : sizeof(buffer) - 1;
+    memcpy(buffer, pos, len);
+    buffer[len] = '\0';
+    return strtof(buffer, nullptr);
+}
+
+// Parses a signed integer, stopping at the first non-digit.
+// Returns 0 if there are no digits or the value doesn't fit in 9 digits.
+inline s32 parseInt(const char *&pos, const char *end) {
+    bool negative = false;
+    if (pos < end && (*pos == '-' || *pos == '+')) {
+        negative = *pos == '-';
+        pos++;
+    }
+    u32 digits = countDigits(pos, end);
+    s32 value = digits <= 9 ? s32(accumulateDigits(0, pos, digits, end)) : 0;
+    pos += digits;
+    return negative ? -value : value;
+}
+
+#endif //SPONZA_NUMBER_PARSE_H
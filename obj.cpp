@@ -3,9 +3,16 @@
 //
 
 #include "obj.h"
+#include "mapped_file.h"
+#include "number_parse.h"
+#include "parallel.h"
 
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <sstream>
+#include <unordered_map>
 
 using namespace std;
 using namespace glm;
@@ -19,7 +26,7 @@ void trimString(string &str) {
     str.erase(location + 1);
 }
 
-u32 findMaterialIndex(vector<OBJMaterial> materials, string name) {
+u32 findMaterialIndex(const vector<OBJMaterial> &materials, const string &name) {
     for (u32 c = 0, n = materials.size(); c < n; c++) {
         if (materials[c].name == name) {
             return c;
@@ -55,6 +62,7 @@ bool loadMaterials(const string &filename, OBJMesh &mesh) {
         printf("Failed to open material file: %s\n", filename.c_str());
         return false;
     }
+    mesh.materialLibraries.push_back(filename);
 
     OBJMaterial *current = nullptr;
 
@@ -177,7 +185,132 @@ bool loadMaterials(const string &filename, OBJMesh &mesh) {
     return true;
 }
 
-bool loadObjFile(const string &cwd, const string &filename, OBJMesh &mesh) {
+void addFace(OBJMesh &mesh, const vector<vec3> &points, const vector<vec3> &normals,
+             const vector<vec2> &texCoords, const vector<ivec3> &face) {
+    if (face.size() < 3) {
+        printf("Warning: Skipping face with %zu vertices\n", face.size());
+        return;
+    }
+    ivec3 v0 = face[0];
+    ivec3 v1 = face[1];
+    ivec3 v2 = face[2];
+    u32 baseIndex = mesh.verts.size();
+    // First face
+    mesh.indices.push_back(baseIndex);
+    mesh.verts.push_back(OBJVertex { points[v0.x], normals[v0.z], texCoords[v0.y] });
+    mesh.indices.push_back(mesh.verts.size());
+    mesh.verts.push_back(OBJVertex { points[v1.x], normals[v1.z], texCoords[v1.y] });
+    mesh.indices.push_back(mesh.verts.size());
+    mesh.verts.push_back(OBJVertex { points[v2.x], normals[v2.z], texCoords[v2.y] });
+    // If number of edges in face is greater than 3,
+    // decompose into triangles as a triangle fan.
+    for (u32 i = 3; i < face.size(); i++) {
+        v1 = v2;
+        v2 = face[i];
+        mesh.indices.push_back(baseIndex);
+        mesh.indices.push_back(mesh.verts.size()-1);
+        mesh.indices.push_back(mesh.verts.size());
+        mesh.verts.push_back(OBJVertex { points[v2.x], normals[v2.z], texCoords[v2.y] });
+    }
+}
+
+// Ends the current mesh part at indexCount and starts one with the given material and object.
+// If the current part has no faces yet, it's reused.
+void switchPart(OBJMesh &mesh, u32 indexCount, u32 materialIndex, u32 objectIndex) {
+    OBJMeshPart *current = &mesh.meshParts.back();
+    if (indexCount != current->indexOffset) {
+        current->indexSize = indexCount - current->indexOffset;
+        mesh.meshParts.push_back(OBJMeshPart { 0, indexCount, 0, 0 });
+        current = &mesh.meshParts.back();
+    }
+    current->materialIndex = materialIndex;
+    current->objectIndex = objectIndex;
+}
+
+// Finds the object for a g or o line, adding it the first time the name is seen.
+u32 findObjectIndex(OBJMesh &mesh, unordered_map<string, u32> &objectNames, const string &name) {
+    const string &key = name.empty() ? string("default") : name;
+    auto found = objectNames.find(key);
+    if (found != objectNames.end()) {
+        return found->second;
+    }
+    u32 index = u32(mesh.objects.size());
+    mesh.objects.push_back(OBJObject { key, emptyBounds() });
+    objectNames[key] = index;
+    return index;
+}
+
+// Computes the bounds of every object from the triangles in its parts, then drops the
+// objects and parts that ended up without any faces.
+void finishObjects(OBJMesh &mesh, u32 numThreads) {
+    u32 numParts = u32(mesh.meshParts.size());
+    vector<Bounds> partBounds(numParts);
+    parallelFor(numParts, numThreads, [&](u32 c) {
+        const OBJMeshPart &part = mesh.meshParts[c];
+        Bounds &bounds = partBounds[c] = emptyBounds();
+        for (u32 i = part.indexOffset, n = part.indexOffset + part.indexSize; i < n; i++) {
+            addPoint(bounds, mesh.verts[mesh.indices[i]].position);
+        }
+    });
+
+    for (OBJObject &object : mesh.objects) {
+        object.bounds = emptyBounds();
+    }
+    for (u32 c = 0; c < numParts; c++) {
+        addBox(mesh.objects[mesh.meshParts[c].objectIndex].bounds, partBounds[c]);
+    }
+    for (OBJObject &object : mesh.objects) {
+        centerBounds(object.bounds);
+    }
+
+    // The sphere needs the final center, so this takes a second pass over the triangles.
+    parallelFor(numParts, numThreads, [&](u32 c) {
+        const OBJMeshPart &part = mesh.meshParts[c];
+        Bounds &bounds = partBounds[c];
+        bounds.center = mesh.objects[part.objectIndex].bounds.center;
+        bounds.radius = 0;
+        for (u32 i = part.indexOffset, n = part.indexOffset + part.indexSize; i < n; i++) {
+            addSpherePoint(bounds, mesh.verts[mesh.indices[i]].position);
+        }
+    });
+    for (u32 c = 0; c < numParts; c++) {
+        Bounds &bounds = mesh.objects[mesh.meshParts[c].objectIndex].bounds;
+        if (!isEmpty(bounds)) {
+            bounds.radius = std::max(bounds.radius, partBounds[c].radius);
+        }
+    }
+
+    vector<u32> remap(mesh.objects.size());
+    u32 numObjects = 0;
+    for (u32 c = 0, n = u32(mesh.objects.size()); c < n; c++) {
+        remap[c] = numObjects;
+        if (!isEmpty(mesh.objects[c].bounds)) {
+            mesh.objects[numObjects++] = std::move(mesh.objects[c]);
+        }
+    }
+    mesh.objects.resize(numObjects);
+
+    u32 keptParts = 0;
+    for (u32 c = 0; c < numParts; c++) {
+        OBJMeshPart part = mesh.meshParts[c];
+        if (part.indexSize != 0) {
+            part.objectIndex = remap[part.objectIndex];
+            mesh.meshParts[keptParts++] = part;
+        }
+    }
+    mesh.meshParts.resize(keptParts);
+}
+
+bool loadObjFileMapped(const string &cwd, const string &filename, OBJMesh &mesh, u32 numThreads, bool weld);
+
+bool loadObjFile(const string &cwd, const string &filename, OBJMesh &mesh, OBJLoadFlags flags) {
+    if (flags & OBJ_LOAD_THREADED) {
+        return loadObjFileMapped(cwd, filename, mesh, hardwareThreads(), (flags & OBJ_LOAD_WELD) != 0);
+    }
+    if (flags & OBJ_LOAD_MAPPED) {
+        return loadObjFileMapped(cwd, filename, mesh, 1, (flags & OBJ_LOAD_WELD) != 0);
+    }
+
     string pathname = cwd + '/' + filename;
     ifstream objStream(pathname);
     if (!objStream) {
@@ -196,8 +329,8 @@ bool loadObjFile(const string &cwd, const string &filename, OBJMesh &mesh) {
     vector<ivec3> face;
 
     // init the first mesh part
-    mesh.meshParts.push_back(OBJMeshPart { 0, u32(mesh.indices.size()), 0 });
-    OBJMeshPart *current = &mesh.meshParts.back();
+    unordered_map<string, u32> objectNames;
+    mesh.meshParts.push_back(OBJMeshPart { 0, u32(mesh.indices.size()), 0, findObjectIndex(mesh, objectNames, "") });
     string currentMtl;
 
     getline(objStream, line);
@@ -217,22 +350,21 @@ bool loadObjFile(const string &cwd, const string &filename, OBJMesh &mesh) {
                 if (!success) {
                     printf("Warning: failed to load material library %s\n", matfile.c_str());
                 }
-            } else if (token == "g") {
-//                string group;
-//                lineStream >> group;
-//                printf("Starting group %s\n", group.c_str());
+            } else if (token == "g" || token == "o") {
+                string name;
+                lineStream >> name;
+                u32 object = findObjectIndex(mesh, objectNames, name);
+                const OBJMeshPart &current = mesh.meshParts.back();
+                if (object != current.objectIndex) {
+                    switchPart(mesh, u32(mesh.indices.size()), current.materialIndex, object);
+                }
             } else if (token == "usemtl") {
                 string mtl;
                 lineStream >> mtl;
                 if (mtl != currentMtl) {
                     // new mesh part
-                    u32 indexCount = u32(mesh.indices.size());
-                    if (indexCount != current->indexOffset) {
-                        current->indexSize = indexCount - current->indexOffset;
-                        mesh.meshParts.push_back(OBJMeshPart {0, indexCount, 0});
-                        current = &mesh.meshParts.back();
-                    }
-                    current->materialIndex = findMaterialIndex(mesh.materials, mtl);
+                    switchPart(mesh, u32(mesh.indices.size()), findMaterialIndex(mesh.materials, mtl),
+                               mesh.meshParts.back().objectIndex);
 //                    printf("Switching material: %s\n", mtl.c_str());
                     currentMtl = std::move(mtl);
                 }
@@ -281,36 +413,581 @@ bool loadObjFile(const string &cwd, const string &filename, OBJMesh &mesh) {
                         face.push_back(ivec3(pIndex, tcIndex, nIndex));
                     }
                 }
-                ivec3 v0 = face[0];
-                ivec3 v1 = face[1];
-                ivec3 v2 = face[2];
-                u32 baseIndex = mesh.verts.size();
-                // First face
-                mesh.indices.push_back(baseIndex);
-                mesh.verts.push_back(OBJVertex { points[v0.x], normals[v0.z], texCoords[v0.y] });
-                mesh.indices.push_back(mesh.verts.size());
-                mesh.verts.push_back(OBJVertex { points[v1.x], normals[v1.z], texCoords[v1.y] });
-                mesh.indices.push_back(mesh.verts.size());
-                mesh.verts.push_back(OBJVertex { points[v2.x], normals[v2.z], texCoords[v2.y] });
-                // If number of edges in face is greater than 3,
-                // decompose into triangles as a triangle fan.
-                for (u32 i = 3; i < face.size(); i++) {
-                    v1 = v2;
-                    v2 = face[i];
-                    mesh.indices.push_back(baseIndex);
-                    mesh.indices.push_back(mesh.verts.size()-1);
-                    mesh.indices.push_back(mesh.verts.size());
-                    mesh.verts.push_back(OBJVertex { points[v2.x], normals[v2.z], texCoords[v2.y] });
-                }
+                addFace(mesh, points, normals, texCoords, face);
             } else if (token != "s") {
                 printf("Unknown token: %s\n", token.c_str());
             }
         }
         getline(objStream, line);
     }
-    current->indexSize = mesh.indices.size() - current->indexOffset;
+    OBJMeshPart &last = mesh.meshParts.back();
+    last.indexSize = mesh.indices.size() - last.indexOffset;
+    finishObjects(mesh, 1);
 
-    printf("Loaded mesh from %s in %lums\n", filename.c_str(), (clock() - time) * 1000 / CLOCKS_PER_SEC);
+    printf("Loaded mesh from %s in %lums (%zu objects)\n", filename.c_str(),
+           (clock() - time) * 1000 / CLOCKS_PER_SEC, mesh.objects.size());
 
     return true;
 }
+
+
+// ------------------ Begin Mapped Loader -------------------
+
+// A range of characters in the mapped file. Not null terminated.
+struct Token {
+    const char *begin;
+    const char *end;
+
+    size_t length() const { return size_t(end - begin); }
+    bool empty() const { return begin == end; }
+    bool operator==(const char *str) const {
+        size_t len = strlen(str);
+        return length() == len && memcmp(begin, str, len) == 0;
+    }
+    bool operator!=(const char *str) const { return !(*this == str); }
+    string str() const { return string(begin, end); }
+};
+
+inline bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Reads the next whitespace delimited token on the line, advancing pos past it.
+inline Token readToken(const char *&pos, const char *lineEnd) {
+    while (pos < lineEnd && isSpace(*pos)) pos++;
+    const char *begin = pos;
+    while (pos < lineEnd && !isSpace(*pos)) pos++;
+    return Token { begin, pos };
+}
+
+inline f32 readFloat(const char *&pos, const char *lineEnd) {
+    Token token = readToken(pos, lineEnd);
+    return parseFloat(token.begin, token.end);
+}
+
+// Converts a 1-based (or negative, relative) OBJ index into a 0-based one.
+// Returns -1 if the index is missing or out of range.
+inline s32 resolveIndex(s32 index, u32 count) {
+    if (index > 0 && u32(index) <= count) return index - 1;
+    if (index < 0 && u32(-index) <= count) return s32(count) + index;
+    return -1;
+}
+
+enum OBJDirectiveType : u8 {
+    kUseMtl,
+    kMtlLib,
+    kObject, // g or o
+};
+
+// A line that affects how faces are split into parts, kept in file order.
+struct OBJDirective {
+    Token name;
+    u32 indexCount; // chunk-relative index count when the directive was read
+    OBJDirectiveType type;
+};
+
+// A line-aligned slice of the file, parsed independently of the others.
+struct OBJChunk {
+    const char *begin;
+    const char *end;
+
+    // attribute counts, and their prefix sums over the previous chunks
+    u32 numPoints = 0, numTexCoords = 0, numNormals = 0;
+    u32 pointBase = 0, texCoordBase = 0, normalBase = 0;
+    u32 numFaceCorners = 0, numFaceIndices = 0; // upper bounds, from countChunk
+
+    vector<ivec3> corners; // one per face corner, becomes an OBJVertex
+    vector<u32> indices;   // triangle fans, relative to the first corner of this chunk
+    vector<OBJDirective> directives;
+    u32 cornerBase = 0, indexBase = 0; // prefix sums of corners and indices
+};
+
+inline const char *findLineEnd(const char *pos, const char *end) {
+    const char *lineEnd = (const char *) memchr(pos, '\n', size_t(end - pos));
+    return lineEnd ? lineEnd : end;
+}
+
+// Splits [begin, end) into about numChunks chunks that start and end on line boundaries.
+void splitChunks(const char *begin, const char *end, u32 numChunks, vector<OBJChunk> &chunks) {
+    size_t target = size_t(end - begin) / numChunks + 1;
+    const char *pos = begin;
+    while (pos < end) {
+        const char *split = size_t(end - pos) > target ? findLineEnd(pos + target, end) : end;
+        if (split < end) split++;
+        chunks.emplace_back();
+        chunks.back().begin = pos;
+        chunks.back().end = split;
+        pos = split;
+    }
+}
+
+// Counts the attribute lines in a chunk, so that every chunk knows where its
+// attributes land in the global arrays before any of them are parsed.
+// Also counts face corners, so parseChunk can size its arrays up front.
+void countChunk(OBJChunk &chunk) {
+    const char *pos = chunk.begin;
+    while (pos < chunk.end) {
+        const char *lineEnd = findLineEnd(pos, chunk.end);
+        Token token = readToken(pos, lineEnd);
+        if (token == "v") chunk.numPoints++;
+        else if (token == "vt") chunk.numTexCoords++;
+        else if (token == "vn") chunk.numNormals++;
+        else if (token == "f") {
+            u32 faceSize = 0;
+            while (!readToken(pos, lineEnd).empty()) faceSize++;
+            chunk.numFaceCorners += faceSize;
+            if (faceSize >= 3) chunk.numFaceIndices += (faceSize - 2) * 3;
+        }
+        pos = lineEnd + 1;
+    }
+}
+
+// Parses a chunk, writing attributes straight into their final slots.
+// Faces can reference attributes from any earlier chunk, which may not be
+// parsed yet, so they are kept as index triples until every chunk is done.
+void parseChunk(OBJChunk &chunk, vec3 *points, vec2 *texCoords, vec3 *normals) {
+    u32 numPoints = chunk.pointBase;
+    u32 numTexCoords = chunk.texCoordBase;
+    u32 numNormals = chunk.normalBase;
+    chunk.corners.reserve(chunk.numFaceCorners);
+    chunk.indices.reserve(chunk.numFaceIndices);
+
+    const char *pos = chunk.begin;
+    while (pos < chunk.end) {
+        const char *lineEnd = findLineEnd(pos, chunk.end);
+
+        Token token = readToken(pos, lineEnd);
+        if (!token.empty() && token.begin[0] != '#') {
+            if (token == "v") {
+                f32 x = readFloat(pos, lineEnd);
+                f32 y = readFloat(pos, lineEnd);
+                f32 z = readFloat(pos, lineEnd);
+                points[numPoints++] = vec3(x, y, z);
+            } else if (token == "vt") {
+                f32 s = readFloat(pos, lineEnd);
+                f32 t = readFloat(pos, lineEnd);
+                texCoords[numTexCoords++] = vec2(s, 1 - t); // t is flipped in OBJ
+            } else if (token == "vn") {
+                f32 x = readFloat(pos, lineEnd);
+                f32 y = readFloat(pos, lineEnd);
+                f32 z = readFloat(pos, lineEnd);
+                normals[numNormals++] = vec3(x, y, z);
+            } else if (token == "f") {
+                u32 base = u32(chunk.corners.size());
+                for (Token vert = readToken(pos, lineEnd); !vert.empty(); vert = readToken(pos, lineEnd)) {
+                    const char *c = vert.begin;
+                    s32 pIndex = resolveIndex(parseInt(c, vert.end), numPoints);
+                    s32 tcIndex = -1, nIndex = -1;
+                    if (c < vert.end && *c == '/') {
+                        c++;
+                        tcIndex = resolveIndex(parseInt(c, vert.end), numTexCoords);
+                        if (c < vert.end && *c == '/') {
+                            c++;
+                            nIndex = resolveIndex(parseInt(c, vert.end), numNormals);
+                        }
+                    }
+                    if (pIndex == -1) {
+                        printf("Missing point index!!!");
+                    } else if (tcIndex == -1) {
+                        printf("Missing texture index!!!");
+                    } else if (nIndex == -1) {
+                        printf("Missing normal index!!!");
+                    } else {
+                        chunk.corners.push_back(ivec3(pIndex, tcIndex, nIndex));
+                    }
+                }
+                u32 faceSize = u32(chunk.corners.size()) - base;
+                if (faceSize < 3) {
+                    printf("Warning: Skipping face with %u vertices\n", faceSize);
+                    chunk.corners.resize(base);
+                }
+                // decompose into triangles as a triangle fan.
+                for (u32 i = 2; i < faceSize; i++) {
+                    chunk.indices.push_back(base);
+                    chunk.indices.push_back(base + i - 1);
+                    chunk.indices.push_back(base + i);
+                }
+            } else if (token == "usemtl") {
+                chunk.directives.push_back(OBJDirective { readToken(pos, lineEnd), u32(chunk.indices.size()), kUseMtl });
+            } else if (token == "mtllib") {
+                chunk.directives.push_back(OBJDirective { readToken(pos, lineEnd), u32(chunk.indices.size()), kMtlLib });
+            } else if (token == "g" || token == "o") {
+                chunk.directives.push_back(OBJDirective { readToken(pos, lineEnd), u32(chunk.indices.size()), kObject });
+            } else if (token != "s") {
+                printf("Unknown token: %.*s\n", int(token.length()), token.begin);
+            }
+        }
+
+        pos = lineEnd + 1;
+    }
+}
+
+// Converts a parsed chunk into vertices and indices at its global offsets.
+void buildChunk(const OBJChunk &chunk, const vector<vec3> &points, const vector<vec2> &texCoords,
+                const vector<vec3> &normals, OBJVertex *verts, u32 *indices, u32 vertBase) {
+    for (u32 c = 0, n = u32(chunk.corners.size()); c < n; c++) {
+        ivec3 corner = chunk.corners[c];
+        verts[c] = OBJVertex { points[corner.x], normals[corner.z], texCoords[corner.y] };
+    }
+    for (u32 c = 0, n = u32(chunk.indices.size()); c < n; c++) {
+        indices[c] = chunk.indices[c] + vertBase;
+    }
+}
+
+// Open addressing hash map from (point, texCoord, normal) index triples to vertex indices.
+// Uses linear probing, with the key and value packed together so a probe touches one cache line.
+struct CornerMap {
+    struct Entry {
+        ivec3 key; // key.x == -1 marks an empty slot
+        u32 value;
+    };
+    vector<Entry> entries;
+    u32 mask;
+    u32 count = 0;
+
+    explicit CornerMap(u32 expected) {
+        u32 capacity = 16;
+        while (capacity < expected * 2) capacity <<= 1;
+        entries.assign(capacity, Entry { ivec3(-1), 0 });
+        mask = capacity - 1;
+    }
+
+    static u32 hash(ivec3 key) {
+        u32 h = u32(key.x) * 0x8da6b343u ^ u32(key.y) * 0xd8163841u ^ u32(key.z) * 0xcb1ab31fu;
+        return h ^ (h >> 15);
+    }
+
+    // Returns the value stored for key, or stores and returns value if there wasn't one.
+    u32 findOrInsert(ivec3 key, u32 value) {
+        if (count * 2 >= entries.size()) grow();
+        for (u32 slot = hash(key) & mask; ; slot = (slot + 1) & mask) {
+            Entry &entry = entries[slot];
+            if (entry.key == key) return entry.value;
+            if (entry.key.x == -1) {
+                entry.key = key;
+                entry.value = value;
+                count++;
+                return value;
+            }
+        }
+    }
+
+    void grow() {
+        vector<Entry> old;
+        old.swap(entries);
+        entries.assign(old.size() * 2, Entry { ivec3(-1), 0 });
+        mask = u32(entries.size()) - 1;
+        for (const Entry &entry : old) {
+            if (entry.key.x == -1) continue;
+            u32 slot = hash(entry.key) & mask;
+            while (entries[slot].key.x != -1) slot = (slot + 1) & mask;
+            entries[slot] = entry;
+        }
+    }
+};
+
+// Gives each distinct corner in the file one vertex, in order of first use, and writes
+// the vertex for every corner to remap. Returns the distinct corners.
+vector<ivec3> weldCorners(const vector<OBJChunk> &chunks, u32 numPoints, u32 numCorners, u32 vertOffset, vector<u32> &remap) {
+    vector<ivec3> unique;
+    CornerMap map(numPoints);
+    remap.resize(numCorners);
+    u32 *out = remap.data();
+    for (const OBJChunk &chunk : chunks) {
+        for (ivec3 corner : chunk.corners) {
+            u32 vert = map.findOrInsert(corner, u32(unique.size()));
+            if (vert == unique.size()) unique.push_back(corner);
+            *out++ = vert + vertOffset;
+        }
+    }
+    return unique;
+}
+
+void loadMaterialLibrary(const string &cwd, const Token &name, OBJMesh &mesh) {
+    string matfile = cwd + '/' + name.str();
+    printf("Loading material file: %s\n", matfile.c_str());
+    bool success = loadMaterials(matfile, mesh);
+    if (!success) {
+        printf("Warning: failed to load material library %s\n", matfile.c_str());
+    }
+}
+
+bool loadObjFileMapped(const string &cwd, const string &filename, OBJMesh &mesh, u32 numThreads, bool weld) {
+    string pathname = cwd + '/' + filename;
+    MappedFile file;
+    if (!mapFile(pathname, file)) {
+        printf("Could not open obj file: %s\n", pathname.c_str());
+        return false;
+    }
+
+    auto startTime = chrono::high_resolution_clock::now();
+
+    // Use a few chunks per thread to balance out the difference in cost between kinds of lines.
+    const size_t minChunkSize = 1 << 18;
+    u32 numChunks = numThreads == 1 ? 1 : u32(std::min(size_t(numThreads) * 4, file.size / minChunkSize + 1));
+    vector<OBJChunk> chunks;
+    splitChunks(file.data, file.data + file.size, numChunks, chunks);
+    numChunks = u32(chunks.size());
+
+    parallelFor(numChunks, numThreads, [&](u32 c) {
+        countChunk(chunks[c]);
+    });
+
+    u32 numPoints = 0, numTexCoords = 0, numNormals = 0;
+    for (OBJChunk &chunk : chunks) {
+        chunk.pointBase = numPoints;
+        chunk.texCoordBase = numTexCoords;
+        chunk.normalBase = numNormals;
+        numPoints += chunk.numPoints;
+        numTexCoords += chunk.numTexCoords;
+        numNormals += chunk.numNormals;
+    }
+
+    vector<vec3> points(numPoints);
+    vector<vec2> texCoords(numTexCoords);
+    vector<vec3> normals(numNormals);
+    parallelFor(numChunks, numThreads, [&](u32 c) {
+        parseChunk(chunks[c], points.data(), texCoords.data(), normals.data());
+    });
+
+    // Stitch the chunks back together in file order.
+    u32 vertOffset = u32(mesh.verts.size());
+    u32 indexOffset = u32(mesh.indices.size());
+    u32 numCorners = 0, numIndices = indexOffset;
+    for (OBJChunk &chunk : chunks) {
+        chunk.cornerBase = numCorners;
+        chunk.indexBase = numIndices;
+        numCorners += u32(chunk.corners.size());
+        numIndices += u32(chunk.indices.size());
+    }
+
+    // init the first mesh part
+    unordered_map<string, u32> objectNames;
+    mesh.meshParts.push_back(OBJMeshPart { 0, indexOffset, 0, findObjectIndex(mesh, objectNames, "") });
+    string currentMtl;
+    for (const OBJChunk &chunk : chunks) {
+        for (const OBJDirective &directive : chunk.directives) {
+            u32 indexCount = chunk.indexBase + directive.indexCount;
+            const OBJMeshPart &current = mesh.meshParts.back();
+            if (directive.type == kMtlLib) {
+                loadMaterialLibrary(cwd, directive.name, mesh);
+            } else if (directive.type == kObject) {
+                u32 object = findObjectIndex(mesh, objectNames, directive.name.str());
+                if (object != current.objectIndex) {
+                    switchPart(mesh, indexCount, current.materialIndex, object);
+                }
+            } else if (currentMtl.compare(0, string::npos, directive.name.begin, directive.name.length()) != 0) {
+                // new mesh part
+                currentMtl = directive.name.str();
+                switchPart(mesh, indexCount, findMaterialIndex(mesh.materials, currentMtl), current.objectIndex);
+            }
+        }
+    }
+    OBJMeshPart &last = mesh.meshParts.back();
+    last.indexSize = numIndices - last.indexOffset;
+
+    // The directives were the last thing pointing into the file.
+    u64 fileSize = file.size;
+    unmapFile(file);
+
+    // Everything that follows has its final size, so nothing is reallocated on the way.
+    mesh.indices.resize(numIndices);
+    if (weld) {
+        vector<u32> remap;
+        vector<ivec3> unique = weldCorners(chunks, numPoints, numCorners, vertOffset, remap);
+        mesh.verts.resize(vertOffset + unique.size());
+        OBJVertex *verts = &mesh.verts[vertOffset];
+        const u32 blockSize = 1 << 16;
+        parallelFor(u32(unique.size() + blockSize - 1) / blockSize, numThreads, [&](u32 block) {
+            for (u32 c = block * blockSize, n = std::min(c + blockSize, u32(unique.size())); c < n; c++) {
+                ivec3 corner = unique[c];
+                verts[c] = OBJVertex { points[corner.x], normals[corner.z], texCoords[corner.y] };
+            }
+        });
+        parallelFor(numChunks, numThreads, [&](u32 c) {
+            OBJChunk &chunk = chunks[c];
+            u32 *indices = &mesh.indices[chunk.indexBase];
+            for (u32 i = 0, n = u32(chunk.indices.size()); i < n; i++) {
+                indices[i] = remap[chunk.cornerBase + chunk.indices[i]];
+            }
+            vector<ivec3>().swap(chunk.corners);
+            vector<u32>().swap(chunk.indices);
+        });
+        printf("Welded %u face corners into %zu vertices (%.2fx reduction)\n",
+               numCorners, unique.size(), numCorners / std::max(f64(unique.size()), 1.0));
+    } else {
+        mesh.verts.resize(vertOffset + numCorners);
+        parallelFor(numChunks, numThreads, [&](u32 c) {
+            OBJChunk &chunk = chunks[c];
+            u32 vertBase = vertOffset + chunk.cornerBase;
+            buildChunk(chunk, points, texCoords, normals,
+                       &mesh.verts[vertBase], &mesh.indices[chunk.indexBase], vertBase);
+            // release the scratch memory as soon as possible
+            vector<ivec3>().swap(chunk.corners);
+            vector<u32>().swap(chunk.indices);
+        });
+    }
+    vector<vec3>().swap(points);
+    vector<vec2>().swap(texCoords);
+    vector<vec3>().swap(normals);
+    vector<OBJChunk>().swap(chunks);
+
+    finishObjects(mesh, numThreads);
+
+    chrono::duration<double> seconds = chrono::high_resolution_clock::now() - startTime;
+    printf("Loaded mesh from %s in %ums (%.1f MB/s, %u threads, %u chunks, %zu objects)\n", filename.c_str(),
+           u32(seconds.count() * 1000), fileSize / (1024.0 * 1024.0) / std::max(seconds.count(), 1e-9),
+           numThreads, numChunks, mesh.objects.size());
+    return true;
+}
+
+bool scanObjFile(const string &cwd, const string &filename, Bounds &pointBounds, u64 &numTriangles) {
+    string pathname = cwd + '/' + filename;
+    MappedFile file;
+    if (!mapFile(pathname, file)) {
+        printf("Could not open obj file: %s\n", pathname.c_str());
+        return false;
+    }
+
+    // Chunks are kept small enough that their counts fit in 32 bits.
+    const size_t maxChunkSize = size_t(1) << 26;
+    u32 numThreads = hardwareThreads();
+    u32 numChunks = u32(std::max(size_t(numThreads) * 4, file.size / maxChunkSize + 1));
+    vector<OBJChunk> chunks;
+    splitChunks(file.data, file.data + file.size, numChunks, chunks);
+    numChunks = u32(chunks.size());
+
+    vector<Bounds> chunkBounds(numChunks);
+    parallelFor(numChunks, numThreads, [&](u32 c) {
+        OBJChunk &chunk = chunks[c];
+        countChunk(chunk);
+        Bounds &bounds = chunkBounds[c] = emptyBounds();
+        for (const char *pos = chunk.begin; pos < chunk.end; ) {
+            const char *lineEnd = findLineEnd(pos, chunk.end);
+            if (readToken(pos, lineEnd) == "v") {
+                f32 x = readFloat(pos, lineEnd);
+                f32 y = readFloat(pos, lineEnd);
+                f32 z = readFloat(pos, lineEnd);
+                addPoint(bounds, vec3(x, y, z));
+            }
+            pos = lineEnd + 1;
+        }
+    });
+
+    pointBounds = emptyBounds();
+    numTriangles = 0;
+    for (u32 c = 0; c < numChunks; c++) {
+        addBox(pointBounds, chunkBounds[c]);
+        numTriangles += chunks[c].numFaceIndices / 3;
+    }
+    centerBounds(pointBounds);
+    if (!isEmpty(pointBounds)) {
+        pointBounds.radius = length(pointBounds.max - pointBounds.center);
+    }
+
+    unmapFile(file);
+    return true;
+}
+
+bool loadObjFileStreaming(const string &cwd, const string &filename, OBJMesh &mesh, const OBJSpanCallback &spanDone) {
+    string pathname = cwd + '/' + filename;
+    MappedFile file;
+    if (!mapFile(pathname, file)) {
+        printf("Could not open obj file: %s\n", pathname.c_str());
+        return false;
+    }
+
+    auto startTime = chrono::high_resolution_clock::now();
+    vector<vec3> points;
+    vector<vec2> texCoords;
+    vector<vec3> normals;
+
+    unordered_map<string, u32> objectNames;
+    OBJMeshSpan span;
+    span.materialIndex = 0;
+    span.objectIndex = findObjectIndex(mesh, objectNames, "");
+    CornerMap map(1024);
+    string currentMtl;
+    u32 numSpans = 0;
+
+    bool keepGoing = true; // until spanDone says to stop
+    auto finishSpan = [&]() {
+        if (!keepGoing || span.indices.empty()) return;
+        // Every vertex in the span is used, so its bounds come straight from the vertices.
+        span.bounds = emptyBounds();
+        for (const OBJVertex &vert : span.verts) addPoint(span.bounds, vert.position);
+        centerBounds(span.bounds);
+        for (const OBJVertex &vert : span.verts) addSpherePoint(span.bounds, vert.position);
+        keepGoing = spanDone(mesh, span);
+        numSpans++;
+        span.verts.clear();
+        span.indices.clear();
+        map = CornerMap(1024);
+    };
+
+    // Small pieces keep the time until the first span is done short.
+    const size_t pieceSize = 1 << 20;
+    const char *end = file.data + file.size;
+    for (const char *pos = file.data; pos < end && keepGoing; ) {
+        OBJChunk chunk;
+        chunk.begin = pos;
+        chunk.end = size_t(end - pos) > pieceSize ? findLineEnd(pos + pieceSize, end) : end;
+        if (chunk.end < end) chunk.end++;
+        pos = chunk.end;
+
+        // Pieces are parsed in order, so everything a face can reference is already parsed.
+        countChunk(chunk);
+        chunk.pointBase = u32(points.size());
+        chunk.texCoordBase = u32(texCoords.size());
+        chunk.normalBase = u32(normals.size());
+        points.resize(points.size() + chunk.numPoints);
+        texCoords.resize(texCoords.size() + chunk.numTexCoords);
+        normals.resize(normals.size() + chunk.numNormals);
+        parseChunk(chunk, points.data(), texCoords.data(), normals.data());
+
+        u32 index = 0;
+        auto addIndices = [&](u32 until) {
+            for (; index < until; index++) {
+                ivec3 corner = chunk.corners[chunk.indices[index]];
+                u32 vert = map.findOrInsert(corner, u32(span.verts.size()));
+                if (vert == span.verts.size()) {
+                    span.verts.push_back(OBJVertex { points[corner.x], normals[corner.z], texCoords[corner.y] });
+                }
+                span.indices.push_back(vert);
+            }
+        };
+        for (const OBJDirective &directive : chunk.directives) {
+            addIndices(directive.indexCount);
+            if (directive.type == kMtlLib) {
+                loadMaterialLibrary(cwd, directive.name, mesh);
+            } else if (directive.type == kObject) {
+                u32 object = findObjectIndex(mesh, objectNames, directive.name.str());
+                if (object != span.objectIndex) {
+                    finishSpan();
+                    span.objectIndex = object;
+                }
+            } else if (currentMtl.compare(0, string::npos, directive.name.begin, directive.name.length()) != 0) {
+                finishSpan();
+                currentMtl = directive.name.str();
+                span.materialIndex = findMaterialIndex(mesh.materials, currentMtl);
+            }
+            if (!keepGoing) break;
+        }
+        if (!keepGoing) break;
+        addIndices(u32(chunk.indices.size()));
+    }
+    finishSpan();
+
+    chrono::duration<double> seconds = chrono::high_resolution_clock::now() - startTime;
+    if (keepGoing) {
+        printf("Streamed %u spans from %s in %ums (%.1f MB/s)\n", numSpans, filename.c_str(),
+               u32(seconds.count() * 1000), file.size / (1024.0 * 1024.0) / std::max(seconds.count(), 1e-9));
+    } else {
+        printf("Stopped streaming %s after %u spans in %ums\n", filename.c_str(), numSpans, u32(seconds.count() * 1000));
+    }
+
+    unmapFile(file);
+    return keepGoing;
+}
+
+// ------------------ End Mapped Loader ---------------------
@@ -6,7 +6,9 @@
 #define SPONZA_OBJ_H
 
 #include "types.h"
+#include "bounds.h"
 #include <glm/glm.hpp>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -63,10 +65,19 @@ struct OBJVertex {
     glm::vec2 texture;
 };
 
+// A group (g) or object (o) from the file. Faces before the first g or o belong to "default".
+// Groups that are reopened later in the file share one object.
+struct OBJObject {
+    std::string name;
+    Bounds bounds; // of every triangle in the object's parts
+};
+
+// A run of triangles with one material and one object.
 struct OBJMeshPart {
     u32 materialIndex;
     u32 indexOffset;
     u32 indexSize;
+    u32 objectIndex;
 };
 
 struct OBJMesh {
@@ -75,10 +86,42 @@ struct OBJMesh {
     std::vector<OBJVertex> verts;
     std::vector<u32> indices;
     std::vector<OBJMeshPart> meshParts;
+    std::vector<OBJObject> objects;
+    std::vector<std::string> materialLibraries; // the path of every mtllib that was loaded
 };
 
+// loader flags
+#define OBJ_LOAD_MAPPED (1<<0) // mmap the file and tokenize it in place instead of going through iostreams
+#define OBJ_LOAD_THREADED (1<<1) // like OBJ_LOAD_MAPPED, but parse line-aligned chunks on every core
+#define OBJ_LOAD_WELD (1<<2) // share one vertex between identical face corners (mapped and threaded loaders only)
+typedef u32 OBJLoadFlags;
+
 bool loadMaterials(const std::string &filename, OBJMesh &mesh);
 
-bool loadObjFile(const std::string &path, const std::string &filename, OBJMesh &mesh);
+bool loadObjFile(const std::string &path, const std::string &filename, OBJMesh &mesh, OBJLoadFlags flags = 0);
+
+// A run of faces that share a material and object, as produced by loadObjFileStreaming.
+// Vertices are welded within the span, and indices are relative to the span's verts.
+struct OBJMeshSpan {
+    u32 materialIndex;
+    u32 objectIndex;
+    Bounds bounds;
+    std::vector<OBJVertex> verts;
+    std::vector<u32> indices;
+};
+
+// Called on the loading thread as each span is completed. mesh holds the materials,
+// textures and object names read so far (object bounds are left empty). The span is cleared after the call, so its vectors may be moved out.
+// Return false to stop loading.
+typedef std::function<bool(const OBJMesh &mesh, OBJMeshSpan &span)> OBJSpanCallback;
+
+// Parses the file a piece at a time, handing out each usemtl span as soon as it is complete
+// instead of building the whole mesh. Only materials, textures and objects are added to mesh.
+// Returns false if the file can't be opened or spanDone stopped loading.
+bool loadObjFileStreaming(const std::string &path, const std::string &filename, OBJMesh &mesh, const OBJSpanCallback &spanDone);
+
+// Reads only the points and counts the triangles, without keeping any of them, to size
+// work on files that are too big to load at once (see outofcore.h).
+bool scanObjFile(const std::string &path, const std::string &filename, Bounds &pointBounds, u64 &numTriangles);
 
 #endif //SPONZA_OBJ_H
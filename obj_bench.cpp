@@ -0,0 +1,163 @@
+// Compares the number parsing kernels in number_parse.h against the
+// iostream and strtof paths the OBJ loader used before, and checks that
+// every float comes out bit-exact with strtof.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "number_parse.h"
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static double elapsedNs(Clock::time_point start) {
+    return chrono::duration<double, nano>(Clock::now() - start).count();
+}
+
+static void report(const char *name, double ns, size_t count, size_t bytes) {
+    printf("  %-24s %7.2f ns/number  %8.1f MB/s\n", name, ns / count, bytes / (ns * 1e-9) / (1024.0 * 1024.0));
+}
+
+static string randomFloat(mt19937 &rng, bool typical) {
+    char buffer[64];
+    u32 kind = typical ? 2 : rng() % 2;
+    if (kind == 0) {
+        // any finite float, printed so that it round trips
+        f32 f;
+        do {
+            u32 bits = rng();
+            memcpy(&f, &bits, sizeof(f));
+        } while (!std::isfinite(f));
+        snprintf(buffer, sizeof(buffer), "%.9g", f);
+    } else if (kind == 1) {
+        // long mantissas with exponents, including ones past the fast path
+        u64 mantissa = (u64(rng()) << 32 | rng()) % 10000000000000000000ULL;
+        snprintf(buffer, sizeof(buffer), "%llue%d", (unsigned long long) mantissa, int(rng() % 80) - 40);
+    } else {
+        // typical OBJ output: fixed point with a handful of decimals
+        u32 decimals = rng() % 8;
+        f64 magnitude = pow(10.0, int(rng() % 5));
+        f64 value = (f64(rng()) / 4294967296.0 * 2 - 1) * magnitude;
+        snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+    }
+    return buffer;
+}
+
+static u32 checkFloats(const vector<string> &floats) {
+    u32 mismatches = 0;
+    for (const string &str : floats) {
+        f32 expected = strtof(str.c_str(), nullptr);
+        f32 actual = parseFloat(str.data(), str.data() + str.size());
+        if (memcmp(&expected, &actual, sizeof(f32)) != 0) {
+            if (mismatches++ < 10) {
+                printf("Mismatch: '%s' strtof=%.9g parseFloat=%.9g\n", str.c_str(), expected, actual);
+            }
+        }
+    }
+    return mismatches;
+}
+
+static void benchFloats(const char *name, const vector<string> &floats) {
+    size_t bytes = 0;
+    for (const string &str : floats) bytes += str.size();
+    printf("%s floats (%.1f MB):\n", name, bytes / (1024.0 * 1024.0));
+
+    volatile f32 sink = 0;
+    {
+        Clock::time_point start = Clock::now();
+        f32 sum = 0;
+        for (const string &str : floats) {
+            istringstream stream(str);
+            f32 value;
+            stream >> value;
+            sum += value;
+        }
+        sink = sum;
+        report("istringstream >> f32", elapsedNs(start), floats.size(), bytes);
+    }
+    {
+        Clock::time_point start = Clock::now();
+        f32 sum = 0;
+        for (const string &str : floats) {
+            char buffer[64];
+            memcpy(buffer, str.data(), str.size() + 1);
+            sum += strtof(buffer, nullptr);
+        }
+        sink = sum;
+        report("strtof", elapsedNs(start), floats.size(), bytes);
+    }
+    {
+        Clock::time_point start = Clock::now();
+        f32 sum = 0;
+        for (const string &str : floats) {
+            sum += parseFloat(str.data(), str.data() + str.size());
+        }
+        sink = sum;
+        report("parseFloat", elapsedNs(start), floats.size(), bytes);
+    }
+    (void) sink;
+}
+
+int main() {
+    const u32 kNumbers = 2000000;
+    mt19937 rng(1234);
+
+    // Typical OBJ numbers, and ones meant to push parseFloat onto its slow paths.
+    vector<string> typical(kNumbers), adversarial(kNumbers);
+    for (string &str : typical) str = randomFloat(rng, true);
+    for (string &str : adversarial) str = randomFloat(rng, false);
+
+    // Correctness first: every number has to match strtof bit for bit.
+    u32 mismatches = checkFloats(typical) + checkFloats(adversarial);
+    printf("Checked %u floats against strtof: %u mismatches\n", kNumbers * 2, mismatches);
+
+    benchFloats("Typical", typical);
+    benchFloats("Adversarial", adversarial);
+
+    // Face corners, as they appear after an 'f'.
+    vector<string> corners(kNumbers);
+    size_t cornerBytes = 0;
+    for (string &str : corners) {
+        str = to_string(rng() % 2000000 + 1) + '/' + to_string(rng() % 2000000 + 1) + '/' + to_string(rng() % 2000000 + 1);
+        cornerBytes += str.size();
+    }
+
+    printf("Face corners (%.1f MB):\n", cornerBytes / (1024.0 * 1024.0));
+    u64 expectedSum = 0, actualSum = 0;
+    {
+        Clock::time_point start = Clock::now();
+        for (const string &str : corners) {
+            size_t slash1 = str.find("/");
+            size_t slash2 = str.find("/", slash1 + 1);
+            expectedSum += atoi(str.substr(0, slash1).c_str());
+            expectedSum += atoi(str.substr(slash1 + 1, slash2).c_str());
+            expectedSum += atoi(str.substr(slash2 + 1, str.length()).c_str());
+        }
+        report("find + atoi(substr)", elapsedNs(start), kNumbers * 3, cornerBytes);
+    }
+    {
+        Clock::time_point start = Clock::now();
+        for (const string &str : corners) {
+            const char *pos = str.data();
+            const char *end = pos + str.size();
+            actualSum += parseInt(pos, end);
+            pos++;
+            actualSum += parseInt(pos, end);
+            pos++;
+            actualSum += parseInt(pos, end);
+        }
+        report("parseInt", elapsedNs(start), kNumbers * 3, cornerBytes);
+    }
+    if (expectedSum != actualSum) {
+        printf("Index mismatch: %llu != %llu\n", (unsigned long long) expectedSum, (unsigned long long) actualSum);
+        mismatches++;
+    }
+
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,186 @@
+#include "occlusion.h"
+
+#include <algorithm>
+#include <cfloat>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "obj.h"
+#include "parallel.h"
+
+using namespace std;
+using namespace glm;
+
+const u32 kBandRows = 16; // rows per job in renderOccluders
+
+void selectOccluders(const OBJMesh &obj, vector<vec3> &occluders) {
+    struct Candidate {
+        f32 area;
+        u32 first;
+    };
+    vector<Candidate> candidates;
+    for (const OBJMeshPart &part : obj.meshParts) {
+        // Every Sponza material sets d, so it's the alpha maps that tell what can be seen through.
+        const OBJMaterial &mat = obj.materials[part.materialIndex];
+        if ((mat.flags & OBJ_MTL_MAP_D) || ((mat.flags & OBJ_MTL_D) && mat.d < 1)) continue;
+        for (u32 i = part.indexOffset, end = part.indexOffset + part.indexSize; i + 3 <= end; i += 3) {
+            vec3 a = obj.verts[obj.indices[i]].position;
+            vec3 b = obj.verts[obj.indices[i + 1]].position;
+            vec3 c = obj.verts[obj.indices[i + 2]].position;
+            f32 area = length(cross(b - a, c - a));
+            if (area > 0) candidates.push_back(Candidate { area, i });
+        }
+    }
+    u32 count = std::min(u32(candidates.size()), u32(MAX_OCCLUDERS));
+    nth_element(candidates.begin(), candidates.begin() + count, candidates.end(),
+                [](const Candidate &a, const Candidate &b) { return a.area > b.area; });
+
+    occluders.clear();
+    for (u32 c = 0; c < count; c++) {
+        for (u32 k = 0; k < 3; k++) {
+            occluders.push_back(obj.verts[obj.indices[candidates[c].first + k]].position);
+        }
+    }
+    printf("Selected %u of %zu opaque triangles as occluders\n", count, candidates.size());
+}
+
+// A triangle ready to rasterize: edge functions that are positive inside, and the depth plane,
+// all in pixels from the bottom left corner of the buffer.
+struct OccluderSetup {
+    vec3 edges[3]; // the pixel centered on x, y is covered where x * edge.x + y * edge.y + edge.z >= 0
+    vec3 depth;    // x * depth.x + y * depth.y + depth.z, plus half a pixel's change in depth
+    s32 minX, maxX, minY, maxY; // inclusive pixel bounds, clamped to the buffer
+};
+
+static bool setupOccluder(const vec4 clip[3], OccluderSetup &setup) {
+    vec3 screen[3];
+    for (int c = 0; c < 3; c++) {
+        if (clip[c].z < -clip[c].w) return false; // in front of the near plane
+        vec3 ndc = vec3(clip[c]) / clip[c].w;
+        screen[c] = vec3((ndc.x * 0.5f + 0.5f) * OCCLUSION_WIDTH, (ndc.y * 0.5f + 0.5f) * OCCLUSION_HEIGHT, ndc.z);
+    }
+    vec3 e1 = screen[1] - screen[0], e2 = screen[2] - screen[0];
+    f32 area = e1.x * e2.y - e2.x * e1.y;
+    if (area <= 0) return false; // back facing, and culled when it's drawn too
+
+    vec2 lo = min(min(vec2(screen[0]), vec2(screen[1])), vec2(screen[2]));
+    vec2 hi = max(max(vec2(screen[0]), vec2(screen[1])), vec2(screen[2]));
+    setup.minX = std::max(s32(floor(lo.x)), 0);
+    setup.minY = std::max(s32(floor(lo.y)), 0);
+    setup.maxX = std::min(s32(ceil(hi.x)), OCCLUSION_WIDTH - 1);
+    setup.maxY = std::min(s32(ceil(hi.y)), OCCLUSION_HEIGHT - 1);
+    if (setup.minX > setup.maxX || setup.minY > setup.maxY) return false;
+
+    for (int c = 0; c < 3; c++) {
+        // Moved in by half a pixel's change in the edge function, so testing it at a pixel center
+        // tests the pixel's corner that's least inside. Only pixels the triangle covers entirely
+        // pass, and nothing can be seen through a gap or past a silhouette in one that's written.
+        vec3 from = screen[c], to = screen[(c + 1) % 3];
+        f32 a = from.y - to.y, b = to.x - from.x;
+        setup.edges[c] = vec3(a, b, -(a * from.x + b * from.y) - 0.5f * (fabs(a) + fabs(b)));
+    }
+    f32 dx = (e1.z * e2.y - e2.z * e1.y) / area;
+    f32 dy = (e2.z * e1.x - e1.z * e2.x) / area;
+    // Store the farthest depth the triangle reaches within each pixel, so nothing that's in front
+    // of any part of it within the pixel counts as hidden.
+    setup.depth = vec3(dx, dy, screen[0].z - dx * screen[0].x - dy * screen[0].y + 0.5f * (fabs(dx) + fabs(dy)));
+    return true;
+}
+
+static void rasterizeRows(f32 *depth, const OccluderSetup &tri, s32 minY, s32 maxY) {
+    for (s32 y = minY; y <= maxY; y++) {
+        f32 py = f32(y) + 0.5f;
+        f32 *row = depth + y * OCCLUSION_WIDTH;
+        s32 x = tri.minX & ~3;
+#ifdef __SSE2__
+        __m128 rowEdges[3], stepEdges[3];
+        for (int c = 0; c < 3; c++) {
+            rowEdges[c] = _mm_set1_ps(tri.edges[c].y * py + tri.edges[c].z);
+            stepEdges[c] = _mm_set1_ps(tri.edges[c].x);
+        }
+        __m128 rowDepth = _mm_set1_ps(tri.depth.y * py + tri.depth.z), stepDepth = _mm_set1_ps(tri.depth.x);
+        for (; x <= tri.maxX; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps(f32(x)), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+            __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(stepEdges[0], px), rowEdges[0]), _mm_setzero_ps());
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(stepEdges[1], px), rowEdges[1]), _mm_setzero_ps()));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(stepEdges[2], px), rowEdges[2]), _mm_setzero_ps()));
+            __m128 old = _mm_loadu_ps(row + x);
+            __m128 nearest = _mm_min_ps(old, _mm_add_ps(_mm_mul_ps(stepDepth, px), rowDepth));
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+        }
+#else
+        for (; x <= tri.maxX; x++) {
+            f32 px = f32(x) + 0.5f;
+            bool inside = true;
+            for (int c = 0; c < 3; c++) {
+                inside &= tri.edges[c].x * px + tri.edges[c].y * py + tri.edges[c].z >= 0;
+            }
+            if (inside) row[x] = std::min(row[x], tri.depth.x * px + tri.depth.y * py + tri.depth.z);
+        }
+#endif
+    }
+}
+
+void renderOccluders(OcclusionBuffer &buffer, const vector<vec3> &occluders, const mat4 &viewProjection) {
+    buffer.viewProjection = viewProjection;
+    buffer.depth.assign(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, FLT_MAX);
+
+    static vector<OccluderSetup> tris;
+    tris.clear();
+    for (u32 c = 0, n = u32(occluders.size()); c + 3 <= n; c += 3) {
+        vec4 clip[3];
+        for (int k = 0; k < 3; k++) {
+            clip[k] = viewProjection * vec4(occluders[c + k], 1);
+        }
+        OccluderSetup setup;
+        if (setupOccluder(clip, setup)) tris.push_back(setup);
+    }
+
+    // Each band of rows is written by one job, so they don't need to synchronize.
+    const u32 numBands = OCCLUSION_HEIGHT / kBandRows;
+    parallelFor(numBands, hardwareThreads(), [&](u32 band) {
+        s32 bandMin = s32(band * kBandRows), bandMax = bandMin + s32(kBandRows) - 1;
+        for (const OccluderSetup &tri : tris) {
+            s32 minY = std::max(tri.minY, bandMin), maxY = std::min(tri.maxY, bandMax);
+            if (minY <= maxY) rasterizeRows(buffer.depth.data(), tri, minY, maxY);
+        }
+    });
+}
+
+bool boxOccluded(const OcclusionBuffer &buffer, const vec3 &min, const vec3 &max) {
+    if (buffer.depth.empty()) return false;
+    vec2 lo(FLT_MAX), hi(-FLT_MAX);
+    f32 nearest = FLT_MAX;
+    for (int c = 0; c < 8; c++) {
+        vec3 corner((c & 1) ? max.x : min.x, (c & 2) ? max.y : min.y, (c & 4) ? max.z : min.z);
+        vec4 clip = buffer.viewProjection * vec4(corner, 1);
+        if (clip.z < -clip.w) return false;
+        vec3 ndc = vec3(clip) / clip.w;
+        lo = glm::min(lo, vec2(ndc));
+        hi = glm::max(hi, vec2(ndc));
+        nearest = std::min(nearest, ndc.z);
+    }
+
+    // Every pixel the box touches, and one more around it for rounding.
+    s32 minX = std::max(s32(floor((lo.x * 0.5f + 0.5f) * OCCLUSION_WIDTH)) - 1, 0);
+    s32 minY = std::max(s32(floor((lo.y * 0.5f + 0.5f) * OCCLUSION_HEIGHT)) - 1, 0);
+    s32 maxX = std::min(s32(floor((hi.x * 0.5f + 0.5f) * OCCLUSION_WIDTH)) + 1, OCCLUSION_WIDTH - 1);
+    s32 maxY = std::min(s32(floor((hi.y * 0.5f + 0.5f) * OCCLUSION_HEIGHT)) + 1, OCCLUSION_HEIGHT - 1);
+    if (minX > maxX || minY > maxY) return false; // off screen, left to frustum culling
+
+    for (s32 y = minY; y <= maxY; y++) {
+        const f32 *row = buffer.depth.data() + y * OCCLUSION_WIDTH;
+        s32 x = minX;
+#ifdef __SSE2__
+        __m128 boxDepth = _mm_set1_ps(nearest);
+        for (; x + 4 <= maxX + 1; x += 4) {
+            if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), boxDepth))) return false;
+        }
+#endif
+        for (; x <= maxX; x++) {
+            if (row[x] >= nearest) return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef SPONZA_OCCLUSION_H
+#define SPONZA_OCCLUSION_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "types.h"
+
+struct OBJMesh;
+
+// Software occlusion culling. A few thousand of the largest opaque triangles in the scene are
+// rasterized on the CPU into a small depth buffer every frame, and boxes that are behind them at
+// every pixel they cover aren't drawn. Nothing is read back from the GPU.
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+#define MAX_OCCLUDERS 4096 // triangles
+
+struct OcclusionBuffer {
+    std::vector<f32> depth; // OCCLUSION_WIDTH * OCCLUSION_HEIGHT, rows from the bottom, NDC depth of the nearest occluder
+    glm::mat4 viewProjection;
+};
+
+// Picks up to MAX_OCCLUDERS of the largest triangles of obj whose materials have no alpha map,
+// in world space, three corners each. Call before findInstances, which removes repeated copies.
+void selectOccluders(const OBJMesh &obj, std::vector<glm::vec3> &occluders);
+
+// Rasterizes the front faces of occluders as seen through viewProjection, in bands of rows
+// spread across threads. Only pixels a triangle covers entirely are written, so this coarse
+// buffer never closes over a gap or spreads past a silhouette. Triangles crossing the near
+// plane are left out.
+void renderOccluders(OcclusionBuffer &buffer, const std::vector<glm::vec3> &occluders, const glm::mat4 &viewProjection);
+
+// True if the world space box is behind the occluders at every pixel it could touch. Boxes
+// crossing the near plane are never occluded.
+bool boxOccluded(const OcclusionBuffer &buffer, const glm::vec3 &min, const glm::vec3 &max);
+
+#endif //SPONZA_OCCLUSION_H
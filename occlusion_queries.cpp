@@ -0,0 +1,117 @@
+#include "occlusion_queries.h"
+#include "gl_includes.h"
+#include "material.h"
+
+using namespace std;
+using namespace glm;
+
+// Two counterclockwise triangles per face, seen from outside the box.
+static const u8 kBoxIndices[36] = {
+    0, 4, 6, 0, 6, 2, // -x
+    1, 3, 7, 1, 7, 5, // +x
+    0, 1, 5, 0, 5, 4, // -y
+    2, 6, 7, 2, 7, 3, // +y
+    0, 2, 3, 0, 3, 1, // -z
+    4, 5, 7, 4, 7, 6, // +z
+};
+
+void initOcclusionQueries(OcclusionQueries &queries, const BoxList &boxes) {
+    freeOcclusionQueries(queries);
+    u32 count = boxCount(boxes);
+    vector<vec3> corners(u64(count) * 8);
+    for (u32 c = 0; c < count; c++) {
+        vec3 min(boxes.minX[c], boxes.minY[c], boxes.minZ[c]);
+        vec3 max(boxes.maxX[c], boxes.maxY[c], boxes.maxZ[c]);
+        for (u32 k = 0; k < 8; k++) {
+            corners[c * 8 + k] = vec3((k & 1) ? max.x : min.x, (k & 2) ? max.y : min.y, (k & 4) ? max.z : min.z);
+        }
+    }
+
+    glGenVertexArrays(1, &queries.vao);
+    glBindVertexArray(queries.vao);
+    glGenBuffers(1, &queries.vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, queries.vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, corners.size() * sizeof(vec3), corners.data(), GL_STATIC_DRAW);
+    glGenBuffers(1, &queries.indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, queries.indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(kBoxIndices), kBoxIndices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(VAO_POS);
+    glVertexAttribPointer(VAO_POS, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), nullptr);
+
+    queries.queries.resize(count);
+    if (count) glGenQueries(GLsizei(count), queries.queries.data());
+    queries.freeQueries = queries.queries;
+    queries.current.assign(count, 0);
+    queries.visible.assign(count, 1);
+    queries.resultFrame.assign(count, 0);
+    checkError();
+}
+
+void freeOcclusionQueries(OcclusionQueries &queries) {
+    if (!queries.queries.empty()) glDeleteQueries(GLsizei(queries.queries.size()), queries.queries.data());
+    if (queries.vao) glDeleteVertexArrays(1, &queries.vao);
+    if (queries.vertexBuffer) glDeleteBuffers(1, &queries.vertexBuffer);
+    if (queries.indexBuffer) glDeleteBuffers(1, &queries.indexBuffer);
+    queries = OcclusionQueries();
+}
+
+u32 readQueryResults(OcclusionQueries &queries, vector<u32> &hidden) {
+    u32 numRead = 0;
+    u32 numLeft = 0;
+    for (const InFlightQuery &query : queries.inFlight) {
+        GLuint available = 0;
+        glGetQueryObjectuiv(query.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            queries.inFlight[numLeft++] = query;
+            continue;
+        }
+        GLuint passed = 0;
+        glGetQueryObjectuiv(query.query, GL_QUERY_RESULT, &passed);
+        queries.freeQueries.push_back(query.query);
+        if (!passed) hidden.push_back(query.box);
+        // Results can come back out of order, and an older one mustn't replace a newer one.
+        if (query.frame > queries.resultFrame[query.box]) {
+            queries.resultFrame[query.box] = query.frame;
+            queries.visible[query.box] = u8(passed != 0);
+        }
+        numRead++;
+    }
+    queries.inFlight.resize(numLeft);
+    return numRead;
+}
+
+u32 issueQueries(OcclusionQueries &queries, const u8 *test, const mat4 &mvp) {
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    bindVertexFormat(kFloatVertex);
+    bindDepthShader(mvp);
+    glBindVertexArray(queries.vao);
+
+    queries.frame++;
+    u32 numIssued = 0;
+    for (u32 c = 0, n = u32(queries.current.size()); c < n; c++) {
+        queries.current[c] = 0;
+        if (!test[c]) continue;
+        // The pool runs dry when results are more than a frame behind, so it doubles.
+        if (queries.freeQueries.empty()) {
+            u32 more = u32(queries.queries.size());
+            if (more == 0) more = 64;
+            queries.queries.resize(queries.queries.size() + more);
+            glGenQueries(GLsizei(more), &queries.queries[queries.queries.size() - more]);
+            queries.freeQueries.insert(queries.freeQueries.end(), queries.queries.end() - more, queries.queries.end());
+        }
+        u32 query = queries.freeQueries.back();
+        queries.freeQueries.pop_back();
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, query);
+        glDrawElementsBaseVertex(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, nullptr, GLint(c * 8));
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        queries.current[c] = query;
+        queries.inFlight.push_back(InFlightQuery { c, query, queries.frame });
+        numIssued++;
+    }
+
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    checkError();
+    return numIssued;
+}
@@ -0,0 +1,50 @@
+#ifndef SPONZA_OCCLUSION_QUERIES_H
+#define SPONZA_OCCLUSION_QUERIES_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "culling.h"
+#include "types.h"
+
+// Hardware occlusion queries on the boxes of a BoxList. Each box is drawn under its own
+// GL_ANY_SAMPLES_PASSED query, and the query both drives conditional rendering of what's in the
+// box in the same frame and is read back a frame or more later, once it's ready, so the CPU never
+// waits on the GPU. A box is queried again every frame it's tested, whether or not its earlier
+// queries have come back, so the queries come from a pool that grows with how far behind the
+// results are.
+struct InFlightQuery {
+    u32 box;
+    u32 query;
+    u32 frame; // issueQueries call it was issued in
+};
+
+struct OcclusionQueries {
+    u32 vao = 0;
+    u32 vertexBuffer = 0; // 8 corners per box, bit 0 of the corner picks max x, bit 1 max y, bit 2 max z
+    u32 indexBuffer = 0;  // 36 u8 indices of one box, drawn with a base vertex per box
+    std::vector<u32> queries;            // every query name made, to delete them
+    std::vector<u32> freeQueries;
+    std::vector<InFlightQuery> inFlight; // issued and not read yet, oldest first
+    std::vector<u32> current;  // per box, the query issued in the last issueQueries, or 0 if it wasn't tested
+    std::vector<u8> visible;   // per box, the newest result read, 1 until the first one comes back
+    std::vector<u32> resultFrame; // per box, the frame of the query visible came from
+    u32 frame = 0;
+};
+
+// (Re)creates the box geometry and a query per box to start the pool, with every box visible.
+void initOcclusionQueries(OcclusionQueries &queries, const BoxList &boxes);
+void freeOcclusionQueries(OcclusionQueries &queries);
+
+// Reads every result that's ready without waiting for the rest, returning their queries to the
+// pool, and appends the boxes whose result says hidden to hidden. Returns the number read.
+u32 readQueryResults(OcclusionQueries &queries, std::vector<u32> &hidden);
+
+// Draws box c under a fresh query for every c where test[c] is set, depth tested against what's
+// been drawn so far but writing neither depth nor color, and sets current to those queries for
+// conditional rendering. Queries from earlier frames stay in flight until they're read. Binds
+// the depth shader in the float vertex format and the boxes' VAO, so the caller has to bind its
+// own again. Boxes the camera is inside of have no front faces to draw, so they shouldn't be
+// tested. Returns the number of queries issued.
+u32 issueQueries(OcclusionQueries &queries, const u8 *test, const glm::mat4 &mvp);
+
+#endif //SPONZA_OCCLUSION_QUERIES_H
@@ -0,0 +1,614 @@
+#include "outofcore.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "meshcache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+using namespace glm;
+
+#define CELL_FILE_MAGIC 0x4C435053 // "SPCL"
+
+struct CellFileHeader {
+    u32 magic;
+    u32 version;
+    u32 vertexSize;   // sizeof(Vertex), in case the layout changes without a version bump
+    u32 numTextures;
+    u32 numMaterials;
+    u32 numCells;
+    u32 numLibraries;
+    u64 sourceSize;
+    s64 sourceMtime;
+    u64 texturesOffset;  // CachedString[numTextures]
+    u64 materialsOffset; // CachedMaterial[numMaterials]
+    u64 librariesOffset; // CachedLibrary[numLibraries]
+    u64 cellsOffset;     // CellInfo[numCells]
+    u64 stringsOffset;   // characters for every CachedString
+    u64 fileSize;
+};
+
+// One cell's geometry. Offsets are from the start of the file.
+struct CellInfo {
+    Bounds bounds;
+    u32 numVerts;
+    u32 numIndices;
+    u32 numParts;
+    u32 unused;
+    u64 vertsOffset;   // Vertex[numVerts]
+    u64 indicesOffset; // u32[numIndices], relative to the cell's vertices
+    u64 partsOffset;   // MeshPart[numParts], one per material
+};
+
+static string cellFileFor(const string &objFile) {
+    return objFile + ".cells";
+}
+
+// ------------------ Begin Cell Builder -------------------
+
+// A triangle on its way to a cell. Tangents are built before the triangles are split up,
+// so they match on both sides of a cell border.
+struct CellTriangle {
+    Vertex verts[3];
+    u32 material;
+};
+
+struct CellGrid {
+    vec3 origin;
+    vec3 cellSize;
+    ivec3 dims;
+
+    u32 numCells() const { return u32(dims.x * dims.y * dims.z); }
+
+    u32 cellIndex(vec3 point) const {
+        ivec3 cell;
+        for (int c = 0; c < 3; c++) {
+            cell[c] = std::min(std::max(int((point[c] - origin[c]) / cellSize[c]), 0), dims[c] - 1);
+        }
+        return u32((cell.z * dims.y + cell.y) * dims.x + cell.x);
+    }
+};
+
+// Splits the longest cell edge in half until there are enough cells for the triangle count.
+static CellGrid chooseGrid(const Bounds &bounds, u64 numTriangles, u32 maxCellTriangles) {
+    const u32 maxCells = 1 << 14;
+    u64 targetCells = std::min(u64(maxCells), std::max(u64(1), (numTriangles + maxCellTriangles - 1) / maxCellTriangles));
+
+    CellGrid grid;
+    grid.origin = bounds.min;
+    grid.dims = ivec3(1);
+    vec3 extent = isEmpty(bounds) ? vec3(1) : bounds.max - bounds.min;
+    while (u64(grid.numCells()) * 2 <= targetCells) {
+        int axis = 0;
+        for (int c = 1; c < 3; c++) {
+            if (extent[c] / grid.dims[c] > extent[axis] / grid.dims[axis]) axis = c;
+        }
+        grid.dims[axis] *= 2;
+    }
+    for (int c = 0; c < 3; c++) {
+        grid.cellSize[c] = std::max(extent[c] / grid.dims[c], 1e-6f);
+    }
+    return grid;
+}
+
+// Triangles are collected per cell and spilled to a scratch file in blocks, then read back one
+// cell at a time. That keeps the amount of geometry in memory bounded no matter the scene size.
+struct CellBins {
+    fstream scratch;
+    u64 scratchSize = 0;
+    vector<vector<CellTriangle>> pending;
+    vector<vector<pair<u64, u32>>> blocks; // offset and count of each spilled block, per cell
+    vector<u64> counts;                    // triangles per cell
+    vector<Bounds> centroids;              // box of the triangle centroids per cell
+    u64 numPending = 0;
+
+    static const u32 blockTriangles = 1 << 12;
+    static const u64 maxPending = 1 << 18;
+
+    u32 addCells(u32 count) {
+        u32 first = u32(counts.size());
+        pending.resize(first + count);
+        blocks.resize(first + count);
+        counts.resize(first + count, 0);
+        centroids.resize(first + count, emptyBounds());
+        return first;
+    }
+
+    void spill(u32 cell) {
+        vector<CellTriangle> &tris = pending[cell];
+        if (tris.empty()) return;
+        // Reads move the same file position, so always append at the end.
+        scratch.seekp(streamoff(scratchSize));
+        scratch.write((const char *) tris.data(), streamsize(tris.size() * sizeof(CellTriangle)));
+        blocks[cell].push_back(make_pair(scratchSize, u32(tris.size())));
+        scratchSize += tris.size() * sizeof(CellTriangle);
+        numPending -= tris.size();
+        tris.clear();
+    }
+
+    void add(u32 cell, const CellTriangle &tri, vec3 centroid) {
+        addPoint(centroids[cell], centroid);
+        counts[cell]++;
+        pending[cell].push_back(tri);
+        numPending++;
+        if (pending[cell].size() >= blockTriangles) {
+            spill(cell);
+        } else if (numPending >= maxPending) {
+            for (u32 c = 0, n = u32(pending.size()); c < n; c++) spill(c);
+        }
+    }
+
+    void read(u32 cell, vector<CellTriangle> &tris) {
+        tris.clear();
+        for (const pair<u64, u32> &block : blocks[cell]) {
+            size_t start = tris.size();
+            tris.resize(start + block.second);
+            scratch.seekg(streamoff(block.first));
+            scratch.read((char *) &tris[start], streamsize(block.second * sizeof(CellTriangle)));
+        }
+        tris.insert(tris.end(), pending[cell].begin(), pending[cell].end());
+    }
+
+    // Moves the triangles of cell into new cells of a grid over its centroids, reading them back
+    // a block at a time. If the centroids are closer together than chooseGrid's smallest cell,
+    // the grid can't separate them, so they're dealt out by count instead. Returns the first new
+    // cell, and the number of them in numCells.
+    u32 split(u32 cell, u32 maxCellTriangles, u32 &numCells) {
+        Bounds bounds = centroids[cell];
+        centerBounds(bounds);
+        CellGrid grid = chooseGrid(bounds, counts[cell], maxCellTriangles);
+        vec3 extent = bounds.max - bounds.min;
+        bool byCount = std::max(extent.x, std::max(extent.y, extent.z)) < 1e-5f;
+        numCells = byCount ? u32((counts[cell] + maxCellTriangles - 1) / maxCellTriangles) : grid.numCells();
+        u32 first = addCells(numCells);
+        vector<pair<u64, u32>> cellBlocks;
+        vector<CellTriangle> tris;
+        cellBlocks.swap(blocks[cell]);
+        tris.swap(pending[cell]);
+        numPending -= tris.size();
+        u64 dealt = 0;
+        auto addAll = [&]() {
+            for (const CellTriangle &tri : tris) {
+                vec3 centroid = (tri.verts[0].position + tri.verts[1].position + tri.verts[2].position) / 3.f;
+                u32 target = byCount ? u32(dealt++ / maxCellTriangles) : grid.cellIndex(centroid);
+                add(first + target, tri, centroid);
+            }
+        };
+        addAll();
+        for (const pair<u64, u32> &block : cellBlocks) {
+            tris.resize(block.second);
+            scratch.seekg(streamoff(block.first));
+            scratch.read((char *) tris.data(), streamsize(block.second * sizeof(CellTriangle)));
+            addAll();
+        }
+        counts[cell] = 0;
+        centroids[cell] = emptyBounds();
+        return first;
+    }
+};
+
+static u64 hashVertex(const Vertex &vert) {
+    u64 words[sizeof(Vertex) / 8];
+    static_assert(sizeof(Vertex) % 8 == 0, "Vertex is hashed 8 bytes at a time");
+    memcpy(words, &vert, sizeof(words));
+    u64 hash = 0x9E3779B97F4A7C15ULL;
+    for (u64 word : words) {
+        hash = (hash ^ word) * 0xC2B2AE3D27D4EB4FULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+// Turns a cell's triangle soup into shared vertices, indices and one part per material.
+static void buildCell(vector<CellTriangle> &tris, vector<Vertex> &verts, vector<u32> &indices, vector<MeshPart> &parts) {
+    stable_sort(tris.begin(), tris.end(), [](const CellTriangle &a, const CellTriangle &b) {
+        return a.material < b.material;
+    });
+
+    // Open addressing on the vertex bytes, storing vertex index + 1 so that 0 means empty.
+    u64 capacity = 16;
+    while (capacity < u64(tris.size()) * 3 * 2) capacity <<= 1;
+    vector<u32> table(capacity, 0);
+    u64 mask = capacity - 1;
+
+    verts.clear();
+    indices.clear();
+    parts.clear();
+    for (const CellTriangle &tri : tris) {
+        if (parts.empty() || parts.back().material != tri.material) {
+            parts.push_back(MeshPart { u32(indices.size()), 0, 0, u16(tri.material), 0, GL_UNSIGNED_INT });
+        }
+        for (const Vertex &vert : tri.verts) {
+            u64 slot = hashVertex(vert) & mask;
+            while (table[slot] && memcmp(&verts[table[slot] - 1], &vert, sizeof(Vertex)) != 0) {
+                slot = (slot + 1) & mask;
+            }
+            if (!table[slot]) {
+                verts.push_back(vert);
+                table[slot] = u32(verts.size());
+            }
+            indices.push_back(table[slot] - 1);
+        }
+        parts.back().size += 3;
+    }
+}
+
+bool buildCellFile(const string &path, const string &filename, u32 maxCellTriangles) {
+    auto startTime = chrono::high_resolution_clock::now();
+    string objFile = path + '/' + filename;
+    string cellFile = cellFileFor(objFile);
+
+    CellFileHeader header;
+    memset(&header, 0, sizeof(header));
+    SourceInfo source;
+    if (!statSource(objFile, source)) {
+        printf("Could not open obj file: %s\n", objFile.c_str());
+        return false;
+    }
+
+    Bounds sceneBounds;
+    u64 numTriangles;
+    if (!scanObjFile(path, filename, sceneBounds, numTriangles)) {
+        return false;
+    }
+    CellGrid grid = chooseGrid(sceneBounds, numTriangles, maxCellTriangles);
+    printf("Splitting %u triangles into a %dx%dx%d grid of cells\n", u32(numTriangles), grid.dims.x, grid.dims.y, grid.dims.z);
+
+    CellBins bins;
+    string scratchFile = cellFile + ".scratch";
+    bins.scratch.open(scratchFile, ios::in | ios::out | ios::binary | ios::trunc);
+    if (!bins.scratch) {
+        printf("Warning: Could not create %s\n", scratchFile.c_str());
+        return false;
+    }
+    bins.addCells(grid.numCells());
+
+    OBJMesh obj;
+    vector<Vertex> spanVerts;
+    bool loaded = loadObjFileStreaming(path, filename, obj, [&](const OBJMesh &, OBJMeshSpan &span) {
+        buildVertexData(span.verts, span.indices, spanVerts);
+        CellTriangle tri;
+        tri.material = span.materialIndex;
+        for (u32 c = 0, n = u32(span.indices.size()); c + 2 < n; c += 3) {
+            for (u32 v = 0; v < 3; v++) {
+                tri.verts[v] = spanVerts[span.indices[c + v]];
+            }
+            vec3 centroid = (tri.verts[0].position + tri.verts[1].position + tri.verts[2].position) / 3.f;
+            bins.add(grid.cellIndex(centroid), tri, centroid);
+        }
+        return true;
+    });
+    if (!loaded || !bins.scratch) {
+        printf("Warning: Failed to split %s into cells\n", objFile.c_str());
+        bins.scratch.close();
+        remove(scratchFile.c_str());
+        return false;
+    }
+    bins.scratch.flush();
+
+    // The grid is uniform, so dense parts of the scene overfill their cells. Those are split
+    // again over their own triangles until every cell fits, which keeps what buildCell holds
+    // in memory bounded too.
+    u32 numSplit = 0;
+    for (u32 c = 0; c < u32(bins.counts.size()); c++) {
+        if (bins.counts[c] <= maxCellTriangles) continue;
+        u32 numCells;
+        bins.split(c, maxCellTriangles, numCells);
+        numSplit++;
+    }
+    if (numSplit) printf("Split %u overfull cells again\n", numSplit);
+    if (!bins.scratch) {
+        printf("Warning: Failed to split %s into cells\n", objFile.c_str());
+        bins.scratch.close();
+        remove(scratchFile.c_str());
+        return false;
+    }
+
+    string tempFile = cellFile + ".tmp";
+    ofstream output(tempFile, ios::binary | ios::trunc);
+    if (!output) {
+        printf("Warning: Could not write cell file %s\n", cellFile.c_str());
+        bins.scratch.close();
+        remove(scratchFile.c_str());
+        return false;
+    }
+
+    auto writeSection = [&](u64 offset, const void *data, u64 size) {
+        static const char padding[16] = {};
+        output.write(padding, streamsize(offset - u64(output.tellp())));
+        output.write((const char *) data, streamsize(size));
+    };
+    output.write((const char *) &header, sizeof(header)); // placeholder, rewritten at the end
+
+    vector<CellInfo> cells;
+    vector<CellTriangle> tris;
+    vector<Vertex> verts;
+    vector<u32> indices;
+    vector<MeshPart> parts;
+    u64 totalVerts = 0;
+    for (u32 c = 0, n = u32(bins.counts.size()); c < n; c++) {
+        if (bins.counts[c] == 0) continue;
+        bins.read(c, tris);
+        if (tris.empty()) continue;
+        buildCell(tris, verts, indices, parts);
+
+        CellInfo cell;
+        cell.unused = 0;
+        cell.bounds = emptyBounds();
+        for (const Vertex &vert : verts) addPoint(cell.bounds, vert.position);
+        centerBounds(cell.bounds);
+        for (const Vertex &vert : verts) addSpherePoint(cell.bounds, vert.position);
+        cell.numVerts = u32(verts.size());
+        cell.numIndices = u32(indices.size());
+        cell.numParts = u32(parts.size());
+        cell.vertsOffset = align16(u64(output.tellp()));
+        writeSection(cell.vertsOffset, verts.data(), verts.size() * sizeof(Vertex));
+        cell.indicesOffset = align16(u64(output.tellp()));
+        writeSection(cell.indicesOffset, indices.data(), indices.size() * sizeof(u32));
+        cell.partsOffset = align16(u64(output.tellp()));
+        writeSection(cell.partsOffset, parts.data(), parts.size() * sizeof(MeshPart));
+        cells.push_back(cell);
+        totalVerts += verts.size();
+    }
+    bins.scratch.close();
+    remove(scratchFile.c_str());
+
+    string strings;
+    vector<CachedLibrary> libraries(obj.materialLibraries.size());
+    for (u32 c = 0, n = u32(libraries.size()); c < n; c++) {
+        if (!packLibrary(obj.materialLibraries[c], strings, libraries[c])) {
+            printf("Warning: Could not read %s, not writing a cell file\n", obj.materialLibraries[c].c_str());
+            output.close();
+            remove(tempFile.c_str());
+            return false;
+        }
+    }
+    vector<CachedString> cachedTextures;
+    for (const OBJTexture &tex : obj.textures) {
+        cachedTextures.push_back(addCachedString(strings, tex.name));
+    }
+    vector<CachedMaterial> cachedMaterials(obj.materials.size());
+    for (u32 c = 0, n = u32(obj.materials.size()); c < n; c++) {
+        Material mat;
+        obj2mesh_material(obj.materials[c], mat);
+        packMaterial(mat, strings, cachedMaterials[c]);
+    }
+
+    header.magic = CELL_FILE_MAGIC;
+    header.version = CELL_FILE_VERSION;
+    header.vertexSize = sizeof(Vertex);
+    header.numTextures = u32(cachedTextures.size());
+    header.numMaterials = u32(cachedMaterials.size());
+    header.numCells = u32(cells.size());
+    header.numLibraries = u32(libraries.size());
+    header.sourceSize = source.size;
+    header.sourceMtime = source.mtime;
+    header.cellsOffset = align16(u64(output.tellp()));
+    writeSection(header.cellsOffset, cells.data(), cells.size() * sizeof(CellInfo));
+    header.texturesOffset = align16(u64(output.tellp()));
+    writeSection(header.texturesOffset, cachedTextures.data(), cachedTextures.size() * sizeof(CachedString));
+    header.materialsOffset = align16(u64(output.tellp()));
+    writeSection(header.materialsOffset, cachedMaterials.data(), cachedMaterials.size() * sizeof(CachedMaterial));
+    header.librariesOffset = align16(u64(output.tellp()));
+    writeSection(header.librariesOffset, libraries.data(), libraries.size() * sizeof(CachedLibrary));
+    header.stringsOffset = align16(u64(output.tellp()));
+    writeSection(header.stringsOffset, strings.data(), strings.size());
+    header.fileSize = u64(output.tellp());
+    output.seekp(0);
+    output.write((const char *) &header, sizeof(header));
+    output.close();
+    if (!output) {
+        printf("Warning: Failed writing cell file %s\n", cellFile.c_str());
+        remove(tempFile.c_str());
+        return false;
+    }
+
+    remove(cellFile.c_str()); // rename won't replace an existing file on Windows
+    if (rename(tempFile.c_str(), cellFile.c_str()) != 0) {
+        printf("Warning: Could not replace cell file %s\n", cellFile.c_str());
+        return false;
+    }
+
+    chrono::duration<double> seconds = chrono::high_resolution_clock::now() - startTime;
+    printf("Built cell file %s in %ums (%u cells, %u vertices, %.1f MB)\n", cellFile.c_str(),
+           u32(seconds.count() * 1000), header.numCells, u32(totalVerts), header.fileSize / (1024.0 * 1024.0));
+    return true;
+}
+
+// ------------------ End Cell Builder ---------------------
+
+struct ResidentCell {
+    GLuint vao = 0; // 0 if the cell isn't on the GPU
+    GLuint verts = 0;
+    GLuint indices = 0;
+};
+
+static struct {
+    MappedFile file;
+    const CellInfo *cells = nullptr;
+    u32 numCells = 0;
+    vector<ResidentCell> resident;
+    vector<u16> shaders; // per material
+    u64 residentBytes = 0;
+} cellFile;
+
+static u64 cellBytes(const CellInfo &cell) {
+    return u64(cell.numVerts) * sizeof(Vertex) + u64(cell.numIndices) * sizeof(u32);
+}
+
+bool openCellFile(const string &objFile, Mesh &mesh, vector<OBJTexture> &textures) {
+    string filename = cellFileFor(objFile);
+    MappedFile &file = cellFile.file;
+    if (!mapFile(filename, file)) {
+        return false; // not built yet
+    }
+
+    // The OBJ is only checked by size and date; hashing it could take minutes at these sizes. The
+    // materials are baked in too, so their libraries are checked like the mesh cache does.
+    CellFileHeader header;
+    SourceInfo source;
+    bool valid = file.size >= sizeof(header);
+    if (valid) {
+        memcpy(&header, file.data, sizeof(header));
+        valid = header.magic == CELL_FILE_MAGIC &&
+                header.version == CELL_FILE_VERSION &&
+                header.vertexSize == sizeof(Vertex) &&
+                header.fileSize == file.size &&
+                header.librariesOffset <= file.size &&
+                header.numLibraries <= (file.size - header.librariesOffset) / sizeof(CachedLibrary) &&
+                header.stringsOffset <= file.size &&
+                statSource(objFile, source) &&
+                header.sourceSize == source.size &&
+                header.sourceMtime == source.mtime;
+    }
+    const char *strings = file.data + header.stringsOffset;
+    const CachedLibrary *libraries = (const CachedLibrary *) (file.data + header.librariesOffset);
+    for (u32 c = 0; valid && c < header.numLibraries; c++) {
+        const CachedString &name = libraries[c].name;
+        valid = u64(name.offset) + name.length <= file.size - header.stringsOffset &&
+                sourceUnchanged(readCachedString(strings, name), libraries[c].size, libraries[c].mtime, libraries[c].hash);
+    }
+    if (!valid) {
+        printf("Cell file %s is out of date\n", filename.c_str());
+        unmapFile(file);
+        return false;
+    }
+
+    const CachedString *cachedTextures = (const CachedString *) (file.data + header.texturesOffset);
+    textures.resize(header.numTextures);
+    for (u32 c = 0; c < header.numTextures; c++) {
+        textures[c].name = readCachedString(strings, cachedTextures[c]);
+        textures[c].texName = UNLOADED;
+    }
+    mesh.textures.assign(header.numTextures, Texture { BAD_TEX });
+
+    const CachedMaterial *cachedMaterials = (const CachedMaterial *) (file.data + header.materialsOffset);
+    mesh.materials.resize(header.numMaterials);
+    for (u32 c = 0; c < header.numMaterials; c++) {
+        unpackMaterial(cachedMaterials[c], strings, mesh.materials[c]);
+    }
+    mesh.parts.clear();
+    mesh.size = 0;
+
+    cellFile.cells = (const CellInfo *) (file.data + header.cellsOffset);
+    cellFile.numCells = header.numCells;
+    cellFile.resident.assign(header.numCells, ResidentCell());
+    cellFile.shaders.clear();
+    cellFile.residentBytes = 0;
+
+    printf("Opened cell file %s (%u cells, %.1f MB)\n", filename.c_str(), header.numCells, file.size / (1024.0 * 1024.0));
+    return true;
+}
+
+static void pageIn(u32 index) {
+    const CellInfo &cell = cellFile.cells[index];
+    ResidentCell &res = cellFile.resident[index];
+    res.vao = createVao();
+    glGetIntegerv(GL_ARRAY_BUFFER_BINDING, (GLint *) &res.verts);
+    glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, (GLint *) &res.indices);
+    // Straight from the mapping; the OS reads the pages in from disk and can drop them again afterwards.
+    glBufferData(GL_ARRAY_BUFFER, cell.numVerts * sizeof(Vertex), cellFile.file.data + cell.vertsOffset, GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, cell.numIndices * sizeof(u32), cellFile.file.data + cell.indicesOffset, GL_STATIC_DRAW);
+    checkError();
+    cellFile.residentBytes += cellBytes(cell);
+}
+
+static void pageOut(u32 index) {
+    ResidentCell &res = cellFile.resident[index];
+    glDeleteVertexArrays(1, &res.vao);
+    glDeleteBuffers(1, &res.verts);
+    glDeleteBuffers(1, &res.indices);
+    res = ResidentCell();
+    cellFile.residentBytes -= cellBytes(cellFile.cells[index]);
+}
+
+void updateCells(const Mesh &mesh, vec3 camPos, u64 budgetBytes) {
+    if (!cellFile.cells) return;
+
+    // Textures are loaded by now, so the shaders won't change.
+    if (cellFile.shaders.size() != mesh.materials.size()) {
+        cellFile.shaders.resize(mesh.materials.size());
+        for (u32 c = 0, n = u32(mesh.materials.size()); c < n; c++) {
+            cellFile.shaders[c] = findShader(mesh, mesh.materials[c]);
+        }
+    }
+
+    u32 numCells = cellFile.numCells;
+    vector<f32> distance(numCells);
+    vector<u32> order(numCells);
+    for (u32 c = 0; c < numCells; c++) {
+        const Bounds &bounds = cellFile.cells[c].bounds;
+        vec3 outside = glm::max(glm::max(bounds.min - camPos, vec3(0)), camPos - bounds.max);
+        distance[c] = length(outside);
+        order[c] = c;
+    }
+    sort(order.begin(), order.end(), [&](u32 a, u32 b) { return distance[a] < distance[b]; });
+
+    // The nearest cells that fit in the budget should be resident.
+    vector<bool> wanted(numCells, false);
+    u64 wantedBytes = 0;
+    for (u32 c : order) {
+        u64 bytes = cellBytes(cellFile.cells[c]);
+        if (wantedBytes + bytes > budgetBytes) break;
+        wanted[c] = true;
+        wantedBytes += bytes;
+    }
+
+    // Free memory before using more, so the budget holds at every point.
+    u32 pagedOut = 0;
+    for (u32 c = 0; c < numCells; c++) {
+        if (cellFile.resident[c].vao && !wanted[c]) {
+            pageOut(c);
+            pagedOut++;
+        }
+    }
+
+    // Closest first, and only so much per frame to keep frame times even.
+    const u64 maxUploadBytes = 32 << 20;
+    u64 uploaded = 0;
+    u32 pagedIn = 0;
+    for (u32 c : order) {
+        if (!wanted[c] || cellFile.resident[c].vao) continue;
+        u64 bytes = cellBytes(cellFile.cells[c]);
+        if (uploaded > 0 && uploaded + bytes > maxUploadBytes) break;
+        pageIn(c);
+        uploaded += bytes;
+        pagedIn++;
+    }
+
+    if (pagedIn || pagedOut) {
+        printf("Cells: paged in %u, paged out %u, %.1f MB resident\n", pagedIn, pagedOut,
+               cellFile.residentBytes / (1024.0 * 1024.0));
+    }
+}
+
+void drawCells(const mat4 &mvp, const vec3 &camPos, const vec3 &lightPos, const Mesh &mesh) {
+    for (u32 c = 0; c < cellFile.numCells; c++) {
+        const ResidentCell &res = cellFile.resident[c];
+        if (!res.vao) continue;
+        const CellInfo &cell = cellFile.cells[c];
+        const MeshPart *parts = (const MeshPart *) (cellFile.file.data + cell.partsOffset);
+        glBindVertexArray(res.vao);
+        for (u32 p = 0; p < cell.numParts; p++) {
+            const MeshPart &mp = parts[p];
+            bindShader(cellFile.shaders[mp.material]);
+            bindMaterial(mvp, camPos, lightPos, mesh, mesh.materials[mp.material]);
+            glDrawElements(GL_TRIANGLES, mp.size, GL_UNSIGNED_INT, (void *)(mp.offset * sizeof(u32)));
+        }
+    }
+}
+
+void closeCellFile() {
+    if (!cellFile.cells) return;
+    for (u32 c = 0; c < cellFile.numCells; c++) {
+        if (cellFile.resident[c].vao) pageOut(c);
+    }
+    unmapFile(cellFile.file);
+    cellFile.cells = nullptr;
+    cellFile.numCells = 0;
+    cellFile.resident.clear();
+}
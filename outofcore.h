@@ -0,0 +1,36 @@
+#ifndef SPONZA_OUTOFCORE_H
+#define SPONZA_OUTOFCORE_H
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "mesh.h"
+#include "obj.h"
+
+// Out-of-core scenes. For scenes too big for one mesh, the OBJ file is split once into a grid
+// of spatial cells, stored next to it as <objFile>.cells. Every cell has its own vertex and
+// 32 bit index buffers, so the scene as a whole has no size limit. At runtime the cells
+// nearest to the camera are kept on the GPU, within a fixed memory budget, and the rest
+// stay on disk.
+#define CELL_FILE_VERSION 3
+
+// Splits path/filename into cells of at most maxCellTriangles triangles and writes the cell file.
+// A uniform grid comes first, and cells that dense parts of the scene overfill are split again.
+// Only the file's attributes and a bounded number of triangles are held in memory at once.
+bool buildCellFile(const std::string &path, const std::string &filename, u32 maxCellTriangles);
+
+// Opens the cell file for objFile if there is an up to date one, filling in mesh.materials.
+// Textures are returned by name; the caller loads them and fills in mesh.textures.
+bool openCellFile(const std::string &objFile, Mesh &mesh, std::vector<OBJTexture> &textures);
+
+// Pages cells in and out so that the ones nearest to camPos are on the GPU, using at most
+// budgetBytes of buffer memory. Uploads are spread over frames. Call once per frame.
+void updateCells(const Mesh &mesh, glm::vec3 camPos, u64 budgetBytes);
+
+// Draws every cell that's on the GPU.
+void drawCells(const glm::mat4 &mvp, const glm::vec3 &camPos, const glm::vec3 &lightPos, const Mesh &mesh);
+
+// Frees the GPU buffers and closes the cell file.
+void closeCellFile();
+
+#endif //SPONZA_OUTOFCORE_H
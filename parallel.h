@@ -0,0 +1,36 @@
+#ifndef SPONZA_PARALLEL_H
+#define SPONZA_PARALLEL_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "types.h"
+
+inline u32 hardwareThreads() {
+    u32 count = std::thread::hardware_concurrency();
+    return count ? count : 1;
+}
+
+// Calls job(i) for every i in [0, count), spread across up to numThreads threads.
+// The calling thread does work too, and the call returns when every job is done.
+template <typename Job>
+void parallelFor(u32 count, u32 numThreads, const Job &job) {
+    std::atomic<u32> next(0);
+    auto worker = [&]() {
+        for (u32 i = next++; i < count; i = next++) {
+            job(i);
+        }
+    };
+
+    if (numThreads > count) numThreads = count;
+    std::vector<std::thread> threads;
+    for (u32 c = 1; c < numThreads; c++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+#endif //SPONZA_PARALLEL_H
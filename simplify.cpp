@@ -0,0 +1,386 @@
+#include "simplify.h"
+
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "obj.h"
+
+using namespace std;
+using namespace glm;
+
+#define NO_VERTEX 0xFFFFFFFF
+#define MANY_VERTICES 0xFFFFFFFE
+
+// Each pass collapses edges whose neighborhoods don't overlap, then the adjacency is rebuilt.
+static const u32 kMaxPasses = 64;
+
+enum VertexKind : u8 {
+    kManifold, // inside the surface, can collapse onto any neighbor
+    kBorder,   // on an open edge, can only collapse along it
+    kSeam,     // on an attribute seam with one twin, can only collapse along the seam, together with its twin
+    kLocked,   // where borders or seams meet, locked by the caller, or anything stranger, never collapses
+};
+
+// Sum of squared distances to a set of planes, as x'Ax + 2b'x + c, and the number of planes.
+struct Quadric {
+    f64 a00, a11, a22, a01, a02, a12;
+    f64 b0, b1, b2;
+    f64 c;
+    f64 weight;
+};
+
+static void addPlane(Quadric &q, dvec3 n, f64 d) {
+    q.a00 += n.x * n.x;
+    q.a11 += n.y * n.y;
+    q.a22 += n.z * n.z;
+    q.a01 += n.x * n.y;
+    q.a02 += n.x * n.z;
+    q.a12 += n.y * n.z;
+    q.b0 += n.x * d;
+    q.b1 += n.y * d;
+    q.b2 += n.z * d;
+    q.c += d * d;
+    q.weight += 1;
+}
+
+static void addQuadric(Quadric &into, const Quadric &q) {
+    into.a00 += q.a00;
+    into.a11 += q.a11;
+    into.a22 += q.a22;
+    into.a01 += q.a01;
+    into.a02 += q.a02;
+    into.a12 += q.a12;
+    into.b0 += q.b0;
+    into.b1 += q.b1;
+    into.b2 += q.b2;
+    into.c += q.c;
+    into.weight += q.weight;
+}
+
+static f64 quadricError(const Quadric &q, vec3 point) {
+    dvec3 p(point);
+    f64 error = q.a00 * p.x * p.x + q.a11 * p.y * p.y + q.a22 * p.z * p.z +
+                2 * (q.a01 * p.x * p.y + q.a02 * p.x * p.z + q.a12 * p.y * p.z) +
+                2 * (q.b0 * p.x + q.b1 * p.y + q.b2 * p.z) + q.c;
+    return std::max(error, 0.0); // rounding
+}
+
+// For every vertex, the triangles around it and the edges out of it.
+struct Adjacency {
+    vector<u32> start;     // per vertex, plus one past the end, into the arrays below
+    vector<u32> next;      // the vertex after it in each triangle, so the edge vertex -> next
+    vector<u32> triangles;
+};
+
+static void buildAdjacency(const vector<u32> &tris, u32 numVerts, Adjacency &adj) {
+    adj.start.assign(numVerts + 1, 0);
+    for (u32 v : tris) {
+        adj.start[v + 1]++;
+    }
+    for (u32 c = 0; c < numVerts; c++) {
+        adj.start[c + 1] += adj.start[c];
+    }
+    adj.next.resize(tris.size());
+    adj.triangles.resize(tris.size());
+    vector<u32> fill(adj.start.begin(), adj.start.end() - 1);
+    for (u32 c = 0, n = u32(tris.size()); c < n; c++) {
+        u32 slot = fill[tris[c]]++;
+        adj.next[slot] = tris[c % 3 == 2 ? c - 2 : c + 1];
+        adj.triangles[slot] = c / 3;
+    }
+}
+
+static bool hasEdge(const Adjacency &adj, u32 from, u32 to) {
+    for (u32 c = adj.start[from], end = adj.start[from + 1]; c < end; c++) {
+        if (adj.next[c] == to) return true;
+    }
+    return false;
+}
+
+static bool isSingle(u32 vertex) {
+    return vertex != NO_VERTEX && vertex != MANY_VERTICES;
+}
+
+struct Collapse {
+    u32 from, to;         // from moves onto to
+    u32 twinFrom, twinTo; // for seams, the same on the other side, or NO_VERTEX
+    f64 cost;
+};
+
+f32 simplifyTriangles(const vector<OBJVertex> &verts, const u32 *indices, u32 numIndices,
+                      u32 targetIndices, const u8 *lockedVerts, vector<u32> &result) {
+    result.clear();
+    if (numIndices == 0) return 0;
+
+    // Number the vertices locally so every array below is the size of this range.
+    vector<u32> globalIndex(indices, indices + numIndices);
+    sort(globalIndex.begin(), globalIndex.end());
+    globalIndex.erase(unique(globalIndex.begin(), globalIndex.end()), globalIndex.end());
+    u32 numVerts = u32(globalIndex.size());
+    vector<u32> tris(numIndices);
+    for (u32 c = 0; c < numIndices; c++) {
+        tris[c] = u32(lower_bound(globalIndex.begin(), globalIndex.end(), indices[c]) - globalIndex.begin());
+    }
+    vector<vec3> pos(numVerts);
+    for (u32 c = 0; c < numVerts; c++) {
+        pos[c] = verts[globalIndex[c]].position;
+    }
+
+    // Vertices at the same position, which differ in normal or uv, are linked in a ring through wedge.
+    // rep is the first of each ring; quadrics and locks are per position so they live there.
+    vector<u32> order(numVerts);
+    for (u32 c = 0; c < numVerts; c++) {
+        order[c] = c;
+    }
+    sort(order.begin(), order.end(), [&](u32 a, u32 b) {
+        if (pos[a].x != pos[b].x) return pos[a].x < pos[b].x;
+        if (pos[a].y != pos[b].y) return pos[a].y < pos[b].y;
+        return pos[a].z < pos[b].z;
+    });
+    vector<u32> rep(numVerts), wedge(numVerts);
+    for (u32 start = 0, end; start < numVerts; start = end) {
+        for (end = start + 1; end < numVerts && pos[order[end]] == pos[order[start]]; end++) {}
+        for (u32 c = start; c < end; c++) {
+            rep[order[c]] = order[start];
+            wedge[order[c]] = order[c + 1 < end ? c + 1 : start];
+        }
+    }
+    vector<u8> pinned(numVerts); // by rep, positions the caller locked
+    if (lockedVerts) {
+        for (u32 c = 0; c < numVerts; c++) {
+            pinned[rep[c]] |= lockedVerts[globalIndex[c]];
+        }
+    }
+
+    Adjacency adj;
+    buildAdjacency(tris, numVerts, adj);
+
+    // Every position starts with the planes of its triangles, plus planes through the open edges,
+    // perpendicular to their triangles, so that borders and seams keep their shape too.
+    vector<Quadric> quadrics(numVerts, Quadric());
+    for (u32 c = 0; c < numIndices; c += 3) {
+        vec3 normal = cross(pos[tris[c + 1]] - pos[tris[c]], pos[tris[c + 2]] - pos[tris[c]]);
+        f32 len = length(normal);
+        if (len == 0) continue;
+        normal /= len;
+        for (u32 k = 0; k < 3; k++) {
+            addPlane(quadrics[rep[tris[c + k]]], dvec3(normal), -f64(dot(normal, pos[tris[c + k]])));
+        }
+        for (u32 k = 0; k < 3; k++) {
+            u32 a = tris[c + k], b = tris[c + (k + 1) % 3];
+            if (hasEdge(adj, b, a)) continue;
+            vec3 edgeNormal = cross(pos[b] - pos[a], normal);
+            f32 edgeLen = length(edgeNormal);
+            if (edgeLen == 0) continue;
+            edgeNormal /= edgeLen;
+            f64 d = -f64(dot(edgeNormal, pos[a]));
+            addPlane(quadrics[rep[a]], dvec3(edgeNormal), d);
+            addPlane(quadrics[rep[b]], dvec3(edgeNormal), d);
+        }
+    }
+
+    vector<u32> openOut(numVerts), openIn(numVerts), twin(numVerts), remap(numVerts);
+    vector<VertexKind> kind(numVerts);
+    vector<u8> locked(numVerts);
+    vector<Collapse> collapses;
+    f64 maxCost = 0;
+    u32 numTriangles = numIndices / 3;
+
+    // Moving from onto to must not flip any triangle that survives. Counts the ones that don't survive.
+    auto checkCollapse = [&](u32 from, u32 to, u32 &removed) {
+        for (u32 c = adj.start[from], end = adj.start[from + 1]; c < end; c++) {
+            const u32 *tri = &tris[adj.triangles[c] * 3];
+            if (rep[tri[0]] == rep[to] || rep[tri[1]] == rep[to] || rep[tri[2]] == rep[to]) {
+                removed++;
+                continue;
+            }
+            vec3 before[3], after[3];
+            for (u32 k = 0; k < 3; k++) {
+                before[k] = pos[tri[k]];
+                after[k] = tri[k] == from ? pos[to] : pos[tri[k]];
+            }
+            vec3 normalBefore = cross(before[1] - before[0], before[2] - before[0]);
+            vec3 normalAfter = cross(after[1] - after[0], after[2] - after[0]);
+            // Turning a triangle much past 75 degrees folds the surface over. Triangles with no
+            // area either way have no orientation to check, so they can't be made or moved.
+            if (dot(normalBefore, normalAfter) <= 0.25f * length(normalBefore) * length(normalAfter)) return false;
+        }
+        return true;
+    };
+
+    // The positions next to a position, over all of its vertices.
+    vector<u32> ringFrom, ringTo;
+    auto gatherRing = [&](u32 vertex, vector<u32> &ring) {
+        ring.clear();
+        u32 v = vertex;
+        do {
+            for (u32 c = adj.start[v], end = adj.start[v + 1]; c < end; c++) {
+                const u32 *tri = &tris[adj.triangles[c] * 3];
+                for (u32 k = 0; k < 3; k++) {
+                    if (rep[tri[k]] != rep[vertex]) ring.push_back(rep[tri[k]]);
+                }
+            }
+            v = wedge[v];
+        } while (v != vertex);
+        sort(ring.begin(), ring.end());
+        ring.erase(unique(ring.begin(), ring.end()), ring.end());
+    };
+
+    // Past the triangles on the edge, any neighbor the two ends share would end up with two
+    // edges to the same place, pinching the surface or folding it onto itself.
+    auto checkLink = [&](u32 from, u32 to, u32 removed) {
+        gatherRing(from, ringFrom);
+        gatherRing(to, ringTo);
+        u32 shared = 0;
+        for (u32 a = 0, b = 0; a < ringFrom.size() && b < ringTo.size();) {
+            if (ringFrom[a] < ringTo[b]) {
+                a++;
+            } else if (ringTo[b] < ringFrom[a]) {
+                b++;
+            } else {
+                shared++;
+                a++;
+                b++;
+            }
+        }
+        return shared <= removed;
+    };
+
+    auto lockAround = [&](u32 vertex) {
+        for (u32 c = adj.start[vertex], end = adj.start[vertex + 1]; c < end; c++) {
+            const u32 *tri = &tris[adj.triangles[c] * 3];
+            locked[rep[tri[0]]] = locked[rep[tri[1]]] = locked[rep[tri[2]]] = 1;
+        }
+    };
+
+    for (u32 pass = 0; pass < kMaxPasses && numTriangles * 3 > targetIndices; pass++) {
+        // An edge is open if the triangle across it doesn't share both of its vertices,
+        // whether that's because there is no triangle (a border) or it has other attributes (a seam).
+        fill(openOut.begin(), openOut.end(), NO_VERTEX);
+        fill(openIn.begin(), openIn.end(), NO_VERTEX);
+        for (u32 c = 0, n = u32(tris.size()); c < n; c++) {
+            u32 a = tris[c], b = tris[c % 3 == 2 ? c - 2 : c + 1];
+            if (hasEdge(adj, b, a)) continue;
+            openOut[a] = openOut[a] == NO_VERTEX ? b : MANY_VERTICES;
+            openIn[b] = openIn[b] == NO_VERTEX ? a : MANY_VERTICES;
+        }
+
+        for (u32 v = 0; v < numVerts; v++) {
+            twin[v] = NO_VERTEX;
+            u32 twins = 0;
+            for (u32 w = wedge[v]; w != v; w = wedge[w]) {
+                if (adj.start[w + 1] == adj.start[w]) continue; // no triangles left
+                twin[v] = w;
+                twins++;
+            }
+            bool open = isSingle(openOut[v]) && isSingle(openIn[v]);
+            if (twins == 0) {
+                kind[v] = openOut[v] == NO_VERTEX && openIn[v] == NO_VERTEX ? kManifold : open ? kBorder : kLocked;
+            } else if (twins == 1 && open && isSingle(openOut[twin[v]]) && isSingle(openIn[twin[v]]) &&
+                       rep[openOut[v]] == rep[openIn[twin[v]]] && rep[openIn[v]] == rep[openOut[twin[v]]]) {
+                // The seam runs through the position in opposite directions on its two sides.
+                kind[v] = kSeam;
+            } else {
+                kind[v] = kLocked;
+            }
+            if (pinned[rep[v]]) kind[v] = kLocked;
+        }
+
+        // Find every allowed collapse, in the cheaper direction of each edge.
+        auto evaluate = [&](u32 from, u32 to, Collapse &collapse) {
+            collapse = Collapse { from, to, NO_VERTEX, NO_VERTEX, 0 };
+            if (rep[from] == rep[to]) return false; // a degenerate triangle
+            switch (kind[from]) {
+                case kManifold:
+                    break;
+                case kBorder:
+                    if (to != openOut[from] && to != openIn[from]) return false;
+                    break;
+                case kSeam: {
+                    if (to != openOut[from] && to != openIn[from]) return false;
+                    u32 other = twin[from];
+                    collapse.twinFrom = other;
+                    if (rep[openOut[other]] == rep[to]) {
+                        collapse.twinTo = openOut[other];
+                    } else if (rep[openIn[other]] == rep[to]) {
+                        collapse.twinTo = openIn[other];
+                    } else {
+                        return false;
+                    }
+                    break;
+                }
+                default:
+                    return false;
+            }
+            // The mean squared distance to the planes, which keeps the error in the units of the positions
+            // no matter how many planes have piled up.
+            const Quadric &qFrom = quadrics[rep[from]], &qTo = quadrics[rep[to]];
+            f64 weight = std::max(qFrom.weight + qTo.weight, 1.0);
+            collapse.cost = (quadricError(qFrom, pos[to]) + quadricError(qTo, pos[to])) / weight;
+            return true;
+        };
+        collapses.clear();
+        for (u32 c = 0, n = u32(tris.size()); c < n; c++) {
+            u32 a = tris[c], b = tris[c % 3 == 2 ? c - 2 : c + 1];
+            if (a > b && hasEdge(adj, b, a)) continue; // seen from the other side
+            Collapse ab, ba;
+            bool canAB = evaluate(a, b, ab);
+            bool canBA = evaluate(b, a, ba);
+            if (canAB && (!canBA || ab.cost <= ba.cost)) {
+                collapses.push_back(ab);
+            } else if (canBA) {
+                collapses.push_back(ba);
+            }
+        }
+        sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) {
+            return a.cost < b.cost;
+        });
+
+        // Collapse the cheapest edges first. Everything around a collapse is locked for the rest
+        // of the pass, so the flip checks only ever see triangles as they are.
+        fill(locked.begin(), locked.end(), 0);
+        for (u32 c = 0; c < numVerts; c++) {
+            remap[c] = c;
+        }
+        u32 numCollapsed = 0;
+        for (const Collapse &collapse : collapses) {
+            if (numTriangles * 3 <= targetIndices) break;
+            if (locked[rep[collapse.from]]) continue;
+
+            u32 removed = 0;
+            if (!checkCollapse(collapse.from, collapse.to, removed)) continue;
+            if (collapse.twinFrom != NO_VERTEX && !checkCollapse(collapse.twinFrom, collapse.twinTo, removed)) continue;
+            if (!checkLink(collapse.from, collapse.to, removed)) continue;
+
+            remap[collapse.from] = collapse.to;
+            lockAround(collapse.from);
+            if (collapse.twinFrom != NO_VERTEX) {
+                remap[collapse.twinFrom] = collapse.twinTo;
+                lockAround(collapse.twinFrom);
+            }
+            addQuadric(quadrics[rep[collapse.to]], quadrics[rep[collapse.from]]);
+            numTriangles -= std::min(removed, numTriangles);
+            maxCost = std::max(maxCost, collapse.cost);
+            numCollapsed++;
+        }
+        if (numCollapsed == 0) break;
+
+        // Drop the triangles that collapsed, including ones that only did by position.
+        u32 out = 0;
+        for (u32 c = 0, n = u32(tris.size()); c < n; c += 3) {
+            u32 a = remap[tris[c]], b = remap[tris[c + 1]], d = remap[tris[c + 2]];
+            if (rep[a] == rep[b] || rep[b] == rep[d] || rep[d] == rep[a]) continue;
+            tris[out++] = a;
+            tris[out++] = b;
+            tris[out++] = d;
+        }
+        tris.resize(out);
+        numTriangles = out / 3;
+        buildAdjacency(tris, numVerts, adj);
+    }
+
+    result.resize(tris.size());
+    for (u32 c = 0, n = u32(tris.size()); c < n; c++) {
+        result[c] = globalIndex[tris[c]];
+    }
+    return f32(sqrt(maxCost));
+}
@@ -0,0 +1,26 @@
+#ifndef SPONZA_SIMPLIFY_H
+#define SPONZA_SIMPLIFY_H
+
+#include <vector>
+#include "types.h"
+
+struct OBJVertex;
+
+// Simplifies the triangles in indices down to about targetIndices indices with edge collapses,
+// cheapest first by quadric error (Garland and Heckbert). Vertices never move, one just
+// collapses onto a neighbor, so the result indexes the same verts.
+//
+// Vertices are compared by position to find attribute seams. A vertex on a seam or on the open
+// border of the triangles only collapses along it, taking its twin on the other side of a seam
+// with it, and vertices where seams or borders meet stay put. So do the positions of any vertex
+// set in lockedVerts (indexed like verts, may be null). Simplifying one range on its own moves
+// its border, so when ranges that meet are simplified separately, the vertices they share have
+// to be locked or cracks open between them.
+//
+// Writes the triangles to result and returns the error of the worst collapse, as the root mean
+// square distance from where it left the surface to the planes of the triangles it merged away.
+// That's in the units of the positions, so it can be projected to pixels.
+f32 simplifyTriangles(const std::vector<OBJVertex> &verts, const u32 *indices, u32 numIndices,
+                      u32 targetIndices, const u8 *lockedVerts, std::vector<u32> &result);
+
+#endif //SPONZA_SIMPLIFY_H
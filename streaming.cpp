@@ -0,0 +1,231 @@
+#include "streaming.h"
+#include "obj.h"
+#include "memory_usage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <stb/stb_image.h>
+
+using namespace std;
+
+int loadTexture(GLuint texname, const char *filename, int format);
+
+typedef chrono::high_resolution_clock Clock;
+
+// A finished span, ready to upload. Indices are already offset to the span's place in the vertex buffer.
+struct StreamedPart {
+    u16 material;
+    u32 object;
+    Bounds bounds;
+    vector<Vertex> verts;
+    vector<u32> indices;
+};
+
+static struct {
+    thread loader;
+    atomic<bool> cancel;
+    bool active = false;
+    Clock::time_point startTime;
+
+    // Written by the loader thread, guarded by lock.
+    mutex lock;
+    vector<Material> newMaterials;
+    vector<string> newTextures;
+    vector<string> newObjects;
+    vector<StreamedPart> newParts;
+    bool loaderDone = false;
+
+    // GL thread only.
+    string dir;
+    GLuint verts, indices;
+    u64 vertCapacity, indexCapacity; // in elements
+    u32 numVerts, numIndices;
+    vector<string> textureNames;
+    u32 texturesLoaded;
+} streaming;
+
+static void loaderMain(string dir, string filename) {
+    u32 vertBase = 0;
+    u32 numMaterials = 0;
+    u32 numTextures = 0;
+    u32 numObjects = 0;
+
+    OBJMesh obj;
+    loadObjFileStreaming(dir, filename, obj, [&](const OBJMesh &obj, OBJMeshSpan &span) {
+        StreamedPart part;
+        part.material = u16(span.materialIndex);
+        part.object = span.objectIndex;
+        part.bounds = span.bounds;
+        buildVertexData(span.verts, span.indices, part.verts);
+        part.indices = std::move(span.indices);
+        for (u32 &index : part.indices) {
+            index += vertBase;
+        }
+        vertBase += u32(part.verts.size());
+
+        lock_guard<mutex> guard(streaming.lock);
+        for (; numMaterials < obj.materials.size(); numMaterials++) {
+            streaming.newMaterials.emplace_back();
+            obj2mesh_material(obj.materials[numMaterials], streaming.newMaterials.back());
+        }
+        for (; numTextures < obj.textures.size(); numTextures++) {
+            streaming.newTextures.push_back(obj.textures[numTextures].name);
+        }
+        for (; numObjects < obj.objects.size(); numObjects++) {
+            streaming.newObjects.push_back(obj.objects[numObjects].name);
+        }
+        streaming.newParts.push_back(std::move(part));
+        return !streaming.cancel;
+    });
+
+    lock_guard<mutex> guard(streaming.lock);
+    streaming.loaderDone = true;
+}
+
+// Replaces buffer with a bigger one holding the same first usedBytes.
+static void growBuffer(GLuint &buffer, u64 usedBytes, u64 newBytes) {
+    GLuint bigger;
+    glGenBuffers(1, &bigger);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bigger);
+    glBufferData(GL_COPY_WRITE_BUFFER, newBytes, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedBytes);
+    glDeleteBuffers(1, &buffer);
+    buffer = bigger;
+}
+
+static void uploadPart(Mesh &mesh, const StreamedPart &part) {
+    u32 numVerts = u32(part.verts.size());
+    u32 numIndices = u32(part.indices.size());
+
+    glBindVertexArray(mesh.vao);
+    if (streaming.numVerts + numVerts > streaming.vertCapacity) {
+        streaming.vertCapacity = max(streaming.vertCapacity * 2, u64(streaming.numVerts + numVerts));
+        growBuffer(streaming.verts, streaming.numVerts * sizeof(Vertex), streaming.vertCapacity * sizeof(Vertex));
+        glBindBuffer(GL_ARRAY_BUFFER, streaming.verts);
+        bindVertexAttribs();
+    }
+    if (streaming.numIndices + numIndices > streaming.indexCapacity) {
+        streaming.indexCapacity = max(streaming.indexCapacity * 2, u64(streaming.numIndices + numIndices));
+        growBuffer(streaming.indices, streaming.numIndices * sizeof(u32), streaming.indexCapacity * sizeof(u32));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, streaming.indices);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, streaming.verts);
+    glBufferSubData(GL_ARRAY_BUFFER, streaming.numVerts * sizeof(Vertex), numVerts * sizeof(Vertex), part.verts.data());
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, streaming.numIndices * sizeof(u32), numIndices * sizeof(u32), part.indices.data());
+    checkError();
+
+    // Spans never mix objects, so each part is also a single object part.
+    mesh.objectParts.push_back(ObjectPart { streaming.numIndices, numIndices, part.object, u32(mesh.parts.size()) });
+    mesh.parts.push_back(MeshPart { streaming.numIndices, numIndices, 0, part.material, 0, GL_UNSIGNED_INT });
+    mergeBounds(mesh.objects[part.object].bounds, part.bounds);
+    streaming.numVerts += numVerts;
+    streaming.numIndices += numIndices;
+    mesh.size = streaming.numIndices;
+}
+
+void startStreaming(const string &dir, const string &filename, Mesh &mesh) {
+    streaming.startTime = Clock::now();
+    streaming.dir = dir;
+    streaming.numVerts = 0;
+    streaming.numIndices = 0;
+    streaming.texturesLoaded = 0;
+
+    // Start with room for a small scene, growing by doubling.
+    streaming.vertCapacity = 1 << 16;
+    streaming.indexCapacity = 1 << 18;
+    mesh.vao = createVao();
+    mesh.size = 0;
+    glGetIntegerv(GL_ARRAY_BUFFER_BINDING, (GLint *) &streaming.verts);
+    glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, (GLint *) &streaming.indices);
+    glBufferData(GL_ARRAY_BUFFER, streaming.vertCapacity * sizeof(Vertex), nullptr, GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, streaming.indexCapacity * sizeof(u32), nullptr, GL_STATIC_DRAW);
+    checkError();
+
+    streaming.cancel = false;
+    streaming.loaderDone = false;
+    streaming.active = true;
+    streaming.loader = thread(loaderMain, dir, filename);
+}
+
+void updateStreaming(Mesh &mesh) {
+    if (!streaming.active) return;
+
+    vector<Material> materials;
+    vector<string> textures;
+    vector<string> objects;
+    vector<StreamedPart> parts;
+    bool loaderDone;
+    {
+        lock_guard<mutex> guard(streaming.lock);
+        materials.swap(streaming.newMaterials);
+        textures.swap(streaming.newTextures);
+        objects.swap(streaming.newObjects);
+        parts.swap(streaming.newParts);
+        loaderDone = streaming.loaderDone;
+    }
+
+    bool changed = !parts.empty();
+    mesh.materials.insert(mesh.materials.end(), materials.begin(), materials.end());
+    for (string &name : textures) {
+        mesh.textures.push_back(Texture { BAD_TEX });
+        streaming.textureNames.push_back(std::move(name));
+    }
+    for (string &name : objects) {
+        mesh.objects.push_back(MeshObject { std::move(name), emptyBounds() });
+    }
+
+    bool firstPart = mesh.parts.empty() && !parts.empty();
+    for (const StreamedPart &part : parts) {
+        uploadPart(mesh, part);
+    }
+    if (firstPart) {
+        chrono::duration<double> seconds = Clock::now() - streaming.startTime;
+        printf("First streamed part resident after %ums\n", u32(seconds.count() * 1000));
+    }
+
+    // Texture decoding happens here on the GL thread, so spread it over frames.
+    // Parts draw with the plain normal shader until their textures arrive.
+    Clock::time_point budgetStart = Clock::now();
+    while (streaming.texturesLoaded < streaming.textureNames.size() &&
+           Clock::now() - budgetStart < chrono::milliseconds(8)) {
+        u32 index = streaming.texturesLoaded++;
+        string file = streaming.dir + '/' + streaming.textureNames[index];
+        GLuint texName;
+        glGenTextures(1, &texName);
+        if (loadTexture(texName, file.c_str(), STBI_rgb)) {
+            mesh.textures[index].glHandle = texName;
+            changed = true;
+        } else {
+            glDeleteTextures(1, &texName);
+        }
+    }
+
+    if (changed) {
+        assignShaders(mesh);
+    }
+
+    if (loaderDone && streaming.texturesLoaded == streaming.textureNames.size()) {
+        streaming.loader.join();
+        streaming.active = false;
+        chrono::duration<double> seconds = Clock::now() - streaming.startTime;
+        printf("Streaming finished in %ums (%u vertices, %u indices, %zu parts)\n", u32(seconds.count() * 1000),
+               streaming.numVerts, streaming.numIndices, mesh.parts.size());
+        printPeakMemory("streaming");
+    }
+}
+
+bool isStreaming() {
+    return streaming.active;
+}
+
+void stopStreaming() {
+    if (!streaming.active) return;
+    streaming.cancel = true;
+    streaming.loader.join();
+    streaming.active = false;
+}
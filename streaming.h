@@ -0,0 +1,25 @@
+#ifndef SPONZA_STREAMING_H
+#define SPONZA_STREAMING_H
+
+#include <string>
+#include "mesh.h"
+
+// Progressive loading. The OBJ file is parsed on a background thread, which also builds
+// the final vertices for each usemtl span. The GL thread uploads finished spans as new
+// mesh parts, so draw() shows the scene filling in instead of a black window.
+
+// Starts loading dir/filename into mesh. The mesh gets its VAO immediately, and parts,
+// materials and textures as they become available.
+void startStreaming(const std::string &dir, const std::string &filename, Mesh &mesh);
+
+// Uploads whatever the loader finished since the last call, and loads a few textures.
+// Call once per frame on the GL thread.
+void updateStreaming(Mesh &mesh);
+
+// True until the loader is done and everything it produced is on the GPU.
+bool isStreaming();
+
+// Stops the loader early if it's still running.
+void stopStreaming();
+
+#endif //SPONZA_STREAMING_H